@@ -19,278 +19,440 @@
  */
 
 #include "andrixhwtype3.h"
+#include "sharedstate.h"
 
 int analog(uint8_t port) {
+	int32_t value;
+	if(sharedStateRead(SHARED_STATE_ANALOG, port, &value))
+		return value;
 	uint8_t send[2];
-	send[0] = ANALOG_SENSOR_REQUEST;
-	send[1] = port;
-	uint8_t *answer;
+	uint8_t answer[6];
 	uint32_t answerLen;
-	userProgramRequest(send, 2, &answer, &answerLen);
-	int result = ((answer[2] << 8) | answer[3]);
-	free(answer);
+	userProgramRequestInto(send, axcpBuildPortCommand(send, ANALOG_SENSOR_REQUEST, port), answer, sizeof(answer), &answerLen);
+	return axcpParseAnalogReply(answer);
+}
+
+int analogTimeout(uint8_t port, int timeout, int *value) {
+	int32_t shared;
+	uint8_t answer[6];
+	if(sharedStateRead(SHARED_STATE_ANALOG, port, &shared)) {
+		*value = shared;
+		return 0;
+	}
+	int result = requestPortTimeout(ANALOG_SENSOR_REQUEST, port, timeout, answer, SHARED_STATE_ANALOG, &shared);
+	*value = result == 0 ? axcpParseAnalogReply(answer) : shared;
+	return result;
+}
+
+void subscribeAnalog(uint8_t port, int interval) {
+	uint8_t send[4];
+	userProgramSend(send, axcpBuildSubscription(send, ANALOG_SENSOR_SUBSCRIPTION, port, interval));
+}
+
+int readAllAnalog(int *values) {
+	int32_t value[AXCP_SENSOR_PORTS];
+	int port, result = readAllSensors(SHARED_STATE_ANALOG, value);
+	for(port=0; port<AXCP_SENSOR_PORTS; port++)
+		values[port] = value[port];
 	return result;
 }
 
 void setAnalogPullups(bool p0, bool p1, bool p2, bool p3, bool p4, bool p5, bool p6, bool p7, bool p8, bool p9, bool p10, bool p11, bool p12, bool p13, bool p14, bool p15) {
 	uint8_t send[3];
-	send[0] = ANALOG_PULLUP_ACTION;
-	send[1] = (p15 << 7) | (p14 << 6) | (p13 << 5) | (p12 << 4) | (p11 << 3) | (p10 << 2) | (p9 << 1) | (p8);
-	send[2] = (p7 << 7) | (p6 << 6) | (p5 << 5) | (p4 << 4) | (p3 << 3) | (p2 << 2) | (p1 << 1) | (p0);
-	userProgramSend(send, 3);
+	uint16_t mask = (p15 << 15) | (p14 << 14) | (p13 << 13) | (p12 << 12) | (p11 << 11) | (p10 << 10) | (p9 << 9) | (p8 << 8) |
+		(p7 << 7) | (p6 << 6) | (p5 << 5) | (p4 << 4) | (p3 << 3) | (p2 << 2) | (p1 << 1) | (p0);
+	userProgramSend(send, axcpBuildPortMaskCommand(send, ANALOG_PULLUP_ACTION, mask));
 }
 
 bool digital(uint8_t port) {
+	int32_t value;
+	if(sharedStateRead(SHARED_STATE_DIGITAL, port, &value))
+		return value;
 	uint8_t send[2];
-	send[0] = DIGITAL_SENSOR_REQUEST;
-	send[1] = port;
-	uint8_t *answer;
+	uint8_t answer[6];
 	uint32_t answerLen;
-	userProgramRequest(send, 2, &answer, &answerLen);
-	bool result = answer[2];
-	free(answer);
+	userProgramRequestInto(send, axcpBuildPortCommand(send, DIGITAL_SENSOR_REQUEST, port), answer, sizeof(answer), &answerLen);
+	return axcpParseDigitalReply(answer);
+}
+
+int digitalTimeout(uint8_t port, int timeout, bool *value) {
+	int32_t shared;
+	uint8_t answer[6];
+	if(sharedStateRead(SHARED_STATE_DIGITAL, port, &shared)) {
+		*value = shared;
+		return 0;
+	}
+	int result = requestPortTimeout(DIGITAL_SENSOR_REQUEST, port, timeout, answer, SHARED_STATE_DIGITAL, &shared);
+	*value = result == 0 ? axcpParseDigitalReply(answer) : shared;
+	return result;
+}
+
+int readAllDigital(bool *values) {
+	int32_t value[AXCP_SENSOR_PORTS];
+	int port, result = readAllSensors(SHARED_STATE_DIGITAL, value);
+	for(port=0; port<AXCP_SENSOR_PORTS; port++)
+		values[port] = value[port];
 	return result;
 }
 
+void subscribeDigital(uint8_t port, int interval) {
+	uint8_t send[4];
+	userProgramSend(send, axcpBuildSubscription(send, DIGITAL_SENSOR_SUBSCRIPTION, port, interval));
+}
+
+// Callbacks registered via onDigitalChange() and the last level reported per port
+static digital_callback_t digitalCallbacks[16];
+static bool digitalLevels[16];
+
+static void digitalUpdated(const uint8_t *record) {
+	uint8_t port = record[0];
+	if(port >= 16 || digitalCallbacks[port] == NULL || (bool) record[1] == digitalLevels[port])
+		return;
+	digitalLevels[port] = record[1];
+	digitalCallbacks[port](port, digitalLevels[port]);
+}
+
+void onDigitalChange(uint8_t port, digital_callback_t callback) {
+	if(port >= 16)
+		return;
+	digitalCallbacks[port] = callback;
+	if(callback == NULL) {
+		subscribeDigital(port, 0);
+		return;
+	}
+	registerUpdateHandler(DIGITAL_SENSOR_UPDATE, payloadLength(DIGITAL_SENSOR_REPLY), digitalUpdated);
+	subscribeDigital(port, EVENT_UPDATE_INTERVAL_MS);
+	digitalLevels[port] = digital(port);
+}
+
+// Callbacks registered via onAnalogThreshold(), their thresholds and whether the last value was above
+static analog_callback_t analogCallbacks[16];
+static int analogThresholds[16];
+static bool analogAbove[16];
+
+static void analogUpdated(const uint8_t *record) {
+	uint8_t port = record[0];
+	if(port >= 16 || analogCallbacks[port] == NULL)
+		return;
+	int value = (record[1] << 8) | record[2];
+	if((value >= analogThresholds[port]) == analogAbove[port])
+		return;
+	analogAbove[port] = !analogAbove[port];
+	analogCallbacks[port](port, value);
+}
+
+void onAnalogThreshold(uint8_t port, int threshold, analog_callback_t callback) {
+	if(port >= 16)
+		return;
+	analogCallbacks[port] = callback;
+	if(callback == NULL) {
+		subscribeAnalog(port, 0);
+		return;
+	}
+	analogThresholds[port] = threshold;
+	registerUpdateHandler(ANALOG_SENSOR_UPDATE, payloadLength(ANALOG_SENSOR_REPLY), analogUpdated);
+	subscribeAnalog(port, EVENT_UPDATE_INTERVAL_MS);
+	analogAbove[port] = analog(port) >= threshold;
+}
+
 void setDigitalPullups(bool p0, bool p1, bool p2, bool p3, bool p4, bool p5, bool p6, bool p7, bool p8, bool p9, bool p10, bool p11, bool p12, bool p13, bool p14, bool p15) {
 	uint8_t send[3];
-	send[0] = DIGITAL_PULLUP_ACTION;
-	send[1] = (p15 << 7) | (p14 << 6) | (p13 << 5) | (p12 << 4) | (p11 << 3) | (p10 << 2) | (p9 << 1) | (p8);
-	send[2] = (p7 << 7) | (p6 << 6) | (p5 << 5) | (p4 << 4) | (p3 << 3) | (p2 << 2) | (p1 << 1) | (p0);
-	userProgramSend(send, 3);
+	uint16_t mask = (p15 << 15) | (p14 << 14) | (p13 << 13) | (p12 << 12) | (p11 << 11) | (p10 << 10) | (p9 << 9) | (p8 << 8) |
+		(p7 << 7) | (p6 << 6) | (p5 << 5) | (p4 << 4) | (p3 << 3) | (p2 << 2) | (p1 << 1) | (p0);
+	userProgramSend(send, axcpBuildPortMaskCommand(send, DIGITAL_PULLUP_ACTION, mask));
 }
 
 void setDigitalOutputMode(bool p0, bool p1, bool p2, bool p3, bool p4, bool p5, bool p6, bool p7, bool p8, bool p9, bool p10, bool p11, bool p12, bool p13, bool p14, bool p15) {
 	uint8_t send[3];
-	send[0] = DIGITAL_OUTPUT_MODE_ACTION;
-	send[1] = (p15 << 7) | (p14 << 6) | (p13 << 5) | (p12 << 4) | (p11 << 3) | (p10 << 2) | (p9 << 1) | (p8);
-	send[2] = (p7 << 7) | (p6 << 6) | (p5 << 5) | (p4 << 4) | (p3 << 3) | (p2 << 2) | (p1 << 1) | (p0);
-	userProgramSend(send, 3);
+	uint16_t mask = (p15 << 15) | (p14 << 14) | (p13 << 13) | (p12 << 12) | (p11 << 11) | (p10 << 10) | (p9 << 9) | (p8 << 8) |
+		(p7 << 7) | (p6 << 6) | (p5 << 5) | (p4 << 4) | (p3 << 3) | (p2 << 2) | (p1 << 1) | (p0);
+	userProgramSend(send, axcpBuildPortMaskCommand(send, DIGITAL_OUTPUT_MODE_ACTION, mask));
 }
 
 void setDigitalOutput(uint8_t port, bool level) {
 	uint8_t send[3];
-	send[0] = DIGITAL_OUTPUT_LEVEL_ACTION;
-	send[1] = port;
-	send[2] = level;
-	userProgramSend(send, 3);
+	userProgramSend(send, axcpBuildPortValueCommand(send, DIGITAL_OUTPUT_LEVEL_ACTION, port, level));
 }
 
 void moveAtPower(uint8_t port, int power) {
 	uint8_t send[4];
-	send[0] = MOTOR_POWER_ACTION;
-	send[1] = port;
-	send[2] = power > 0 ? 0 : 1;
-	send[3] = power > 0 ? (uint8_t) (power*2.55) : (uint8_t) (-power*2.55);
-	userProgramSend(send, 4);
+	uint8_t magnitude = power > 0 ? (uint8_t) (power*2.55) : (uint8_t) (-power*2.55);
+	userProgramSend(send, axcpBuildMotorCommand(send, MOTOR_POWER_ACTION, port, power > 0 ? 0 : 1, magnitude));
 }
 
 void moveAtVelocity(uint8_t port, int velocity) {
 	uint8_t send[4];
-	send[0] = MOTOR_VELOCITY_ACTION;
-	send[1] = port;
-	send[2] = velocity > 0 ? 0 : 1;
-	send[3] = velocity > 0 ? (uint8_t) (velocity*2.55) : (uint8_t) (-velocity*2.55);
-	userProgramSend(send, 4);
+	uint8_t magnitude = velocity > 0 ? (uint8_t) (velocity*2.55) : (uint8_t) (-velocity*2.55);
+	userProgramSend(send, axcpBuildMotorCommand(send, MOTOR_VELOCITY_ACTION, port, velocity > 0 ? 0 : 1, magnitude));
 }
 
 void moveAtPowerToAbsolute(uint8_t port, int power, int position) {
 	uint8_t send[7];
-	send[0] = MOTOR_POWER_ABSOLUTE_POSITION_ACTION;
-	send[1] = port;
-	send[2] = power > 0 ? (uint8_t) (power*2.55) : (uint8_t) (-power*2.55);
-	send[3] = (position >> 24) & 0xFF;
-	send[4] = (position >> 16) & 0xFF;
-	send[5] = (position >> 8) & 0xFF;
-	send[6] = position & 0xFF;
-	userProgramSend(send, 7);
+	uint8_t magnitude = power > 0 ? (uint8_t) (power*2.55) : (uint8_t) (-power*2.55);
+	userProgramSend(send, axcpBuildMotorPositionCommand(send, MOTOR_POWER_ABSOLUTE_POSITION_ACTION, port, magnitude, position));
 }
 
 void moveAtVelocityToAbsolute(uint8_t port, int velocity, int position) {
 	uint8_t send[7];
-	send[0] = MOTOR_VELOCITY_ABSOLUTE_POSITION_ACTION;
-	send[1] = port;
-	send[2] = velocity > 0 ? (uint8_t) (velocity*2.55) : (uint8_t) (-velocity*2.55);
-	send[3] = (position >> 24) & 0xFF;
-	send[4] = (position >> 16) & 0xFF;
-	send[5] = (position >> 8) & 0xFF;
-	send[6] = position & 0xFF;
-	userProgramSend(send, 7);
+	uint8_t magnitude = velocity > 0 ? (uint8_t) (velocity*2.55) : (uint8_t) (-velocity*2.55);
+	userProgramSend(send, axcpBuildMotorPositionCommand(send, MOTOR_VELOCITY_ABSOLUTE_POSITION_ACTION, port, magnitude, position));
 }
 
 void moveAtPowerToRelative(uint8_t port, int power, int deltaPosition) {
 	uint8_t send[7];
-	send[0] = MOTOR_POWER_RELATIVE_POSITION_ACTION;
-	send[1] = port;
-	send[2] = power > 0 ? (uint8_t) (power*2.55) : (uint8_t) (-power*2.55);
-	send[3] = (deltaPosition >> 24) & 0xFF;
-	send[4] = (deltaPosition >> 16) & 0xFF;
-	send[5] = (deltaPosition >> 8) & 0xFF;
-	send[6] = deltaPosition & 0xFF;
-	userProgramSend(send, 7);
+	uint8_t magnitude = power > 0 ? (uint8_t) (power*2.55) : (uint8_t) (-power*2.55);
+	userProgramSend(send, axcpBuildMotorPositionCommand(send, MOTOR_POWER_RELATIVE_POSITION_ACTION, port, magnitude, deltaPosition));
 }
 
 void moveAtVelocityToRelative(uint8_t port, int velocity, int deltaPosition) {
 	uint8_t send[7];
-	send[0] = MOTOR_VELOCITY_RELATIVE_POSITION_ACTION;
-	send[1] = port;
-	send[2] = velocity > 0 ? (uint8_t) (velocity*2.55) : (uint8_t) (-velocity*2.55);
-	send[3] = (deltaPosition >> 24) & 0xFF;
-	send[4] = (deltaPosition >> 16) & 0xFF;
-	send[5] = (deltaPosition >> 8) & 0xFF;
-	send[6] = deltaPosition & 0xFF;
-	userProgramSend(send, 7);
+	uint8_t magnitude = velocity > 0 ? (uint8_t) (velocity*2.55) : (uint8_t) (-velocity*2.55);
+	userProgramSend(send, axcpBuildMotorPositionCommand(send, MOTOR_VELOCITY_RELATIVE_POSITION_ACTION, port, magnitude, deltaPosition));
 }
 
 void freeze(uint8_t port) {
 	uint8_t send[2];
-	send[0] = MOTOR_FREEZE_ACTION;
-	send[1] = port;
-	userProgramSend(send, 2);
+	userProgramSend(send, axcpBuildPortCommand(send, MOTOR_FREEZE_ACTION, port));
 }
 
 void brake(uint8_t port, int brakingPower) {
 	uint8_t send[3];
-	send[0] = MOTOR_BRAKE_ACTION;
-	send[1] = port;
-	send[2] = (uint8_t) (brakingPower * 2.55);
-	userProgramSend(send, 3);
+	userProgramSend(send, axcpBuildPortValueCommand(send, MOTOR_BRAKE_ACTION, port, (uint8_t) (brakingPower * 2.55)));
 }
 
 void off(uint8_t port) {
 	uint8_t send[2];
-	send[0] = MOTOR_OFF_ACTION;
-	send[1] = port;
-	userProgramSend(send, 2);
+	userProgramSend(send, axcpBuildPortCommand(send, MOTOR_OFF_ACTION, port));
 }
 
-void allOff() {
-	uint8_t send[2];
-	send[0] = MOTOR_OFF_ACTION;
+// Drives all motors in 'ports' at the percentages in 'speeds', indexed by port, with a single MOTOR_MULTI_ACTION
+static void moveMultiple(uint8_t action, uint8_t ports, const int *speeds) {
+	uint8_t send[3 + 16];
+	uint8_t values[12];
 	uint8_t i;
 	for(i=0; i<6; i++) {
-		send[1] = i;
-		userProgramSend(send, 2);
+		if(ports & (1 << i)) {
+			values[2*i] = speeds[i] > 0 ? 0 : 1;
+			values[2*i + 1] = speeds[i] > 0 ? (uint8_t) (speeds[i]*2.55) : (uint8_t) (-speeds[i]*2.55);
+		}
 	}
+	userProgramSend(send, axcpBuildMultiAction(send, MOTOR_MULTI_ACTION, action, ports & 0x3F, values));
+}
+
+void moveMultipleAtPower(uint8_t ports, const int *powers) {
+	moveMultiple(MOTOR_POWER_ACTION, ports, powers);
+}
+
+void moveMultipleAtVelocity(uint8_t ports, const int *velocities) {
+	moveMultiple(MOTOR_VELOCITY_ACTION, ports, velocities);
+}
+
+void freezeMultiple(uint8_t ports) {
+	uint8_t send[3];
+	userProgramSend(send, axcpBuildMultiAction(send, MOTOR_MULTI_ACTION, MOTOR_FREEZE_ACTION, ports & 0x3F, NULL));
+}
+
+void brakeMultiple(uint8_t ports, int brakingPower) {
+	uint8_t send[3 + 8];
+	uint8_t values[6];
+	memset(values, (uint8_t) (brakingPower * 2.55), sizeof(values));
+	userProgramSend(send, axcpBuildMultiAction(send, MOTOR_MULTI_ACTION, MOTOR_BRAKE_ACTION, ports & 0x3F, values));
+}
+
+void offMultiple(uint8_t ports) {
+	uint8_t send[3];
+	userProgramSend(send, axcpBuildMultiAction(send, MOTOR_MULTI_ACTION, MOTOR_OFF_ACTION, ports & 0x3F, NULL));
+}
+
+// MOTOR_MULTI_ACTION is not known to every hardware controller, so the safety calls below use the single port
+// actions every one of them knows, sent together in one write
+void allOff() {
+	uint8_t send[2];
+	uint8_t i;
+	int batch = userProgramBeginBatch();
+	for(i=0; i<6; i++)
+		userProgramSend(send, axcpBuildPortCommand(send, MOTOR_OFF_ACTION, i));
+	if(batch)
+		userProgramCommitBatch();
 }
 
 void clearPosition(uint8_t port) {
 	uint8_t send[2];
-	send[0] = MOTOR_CLEAR_POSITION_ACTION;
-	send[1] = port;
-	userProgramSend(send, 2);
+	userProgramSend(send, axcpBuildPortCommand(send, MOTOR_CLEAR_POSITION_ACTION, port));
 }
 
 int getPosition(uint8_t port) {
+	int32_t value;
+	if(sharedStateRead(SHARED_STATE_MOTOR_POSITION, port, &value))
+		return value;
 	uint8_t send[2];
-	send[0] = MOTOR_POSITION_REQUEST;
-	send[1] = port;
-	uint8_t *answer;
+	uint8_t answer[6];
 	uint32_t answerLen;
-	userProgramRequest(send, 2, &answer, &answerLen);
-	int result = (answer[2] << 24) | (answer[3] << 16) | (answer[4] << 8) | (answer[5]);
-	free(answer);
+	userProgramRequestInto(send, axcpBuildPortCommand(send, MOTOR_POSITION_REQUEST, port), answer, sizeof(answer), &answerLen);
+	return axcpParseMotorPositionReply(answer);
+}
+
+int getPositionTimeout(uint8_t port, int timeout, int *position) {
+	int32_t shared;
+	uint8_t answer[6];
+	if(sharedStateRead(SHARED_STATE_MOTOR_POSITION, port, &shared)) {
+		*position = shared;
+		return 0;
+	}
+	int result = requestPortTimeout(MOTOR_POSITION_REQUEST, port, timeout, answer, SHARED_STATE_MOTOR_POSITION, &shared);
+	*position = result == 0 ? axcpParseMotorPositionReply(answer) : shared;
 	return result;
 }
 
+void subscribePosition(uint8_t port, int interval) {
+	uint8_t send[4];
+	userProgramSend(send, axcpBuildSubscription(send, MOTOR_POSITION_SUBSCRIPTION, port, interval));
+}
+
 int getVelocity(uint8_t port) {
+	int32_t value;
+	if(sharedStateRead(SHARED_STATE_MOTOR_VELOCITY, port, &value))
+		return (uint8_t) (value / 2.55);
 	uint8_t send[2];
-	send[0] = MOTOR_VELOCITY_REQUEST;
-	send[1] = port;
-	uint8_t *answer;
+	uint8_t answer[6];
 	uint32_t answerLen;
-	userProgramRequest(send, 2, &answer, &answerLen);
-	int result =  answer[2] == 0 ? (uint8_t) (answer[3] / 2.55) : (uint8_t) (-answer[3] / 2.55);
-	free(answer);
-	return result;
+	userProgramRequestInto(send, axcpBuildPortCommand(send, MOTOR_VELOCITY_REQUEST, port), answer, sizeof(answer), &answerLen);
+	uint8_t direction;
+	uint8_t velocity = axcpParseMotorVelocityReply(answer, &direction);
+	return direction == 0 ? (uint8_t) (velocity / 2.55) : (uint8_t) (-velocity / 2.55);
 }
 
-void enableAllServos() {
+void subscribeVelocity(uint8_t port, int interval) {
+	uint8_t send[4];
+	userProgramSend(send, axcpBuildSubscription(send, MOTOR_VELOCITY_SUBSCRIPTION, port, interval));
+}
+
+// Callbacks registered via onPositionReached()
+static position_callback_t positionCallbacks[16];
+
+static void positionReached(const uint8_t *record) {
+	uint8_t port = record[0];
+	if(port < 16 && positionCallbacks[port] != NULL)
+		positionCallbacks[port](port);
+}
+
+void onPositionReached(uint8_t port, position_callback_t callback) {
+	if(port >= 16)
+		return;
+	positionCallbacks[port] = callback;
+	registerUpdateHandler(MOTOR_POSITION_REACHED_ACTION, payloadLength(MOTOR_POSITION_REACHED_ACTION),
+		positionReached);
+}
+
+// Switches all servos in 'ports' on or off with a single SERVO_MULTI_ACTION
+static void switchServos(uint8_t ports, uint8_t on) {
+	uint8_t send[3 + 8];
+	uint8_t values[6];
+	memset(values, on, sizeof(values));
+	userProgramSend(send, axcpBuildMultiAction(send, SERVO_MULTI_ACTION, SERVO_ONOFF_ACTION, ports & 0x3F, values));
+}
+
+void enableServos(uint8_t ports) {
+	switchServos(ports, 1);
+}
+
+void disableServos(uint8_t ports) {
+	switchServos(ports, 0);
+}
+
+// Switches all servos on or off with the single port actions, see allOff()
+static void switchAllServos(uint8_t on) {
 	uint8_t send[3];
-	send[0] = SERVO_ONOFF_ACTION;
-	send[2] = 1;
 	uint8_t i;
-	for(i=0; i<6; i++) {
-		send[1] = i;
-		userProgramSend(send, 3);
-	}
+	int batch = userProgramBeginBatch();
+	for(i=0; i<6; i++)
+		userProgramSend(send, axcpBuildPortValueCommand(send, SERVO_ONOFF_ACTION, i, on));
+	if(batch)
+		userProgramCommitBatch();
+}
+
+void enableAllServos() {
+	switchAllServos(1);
 }
 
 void disableAllServos() {
-	uint8_t send[3];
-	send[0] = SERVO_ONOFF_ACTION;
-	send[2] = 0;
-	uint8_t i;
-	for(i=0; i<6; i++) {
-		send[1] = i;
-		userProgramSend(send, 3);
-	}
+	switchAllServos(0);
 }
 
 void enableServo(uint8_t port) {
 	uint8_t send[3];
-	send[0] = SERVO_ONOFF_ACTION;
-	send[1] = port;
-	send[2] = 1;
-	userProgramSend(send, 3);
+	userProgramSend(send, axcpBuildPortValueCommand(send, SERVO_ONOFF_ACTION, port, 1));
 }
 
 void disableServo(uint8_t port) {
 	uint8_t send[3];
-	send[0] = SERVO_ONOFF_ACTION;
-	send[1] = port;
-	send[2] = 0;
-	userProgramSend(send, 3);
+	userProgramSend(send, axcpBuildPortValueCommand(send, SERVO_ONOFF_ACTION, port, 0));
 }
 
 void setPosition(uint8_t port, int position) {
 	uint8_t send[3];
-	send[0] = SERVO_DRIVE_ACTION;
-	send[1] = port;
-	send[2] = (uint8_t) (position*2.55/1.8);
-	userProgramSend(send, 3);
+	userProgramSend(send, axcpBuildPortValueCommand(send, SERVO_DRIVE_ACTION, port, (uint8_t) (position*2.55/1.8)));
+}
+
+void setPositions(uint8_t ports, const int *positions) {
+	uint8_t send[3 + 8];
+	uint8_t values[6];
+	uint8_t i;
+	for(i=0; i<6; i++) {
+		if(ports & (1 << i))
+			values[i] = (uint8_t) (positions[i]*2.55/1.8);
+	}
+	userProgramSend(send, axcpBuildMultiAction(send, SERVO_MULTI_ACTION, SERVO_DRIVE_ACTION, ports & 0x3F, values));
 }
 
 int controllerBatteryCharge() {
+	int32_t value;
+	if(sharedStateRead(SHARED_STATE_CONTROLLER_BATTERY_CHARGE, 0, &value))
+		return (int) (value / 2.55);
 	uint8_t send[1];
 	send[0] = CONTROLLER_BATTERY_CHARGE_REQUEST;
-	uint8_t *answer;
+	uint8_t answer[6];
 	uint32_t answerLen;
-	userProgramRequest(send, 1, &answer, &answerLen);
+	userProgramRequestInto(send, 1, answer, sizeof(answer), &answerLen);
 	int result = (int) (answer[1] / 2.55);
-	free(answer);
 	return result;
 }
 
 bool controllerBatteryChargingState() {
+	int32_t value;
+	if(sharedStateRead(SHARED_STATE_CONTROLLER_BATTERY_CHARGING_STATE, 0, &value))
+		return value;
 	uint8_t send[1];
 	send[0] = CONTROLLER_BATTERY_CHARGING_STATE_REQUEST;
-	uint8_t *answer;
+	uint8_t answer[6];
 	uint32_t answerLen;
-	userProgramRequest(send, 1, &answer, &answerLen);
+	userProgramRequestInto(send, 1, answer, sizeof(answer), &answerLen);
 	bool result = answer[1];
-	free(answer);
 	return result;
 }
 
 int phoneBatteryCharge() {
+	int32_t value;
+	if(sharedStateRead(SHARED_STATE_PHONE_BATTERY_CHARGE, 0, &value))
+		return (int) (value / 2.55);
 	uint8_t send[1];
 	send[0] = PHONE_BATTERY_CHARGE_REQUEST;
-	uint8_t *answer;
+	uint8_t answer[6];
 	uint32_t answerLen;
-	userProgramRequest(send, 1, &answer, &answerLen);
+	userProgramRequestInto(send, 1, answer, sizeof(answer), &answerLen);
 	int result = (int) (answer[1] / 2.55);
-	free(answer);
 	return result;
 }
 
 bool phoneBatteryChargingState() {
+	int32_t value;
+	if(sharedStateRead(SHARED_STATE_PHONE_BATTERY_CHARGING_STATE, 0, &value))
+		return value;
 	uint8_t send[1];
 	send[0] = PHONE_BATTERY_CHARGING_STATE_REQUEST;
-	uint8_t *answer;
+	uint8_t answer[6];
 	uint32_t answerLen;
-	userProgramRequest(send, 1, &answer, &answerLen);
+	userProgramRequestInto(send, 1, answer, sizeof(answer), &answerLen);
 	bool result = answer[1];
-	free(answer);
 	return result;
 }
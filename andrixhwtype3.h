@@ -24,6 +24,7 @@
  */
 
 #include "axcp.h"
+#include "userprogram.h"
 #include <stdbool.h>
 
 /*
@@ -33,6 +34,35 @@
  */
 int analog(uint8_t port);
 
+/*
+ * Like analog(), but waits at most 'timeout' milliseconds for the value, so that a control loop doesn't
+ * freeze if the hardware controller doesn't answer. Then the last known value is used instead, if any.
+ * - param port: port number ranging from 0 to 15.
+ * - param timeout: the maximum time to wait in milliseconds.
+ * - param value: receives the sensor value ranging from 0 to 1023.
+ * - return: 0 if 'value' is current, 1 if it is the last known value or -1 if no value is known.
+ */
+int analogTimeout(uint8_t port, int timeout, int *value);
+
+/*
+ * Subscribes to the analog sensor at port number 'port', i.e. the hardware controller reports its value every
+ * 'interval' milliseconds without being asked. The values are then answered by analog() without a round trip
+ * and are delivered as ANALOG_SENSOR_UPDATE by receiveUpdate().
+ * - param port: port number ranging from 0 to 15.
+ * - param interval: the update interval in milliseconds; 0 cancels the subscription.
+ */
+void subscribeAnalog(uint8_t port, int interval);
+
+/*
+ * Reads all 16 analog sensors with a single request, which is much faster than 16 calls to analog(). If the
+ * hardware controller doesn't know that request, every sensor is read on its own. A sensor that can't be read
+ * gets its last known value, see analogTimeout().
+ * - param values: array of 16 ints that receives the sensor values ranging from 0 to 1023, indexed by port.
+ * - return: 0 if all values are current, 1 if some are the last known ones or -1 if a value is not known at all,
+ *   in which case it is 0.
+ */
+int readAllAnalog(int *values);
+
 /*
  * Controls the pullup resistors for all 16 analog ports. The boolean parameters represent the resistor
  * setting for each port in incremental order. An inactive pullup resistor means "floating", which is
@@ -48,6 +78,57 @@ void setAnalogPullups(bool p0, bool p1, bool p2, bool p3, bool p4, bool p5, bool
  */
 bool digital(uint8_t port);
 
+/*
+ * Like digital(), but waits at most 'timeout' milliseconds for the value, see analogTimeout().
+ * - param port: port number ranging from 0 to 15.
+ * - param timeout: the maximum time to wait in milliseconds.
+ * - param value: receives true if the sensor is pressed, false if not.
+ * - return: 0 if 'value' is current, 1 if it is the last known value or -1 if no value is known.
+ */
+int digitalTimeout(uint8_t port, int timeout, bool *value);
+
+/*
+ * Reads all 16 digital sensors with a single request, see readAllAnalog().
+ * - param values: array of 16 bools that receives the sensor values, indexed by port.
+ * - return: same as readAllAnalog().
+ */
+int readAllDigital(bool *values);
+
+/*
+ * Subscribes to the digital sensor at port number 'port', see subscribeAnalog(). The values are delivered as
+ * DIGITAL_SENSOR_UPDATE.
+ * - param port: port number ranging from 0 to 15.
+ * - param interval: the update interval in milliseconds; 0 cancels the subscription.
+ */
+void subscribeDigital(uint8_t port, int interval);
+
+/*
+ * Callback for onDigitalChange(), invoked with the 'port' and its new 'level'.
+ */
+typedef void (*digital_callback_t)(uint8_t port, bool level);
+
+/*
+ * Registers 'callback' to be invoked by waitForEvents() whenever the level of the digital sensor at port
+ * number 'port' changes. Subscribes to the sensor, see subscribeDigital().
+ * - param port: port number ranging from 0 to 15.
+ * - param callback: the function to invoke or NULL to stop watching the port.
+ */
+void onDigitalChange(uint8_t port, digital_callback_t callback);
+
+/*
+ * Callback for onAnalogThreshold(), invoked with the 'port' and the 'value' that crossed the threshold.
+ */
+typedef void (*analog_callback_t)(uint8_t port, int value);
+
+/*
+ * Registers 'callback' to be invoked by waitForEvents() whenever the value of the analog sensor at port number
+ * 'port' crosses 'threshold' in either direction. Subscribes to the sensor, see subscribeAnalog().
+ * - param port: port number ranging from 0 to 15.
+ * - param threshold: the threshold ranging from 0 to 1023; values from 'threshold' on count as above.
+ * - param callback: the function to invoke or NULL to stop watching the port.
+ */
+void onAnalogThreshold(uint8_t port, int threshold, analog_callback_t callback);
+
 /*
  * Controls the output mode for all 16 digital ports. The boolean parameters represent the output modes
  * for each port in incremental order, where true means output and false means input.
@@ -132,6 +213,42 @@ void brake(uint8_t port, int brakingPower);
  */
 void off(uint8_t port);
 
+/*
+ * Drives all motors in 'ports' at the specified 'powers' with a single command, so that they start at the
+ * same time.
+ * - param ports: bit mask of the port numbers, bit n is port n ranging from 0 to 5.
+ * - param powers: array of 6 powers ranging from -100 percent to 100 percent, indexed by port. Only the
+ *   entries of the ports in 'ports' are used.
+ */
+void moveMultipleAtPower(uint8_t ports, const int *powers);
+
+/*
+ * Drives all motors in 'ports' at the specified 'velocities' with a single command, see moveMultipleAtPower().
+ * - param ports: bit mask of the port numbers, bit n is port n ranging from 0 to 5.
+ * - param velocities: array of 6 velocities ranging from -100 percent to 100 percent, indexed by port.
+ */
+void moveMultipleAtVelocity(uint8_t ports, const int *velocities);
+
+/*
+ * Freezes all motors in 'ports' with a single command, see freeze().
+ * - param ports: bit mask of the port numbers, bit n is port n ranging from 0 to 5.
+ */
+void freezeMultiple(uint8_t ports);
+
+/*
+ * Brakes all motors in 'ports' with the specified 'brakingPower' with a single command, see brake().
+ * - param ports: bit mask of the port numbers, bit n is port n ranging from 0 to 5.
+ * - param brakingPower: the breaking power ranging from 0 percent to 100 percent.
+ */
+void brakeMultiple(uint8_t ports, int brakingPower);
+
+/*
+ * Stops all motors in 'ports' with a single command, see off(). Like all *Multiple() functions, this needs a
+ * hardware controller that knows MOTOR_MULTI_ACTION; older ones reject it. allOff() works with every one.
+ * - param ports: bit mask of the port numbers, bit n is port n ranging from 0 to 5.
+ */
+void offMultiple(uint8_t ports);
+
 /*
  * Stops all motors connected to the controller. Stops any movement, freezing or braking, i.e. the
  * motors won't be powered and can move freely.
@@ -151,6 +268,23 @@ void clearPosition(uint8_t port);
  */
 int getPosition(uint8_t port);
 
+/*
+ * Like getPosition(), but waits at most 'timeout' milliseconds for the position, see analogTimeout().
+ * - param port: the port number ranging from 0 to 5.
+ * - param timeout: the maximum time to wait in milliseconds.
+ * - param position: receives the position of the motor.
+ * - return: 0 if 'position' is current, 1 if it is the last known position or -1 if no position is known.
+ */
+int getPositionTimeout(uint8_t port, int timeout, int *position);
+
+/*
+ * Subscribes to the position of the motor connected to port number 'port', see subscribeAnalog(). The
+ * positions are delivered as MOTOR_POSITION_UPDATE.
+ * - param port: the port number ranging from 0 to 5.
+ * - param interval: the update interval in milliseconds; 0 cancels the subscription.
+ */
+void subscribePosition(uint8_t port, int interval);
+
 /*
  * Returns the current velocity of the motor connected to port number 'port'.
  * - param port: the port number ranging from 0 to 5.
@@ -158,6 +292,27 @@ int getPosition(uint8_t port);
  */
 int getVelocity(uint8_t port);
 
+/*
+ * Subscribes to the velocity of the motor connected to port number 'port', see subscribeAnalog(). The
+ * velocities are delivered as MOTOR_VELOCITY_UPDATE.
+ * - param port: the port number ranging from 0 to 5.
+ * - param interval: the update interval in milliseconds; 0 cancels the subscription.
+ */
+void subscribeVelocity(uint8_t port, int interval);
+
+/*
+ * Callback for onPositionReached(), invoked with the 'port' of the motor.
+ */
+typedef void (*position_callback_t)(uint8_t port);
+
+/*
+ * Registers 'callback' to be invoked by waitForEvents() whenever the motor connected to port number 'port'
+ * reached the target of moveAtPowerToAbsolute() and the like.
+ * - param port: the port number ranging from 0 to 5.
+ * - param callback: the function to invoke or NULL to stop watching the port.
+ */
+void onPositionReached(uint8_t port, position_callback_t callback);
+
 /*
  * Activates all servos that are connected to the controller. An activated servo holds its configured
  * position and applies force if necessary.
@@ -170,6 +325,18 @@ void enableAllServos();
  */
 void disableAllServos();
 
+/*
+ * Activates all servos in 'ports' with a single command, see enableServo().
+ * - param ports: bit mask of the port numbers, bit n is port n ranging from 0 to 5.
+ */
+void enableServos(uint8_t ports);
+
+/*
+ * Deactivates all servos in 'ports' with a single command, see disableServo().
+ * - param ports: bit mask of the port numbers, bit n is port n ranging from 0 to 5.
+ */
+void disableServos(uint8_t ports);
+
 /*
  * Activates the servo connected to servo port number 'port'. An activated servo holds its configured
  * position and applies force if necessary.
@@ -192,6 +359,14 @@ void disableServo(uint8_t port);
  */
 void setPosition(uint8_t port, int position);
 
+/*
+ * Sets the 'positions' of all servos in 'ports' with a single command, so that they start moving at the
+ * same time.
+ * - param ports: bit mask of the port numbers, bit n is port n ranging from 0 to 5.
+ * - param positions: array of 6 target positions ranging from 0 degrees to 180 degrees, indexed by port.
+ */
+void setPositions(uint8_t ports, const int *positions);
+
 /*
  * Returns the current charge of the controller battery.
  * - return: the controller battery charge ranging from 0 percent to 100 percent.
@@ -21,8 +21,8 @@
 /* 
  * This program implements the software controller in the Hedgehog architecture for a Raspberry PI.
  * Communication with the HWC or HLC is done via UART and user programs will be executed as simple childs.
- * The main control flow is a consumer pattern (via polling) for incoming commands, either from UART, childs
- * or CLI, appropriate handling of them and returning to polling. All single-threaded.
+ * The main control flow is a consumer pattern (via an epoll reactor) for incoming commands, either from UART,
+ * childs or CLI, appropriate handling of them and returning to sleep until the next event. All single-threaded.
  * Even though AXCP specification recommends command requests to be blocking until to according reply
  * was received, requests to HWC or HLC here are not blocking and will be noted until a reply was received.
  */
@@ -30,34 +30,130 @@
 #include "andrixswc.h"
 
 int debugger_pid;
+int debugger_rfd = -1;
 int debugger_wfd;
 int debugger_attached = 0;
 int debugger_breaked = 0;
 
+int uprog_cmd_rfd = -1;
 int uprog_cmd_wfd = -1;
+int uprog_out_rfd = -1;
+int uprog_event_wfd = -1;
+// Rings that replace the command pipes of the running program if set up, see shmring.h. Option -r enables them;
+// they save copying, but andrixswc still has to be woken for every command, so they are no faster than pipes.
+shm_channel_t uprog_ring;
+int uprog_ring_open = 0;
+int use_program_ring = 0;
+// Statistics of the rings of terminated programs
+uint32_t uprog_ring_notifications = 0;
+uint32_t uprog_ring_sleeps = 0;
+// Tag of the program's next request, sent back before the reply, see REQUEST_TAG_SWCINTERN
+uint8_t uprog_request_tag = 0;
 int program_pid = -1;
 uint16_t currVersion;
 char currName[32];
 int restart = 0;
+// Handle of the current execution in the compact EXECUTION_* and DEBUGGING_* commands, or 0 if the full name and
+// version are sent. Compact commands are used once the HLC subscribed to them with EXECUTION_COMPACT_SUBSCRIPTION.
+int compact_execution = 0;
+uint8_t execution_handle = 0;
+uint8_t last_execution_handle = 0;
+
+// State of the compilation in progress, see compileProgram()
+int compile_pid = -1;
+int compile_file = -1;
+int compile_linking = 0;
+uint8_t compile_opcode;
+char compile_name[32];
+uint16_t compile_version;
 
 ringbuffer_handler_t* customDataBuffer;
-
-int replyOpcode = -1;
-int replyPort = -1;
+// Size the custom data buffer may grow to, see option -c
+int custom_data_max_size = CUSTOM_DATA_BUFFER_DEFAULT_MAX_SIZE;
+// WAIT_CUSTOM_DATA_REQUEST_SWCINTERN of the program whose reply is deferred until 'minimum' bytes arrived or
+// custom_data_timer expired, see replyCustomData()
+int custom_data_waiting = 0;
+uint32_t custom_data_minimum;
+uint32_t custom_data_capacity;
+uint8_t custom_data_tag;
+int custom_data_timer = -1;
+// Output of the program collected until printout_threshold bytes are there or printout_timer expires after
+// printout_deadline milliseconds, see printoutFlush(). Output that doesn't fit is dropped.
+ringbuffer_handler_t *printout_buffer = NULL;
+int printout_threshold = UART_BULK_PIECE_BYTES;
+int printout_deadline = PRINTOUT_DEFAULT_DEADLINE_MS;
+int printout_timer = -1;
+int printout_timer_armed = 0;
+// Bytes dropped since the last notice in the output, see uprog_out_received()
+uint32_t printout_unreported = 0;
+uint32_t printout_bytes = 0;
+uint32_t printout_frames = 0;
+uint32_t printout_dropped = 0;
+
+// Timer that expires when the oldest request in the pending table times out, see request_timeout()
+int request_timer = -1;
+int request_timer_armed = 0;
+uint32_t request_retries = 0;
+uint32_t request_failures = 0;
+// Maximum age in milliseconds of a mirrored value that is used to answer a request; 0 disables the mirror
+int mirror_max_age = MIRROR_DEFAULT_MAX_AGE_MS;
+uint32_t mirror_hits = 0;
+uint32_t mirror_misses = 0;
+// Region the mirror is published to and the read-only fd passed to programs as SHARED_STATE_FD
+shared_state_t *shared_state = NULL;
+int shared_state_fd = -1;
+
+// Bit masks of the ports the running program subscribed to, per subscription opcode
+uint16_t program_subscriptions[SUBSCRIPTION_SLOTS];
+const uint8_t subscription_opcodes[SUBSCRIPTION_SLOTS] = {ANALOG_SENSOR_SUBSCRIPTION, DIGITAL_SENSOR_SUBSCRIPTION,
+	MOTOR_POSITION_SUBSCRIPTION, MOTOR_VELOCITY_SUBSCRIPTION};
+uint32_t updates_forwarded = 0;
+uint32_t updates_dropped = 0;
 uint8_t hwctype = 0;
 
-struct pollfd pfds[5];
+int uart_fd = -1;
+int running = 1;
+
+// Decoders for commands from the UART and from the user program, which may arrive in pieces
+axcp_decoder_t uart_decoder;
+axcp_decoder_t uprog_decoder;
+// Timer that expires if a command from the UART stays incomplete, see uart_frame_timeout()
+int uart_frame_timer = -1;
+int uart_frame_timer_armed = 0;
+uint32_t uart_frame_timeouts = 0;
+// While set, commands to the UART are only queued and written at once afterwards, see uprog_cmd_readable()
+int uart_corked = 0;
+// Timer that expires when the UART driver is expected to take more queued commands, see uartSend()
+int uart_send_timer = -1;
+int uart_send_timer_armed = 0;
+// Bytes the UART sends per millisecond and bytes its driver's output queue is filled up to, see uartSetSpeed()
+int uart_bytes_per_ms = UART_BAUD_RATE / 10000;
+int uart_queue_bytes = UART_QUEUE_MIN_BYTES;
+// Set once the program was told to stop; its actuator actions are dropped from then on
+int program_stopping = 0;
+// Emergency stops issued and the time in microseconds (see timeMicros()) it took to write the last and the
+// slowest one to the UART. While one is in flight, estop_started_at is set and estop_target is the
+// outqueueQueuedBytes() the burst is written at.
+uint32_t estops = 0;
+uint64_t estop_started_at = 0;
+uint64_t estop_target = 0;
+uint64_t estop_latency_last = 0;
+uint64_t estop_latency_max = 0;
+// Cleared once the hardware controller rejected MOTOR_MULTI_ACTION or SERVO_MULTI_ACTION, see emergencyStop()
+int hwc_multi_actions = 1;
+// Set while the multi actions of an emergencyStop() may still be rejected
+int estop_multi_sent = 0;
 
 void bailOut(char* message, ...) {
 	va_list ap;
-	if(pfds[0].fd != -1)
-		close(pfds[0].fd);
-	if(pfds[1].fd != -1)
-		close(pfds[1].fd);
+	if(uart_fd != -1)
+		close(uart_fd);
+	if(uprog_cmd_rfd != -1)
+		close(uprog_cmd_rfd);
 	if(uprog_cmd_wfd != -1)
 		close(uprog_cmd_wfd);
-	if(pfds[2].fd != -1)
-		close(pfds[2].fd);
+	if(uprog_out_rfd != -1)
+		close(uprog_out_rfd);
 	va_start(ap, message);
 	vfprintf(stdout, message, ap);
 	va_end(ap);
@@ -67,28 +163,325 @@ void bailOut(char* message, ...) {
 	exit(EXIT_FAILURE);
 }
 
-void writeUART(uint8_t* command, uint32_t length) {
-	int result = axcpEncodeAndSend(pfds[0].fd, command, length);
-  printf("Write to UART opcode %d: ", command[0]);
+/*
+ * Return: the priority class (see outqueue.h) of commands with 'opcode' on their way to the UART.
+ */
+int uartPriority(uint8_t opcode) {
+	if((opcode >= DIGITAL_OUTPUT_MODE_ACTION && opcode <= DIGITAL_OUTPUT_LEVEL_ACTION) ||
+			(opcode >= MOTOR_POWER_ACTION && opcode <= MOTOR_MULTI_ACTION) || opcode == MOTOR_CLEAR_POSITION_ACTION ||
+			(opcode >= SERVO_ONOFF_ACTION && opcode <= SERVO_MULTI_ACTION) ||
+			(opcode >= HW_CONTROLLER_OFF_ACTION && opcode <= PHONE_RESET_ACTION))
+		return OUTQUEUE_CONTROL;
+	// Program, execution and debugging commands, which must keep their order among each other
+	if(opcode >= PROGRAM_COMPILE_REQUEST)
+		return OUTQUEUE_BULK;
+	return OUTQUEUE_NORMAL;
+}
+
+/*
+ * Queues the command consisting of 'count' consecutive 'parts' for the UART without writing it, see
+ * axcpEncodeAndSendv() and uartSend().
+ */
+void queueUARTv(struct iovec* parts, int count) {
+	int result = outqueuePushv(uartPriority(((uint8_t*) parts[0].iov_base)[0]), parts, count);
+  printf("Write to UART opcode %d: ", ((uint8_t*) parts[0].iov_base)[0]);
+  int p;
   uint32_t i;
-  for(i=1; i<length; i++)
-    printf("%d,", command[i]);
+  for(p=0; p<count; p++)
+    for(i = (p == 0 ? 1 : 0); i<parts[p].iov_len; i++)
+      printf("%d,", ((uint8_t*) parts[p].iov_base)[i]);
   printf("\n");
   
 	if(result == -1)
-		bailOut("UART write failed\n");
+		bailOut("UART queue is out of memory\n");
 	if(result == -2)
 		bailOut("UART write: specified length doesn't equal command length specification\n");
 }
 
+void queueUART(uint8_t* command, uint32_t length) {
+	struct iovec part;
+	part.iov_base = command;
+	part.iov_len = length;
+	queueUARTv(&part, 1);
+}
+
+/*
+ * Return: the number of bytes waiting in the UART driver's output queue or 0 if that's unknown.
+ */
+int uartQueued() {
+	int queued;
+	if(ioctl(uart_fd, TIOCOUTQ, &queued) == -1)
+		return 0;
+	return queued;
+}
+
+/*
+ * Sizes the driver's output queue for a UART running at 'baud'. A byte takes 10 bits on the line.
+ */
+void uartSetSpeed(int baud) {
+	uart_bytes_per_ms = baud / 10000 > 0 ? baud / 10000 : 1;
+	uart_queue_bytes = uart_bytes_per_ms * UART_QUEUE_MS;
+	if(uart_queue_bytes < UART_QUEUE_MIN_BYTES)
+		uart_queue_bytes = UART_QUEUE_MIN_BYTES;
+}
+
+/*
+ * Writes queued commands to the UART, highest priority first, as long as the driver's output queue holds less
+ * than uart_queue_bytes. The coalesced actuator actions are taken at every opportunity, so they carry the
+ * newest values. If commands remain, uart_send_timer is armed for the time the driver needs to drain its queue.
+ */
+void uartSendQueued() {
+	while(outqueueLength() > 0 || coalesceCount() > 0) {
+		int room = uart_queue_bytes - uartQueued();
+		if(room <= 0)
+			break;
+		coalesceFlush(queueUART);
+		int sent = outqueueSend(uart_fd, room);
+		if(sent == -1)
+			bailOut("UART write failed\n");
+		if(outqueueLength() == 0)
+			return;
+		// The driver didn't take more
+		if(sent < room)
+			break;
+	}
+	if(outqueueLength() == 0 && coalesceCount() == 0)
+		return;
+	if(!uart_send_timer_armed) {
+		int queued = uartQueued() - uart_queue_bytes / 2;
+		reactorArmTimer(uart_send_timer, queued > 0 ? queued / uart_bytes_per_ms + 1 : 1);
+		uart_send_timer_armed = 1;
+	}
+}
+
+/*
+ * Like uartSendQueued(), and records the stop latency once the burst of an emergencyStop() is written.
+ */
+void uartSend() {
+	uartSendQueued();
+	if(estop_started_at != 0 && outqueueWrittenBytes(OUTQUEUE_CONTROL) >= estop_target) {
+		estop_latency_last = timeMicros() - estop_started_at;
+		if(estop_latency_last > estop_latency_max)
+			estop_latency_max = estop_latency_last;
+		estop_started_at = 0;
+	}
+}
+
+void uart_send_timeout(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	uart_send_timer_armed = 0;
+	uartSend();
+}
+
+/*
+ * Writes everything still queued for the UART, blocking until it's done, e.g. before exiting.
+ */
+void uartDrain() {
+	fcntl(uart_fd, F_SETFL, fcntl(uart_fd, F_GETFL) & ~O_NONBLOCK);
+	coalesceFlush(queueUART);
+	while(outqueueLength() > 0)
+		if(outqueueSend(uart_fd, outqueueLength()) == -1)
+			break;
+}
+
+/*
+ * Writes the command consisting of 'count' consecutive 'parts' to the UART, see axcpEncodeAndSendv(). The
+ * command is queued with the priority of its opcode and written as soon as the UART is ready for it, which is
+ * deferred until the end of the current chunk from the program while uart_corked is set.
+ */
+void writeUARTv(struct iovec* parts, int count) {
+	queueUARTv(parts, count);
+	if(!uart_corked)
+		uartSend();
+}
+
+void writeUART(uint8_t* command, uint32_t length) {
+	struct iovec part;
+	part.iov_base = command;
+	part.iov_len = length;
+	writeUARTv(&part, 1);
+}
+
+/*
+ * Return: 1 if 'opcode' is an action that moves a motor or servo, i.e. is obsolete after an emergencyStop().
+ */
+int uartMotion(uint8_t opcode) {
+	return (opcode >= MOTOR_POWER_ACTION && opcode <= MOTOR_MULTI_ACTION) ||
+		(opcode >= SERVO_ONOFF_ACTION && opcode <= SERVO_MULTI_ACTION);
+}
+
+/*
+ * Queues the commands that switch all motors and servos off: the two multi actions if 'multi' is set, otherwise
+ * MOTOR_OFF_ACTION and SERVO_ONOFF_ACTION for every port, which older hardware controllers understand as well.
+ */
+void queueStop(int multi) {
+	static const uint8_t off[ESTOP_PORTS] = {0};
+	uint8_t send[3 + 8];
+	int port;
+	if(multi) {
+		uint8_t ports = (1 << ESTOP_PORTS) - 1;
+		queueUART(send, axcpBuildMultiAction(send, MOTOR_MULTI_ACTION, MOTOR_OFF_ACTION, ports, NULL));
+		queueUART(send, axcpBuildMultiAction(send, SERVO_MULTI_ACTION, SERVO_ONOFF_ACTION, ports, off));
+		return;
+	}
+	for(port=0; port<ESTOP_PORTS; port++) {
+		queueUART(send, axcpBuildPortCommand(send, MOTOR_OFF_ACTION, port));
+		queueUART(send, axcpBuildPortValueCommand(send, SERVO_ONOFF_ACTION, port, 0));
+	}
+}
+
+/*
+ * Switches all motors and servos off, ahead of everything waiting for the UART. Motor and servo actions that
+ * were not sent yet are dropped, as they are obsolete now; other control commands stay queued. Used whenever the
+ * program terminates or is stopped, so that no actuator keeps running on the last value the program set.
+ * The multi actions are used unless the hardware controller rejected them before. If it rejects them now, the
+ * stop is repeated with single port actions, see uart_cmd_received().
+ */
+void emergencyStop() {
+	estops++;
+	estop_started_at = timeMicros();
+	coalesceClear();
+	outqueueDrop(OUTQUEUE_CONTROL, uartMotion);
+	estop_multi_sent = hwc_multi_actions;
+	queueStop(hwc_multi_actions);
+	estop_target = outqueueQueuedBytes(OUTQUEUE_CONTROL);
+	uartSend();
+}
+
+/*
+ * Writes the command consisting of 'header' of 'headerLength' bytes followed by the 'length' bytes of 'data'
+ * to the UART, split into several commands with the same header that carry at most UART_BULK_PIECE_BYTES of
+ * 'data' each. This is for commands like EXECUTION_PRINTOUT_ACTION whose data is a stream anyway, so that
+ * commands of higher priority don't have to wait for a long one.
+ */
+void writeUARTStream(uint8_t *header, uint32_t headerLength, uint8_t *data, uint32_t length) {
+	struct iovec parts[2];
+	parts[0].iov_base = header;
+	parts[0].iov_len = headerLength;
+	do {
+		uint32_t piece = length < UART_BULK_PIECE_BYTES ? length : UART_BULK_PIECE_BYTES;
+		parts[1].iov_base = data;
+		parts[1].iov_len = piece;
+		queueUARTv(parts, 2);
+		data += piece;
+		length -= piece;
+	} while(length > 0);
+	if(!uart_corked)
+		uartSend();
+}
+
+/*
+ * Writes 'command' to the running user program. Does nothing if there is no program or the program has
+ * already terminated.
+ */
+void writeUprog(uint8_t* command, uint32_t length) {
+	struct iovec part;
+	part.iov_base = command;
+	part.iov_len = length;
+	writeUprogv(&part, 1);
+}
+
+/*
+ * Like writeUprog(), but the command is given as 'count' consecutive 'parts', see axcpEncodeAndSendv().
+ */
+void writeUprogv(const struct iovec *parts, int count) {
+	if(uprog_cmd_wfd == -1)
+		return;
+	int result;
+	if(uprog_ring_open)
+		result = axcpEncodeAndWriteRingv(&uprog_ring, parts, count);
+	else
+		result = axcpEncodeAndSendv(uprog_cmd_wfd, parts, count);
+	// EPIPE means the program terminated before reading, which is not an error
+	if(result == -1 && errno != EPIPE)
+		bailOut("I/O error when forwarding to pipe\n");
+	if(result == -2)
+		bailOut("Payload length inconsistency when forwarding to pipe\n");
+}
+
 /*
- * - return: 0 on success, 1 on compilation failure, -1 on precondition failure
+ * Writes the REQUEST_TAG_SWCINTERN with 'tag' that precedes the program's reply or error answering the request
+ * tagged 'tag'.
  */
-int compileProgram(const char *name, const uint16_t version, const char *code, const uint32_t codeLength, uint8_t** msg, uint32_t* msgLength) {
+void writeUprogTag(uint8_t tag) {
+	uint8_t send[2];
+	send[0] = REQUEST_TAG_SWCINTERN;
+	send[1] = tag;
+	writeUprog(send, 2);
+}
+
+/*
+ * Fills 'header' with 'opcode' followed by the name and version of the current program, which is the
+ * 35-byte header of all EXECUTION_* and DEBUGGING_* commands sent to the HLC. If the execution has a handle, the
+ * compact variant of 'opcode' followed by the handle is used instead.
+ * Return: the length of the header, i.e. 35 or 2.
+ */
+uint32_t composeExecutionHeader(uint8_t* header, uint8_t opcode) {
+	if(execution_handle != 0) {
+		switch(opcode) {
+		case EXECUTION_PRINTOUT_ACTION:
+			header[0] = EXECUTION_PRINTOUT_COMPACT_ACTION;
+			break;
+		case EXECUTION_DATA_ACTION:
+			header[0] = EXECUTION_DATA_COMPACT_ACTION;
+			break;
+		case DEBUGGING_BREAKED_ACTION:
+			header[0] = DEBUGGING_BREAKED_COMPACT_ACTION;
+			break;
+		}
+		header[1] = execution_handle;
+		return 2;
+	}
+	header[0] = opcode;
+	memcpy(header + 1, currName, 32);
+	header[33] = (currVersion >> 8) & 0xFF;
+	header[34] = currVersion & 0xFF;
+	return 35;
+}
+
+/*
+ * Forks gcc with 'gcc_file' as STDERR. The remaining arguments are passed to gcc; the list must be NULL terminated.
+ */
+int forkCompiler(int gcc_file, ...) {
+	char *args[16];
+	va_list ap;
+	int i = 0;
+	args[i++] = "gcc";
+	va_start(ap, gcc_file);
+	while(i < 15 && (args[i] = va_arg(ap, char*)) != NULL)
+		i++;
+	va_end(ap);
+	args[i] = NULL;
+
+	int pid = fork();
+	if(pid < 0) {
+		bailOut("Failed to fork compiler\n");
+	} else if(pid == 0) {
+		reactorResetSignals();
+		// Redirect STDERR of compiler to the end of the gcc file to have all warnings and errors in the right file
+		lseek(gcc_file, 0, SEEK_END);
+		dup2(gcc_file, STDERR_FILENO);
+		close(gcc_file);
+		execvp("gcc", args);
+		bailOut("Child exec fail\n");
+	}
+	return pid;
+}
+
+/*
+ * Starts compiling the program 'name' in 'version' for the connected hardware controller. The compiler runs
+ * as a child process; once it has terminated, compileStageDone() continues with linking and finally
+ * sends the reply for the request 'opcode' to the HLC.
+ * - return: 0 on success, -1 if no hardware controller is known, -2 if a compilation is already running
+ */
+int compileProgram(const char *name, const uint16_t version, const char *code, const uint32_t codeLength, uint8_t opcode) {
 
 	// Check if a hardware controller is connected that can be compiled against
 	if(hwctype == 0)
 		return -1;
+	if(compile_pid != -1)
+		return -2;
 
 	// Retrieve program name and program version
 	char localName[33];
@@ -130,81 +523,109 @@ int compileProgram(const char *name, const uint16_t version, const char *code, c
 
 	// Open file for gcc output, both for compiling and linking
 	snprintf(path, 128, "./%s/compiler_output", localName);
-	int gcc_file = open(path, O_CREAT | O_WRONLY | O_TRUNC, S_IRWXU | S_IRGRP | S_IROTH);
-	if(gcc_file == -1)
+	compile_file = open(path, O_CREAT | O_RDWR | O_TRUNC, S_IRWXU | S_IRGRP | S_IROTH);
+	if(compile_file == -1)
 		bailOut("Unable to create file\n");
 
 	// useful file names
 	char sourcefile[128];
 	char objectfile[128];
-	char binaryfile[128];
-	char hwctypefile[128];
 	snprintf(sourcefile, 128, "./%s/%s_v%d.c", localName, localName, version);
 	snprintf(objectfile, 128, "./%s/%s_v%d.o", localName, localName, version);
-	snprintf(binaryfile, 128, "./%s/%s_v%d", localName, localName, version);
-	snprintf(hwctypefile, 128, "./andrixhwtype%d.o", hwctype);
 
 	printf("Building...\n");        // <-----
 	printf("gcc -Wall -ggdb3 -std=c99 -pedantic -c -o %s %s\n", objectfile, sourcefile);   // <-----
 
-	// Execute the compiler in a separate process.
-	int pid = fork();
-	if(pid < 0) {
-		bailOut("Failed to fork compile\n");
-	} else if(pid == 0) {
-		// Redirect STDERR of compiler to have all warnings and errors in the right file and start compiling
-		dup2(gcc_file, STDERR_FILENO);
-		close(gcc_file);
-		execlp("gcc", "gcc", "-Wall", "-ggdb3", "-std=c99", "-pedantic", "-c", "-o", objectfile, sourcefile, NULL);
-		bailOut("Child exec fail\n");
+	// Execute the compiler in a separate process, its termination is reported via SIGCHLD
+	compile_pid = forkCompiler(compile_file, "-Wall", "-ggdb3", "-std=c99", "-pedantic", "-c", "-o", objectfile, sourcefile, NULL);
+	compile_linking = 0;
+	compile_opcode = opcode;
+	memcpy(compile_name, name, 32);
+	compile_version = version;
+
+	return 0;
+}
+
+/*
+ * Sends the reply for a compile request for which compileProgram() returned an error.
+ */
+void compileProgramFailed(int result, uint8_t opcode) {
+	if(result == -1) {
+		// Request a hardware controller sign.
+		uint8_t send1[1];
+		send1[0] = HW_CONTROLLER_TYPE_REQUEST;
+		writeUART(send1, 1);
 	}
+	// Send to HLC that operation failed.
+	uint8_t send2[3];
+	uint8_t errorCode = result == -1 ? ERRORCODE_NO_HW_CONTROLLER_CONNECTED : ERRORCODE_COMPILATION_IN_PROGRESS;
+	writeUART(send2, axcpBuildError(send2, errorCode, opcode));
+}
 
-	// Wait for the result of the compiler.
-	int compilerStatus;
-	int linkerStatus;
-	if(waitpid(pid, &compilerStatus, 0) < 0)
-		bailOut("Couldn't wait for child\n");
-	printf("Program compiled with status %d\n", compilerStatus); // <---
-
-	printf("gcc -o %s %s %s %s %s %s\n", binaryfile, objectfile, "./tools.o", "./axcp.o", "./userprogram.o", hwctypefile);
-
-	// If compilation successful, execute the linker in a separate process
-	if(compilerStatus == 0) {
-		pid = fork();
-		if(pid < 0) {
-			bailOut("Failed to fork linker\n");
-		} else if(pid == 0) {
-			// Set linker STDERR output at the end of the gcc file and start linking.
-			lseek(gcc_file, 0, SEEK_END);
-			dup2(gcc_file, STDERR_FILENO);
-			close(gcc_file);
-			execlp("gcc", "gcc", "-o", binaryfile, objectfile, "./tools.o", "./axcp.o", "./userprogram.o", hwctypefile, NULL);
-			bailOut("Child exec fail\n");
-		}
+/*
+ * Called when the compiler or linker process of the running compilation terminated with 'status'.
+ */
+void compileStageDone(int status) {
+	// Retrieve program name
+	char localName[33];
+	memcpy(localName, compile_name, 32);
+	localName[32] = '\0';
+	int i;
+	for(i = 31; localName[i] == ' '; i--)
+		localName[i] = '\0';
 
-		// Wait for the results of the linker
-		if(waitpid(pid, &linkerStatus, 0) < 0)
-			bailOut("Couldn't wait for child\n");
-		printf("Program linked with status %d\n", linkerStatus); // <---
+	if(!compile_linking) {
+		printf("Program compiled with status %d\n", status); // <---
+
+		// If compilation successful, execute the linker in a separate process
+		if(status == 0) {
+			char objectfile[128];
+			char binaryfile[128];
+			char hwctypefile[128];
+			snprintf(objectfile, 128, "./%s/%s_v%d.o", localName, localName, compile_version);
+			snprintf(binaryfile, 128, "./%s/%s_v%d", localName, localName, compile_version);
+			snprintf(hwctypefile, 128, "./andrixhwtype%d.o", hwctype);
+
+			printf("gcc -o %s %s %s %s %s %s %s %s -lrt\n", binaryfile, objectfile, "./tools.o", "./axcp.o", "./sharedstate.o", "./shmring.o", "./userprogram.o", hwctypefile);
+			compile_pid = forkCompiler(compile_file, "-o", binaryfile, objectfile, "./tools.o", "./axcp.o", "./sharedstate.o", "./shmring.o", "./userprogram.o", hwctypefile, "-lrt", NULL);
+			compile_linking = 1;
+			return;
+		}
+	} else {
+		printf("Program linked with status %d\n", status); // <---
 	}
+	compile_pid = -1;
+	int result = status == 0 ? 0 : 1;
 
-	// Find out length of gcc file
-	off_t len = lseek(gcc_file, 0, SEEK_END);
+	// Read the gcc file, which is the message for the HLC
+	off_t len = lseek(compile_file, 0, SEEK_END);
 	if(len < 0)
 		bailOut("Couldn't read length of compiler file\n");
-	*msgLength = (uint32_t) len;
-	close(gcc_file);
-
-	// Open gcc file for reading and read allocated buffer
-	gcc_file = open(path, O_RDONLY);
-	if(gcc_file == -1)
-		bailOut("Unable to open compiler file\n");
-	*msg = (uint8_t*) malloc(len);
-	if(fullRead(gcc_file, *msg, len) == -1)
+	uint8_t* msg = (uint8_t*) malloc(len);
+	lseek(compile_file, 0, SEEK_SET);
+	if(fullRead(compile_file, msg, len) == -1)
 		bailOut("Unable to read compiler file\n");
-	close(gcc_file);
-
-	return (compilerStatus == 0 && linkerStatus == 0) ? 0 : 1;
+	close(compile_file);
+	compile_file = -1;
+
+	// Compose answer and send to HLC
+	uint8_t header[36];
+	header[0] = compile_opcode == PROGRAM_COMPILE_REQUEST ? PROGRAM_COMPILE_REPLY : PROGRAM_COMPILE_EXECUTE_REPLY;
+	memcpy(header + 1, compile_name, 32);
+	header[33] = (compile_version >> 8) & 0xFF;
+	header[34] = compile_version & 0xFF;
+	header[35] = (uint8_t) result;
+	struct iovec parts[2];
+	parts[0].iov_base = header;
+	parts[0].iov_len = 36;
+	parts[1].iov_base = msg;
+	parts[1].iov_len = len;
+	writeUARTv(parts, 2);
+	free(msg);
+
+	// If compilation was successful and requested, execute the program
+	if(compile_opcode == PROGRAM_COMPILE_EXECUTE_REQUEST && result == 0)
+		startProgram(compile_name, compile_version, PROGRAM_COMPILE_EXECUTE_REQUEST);
 }
 
 /*
@@ -213,7 +634,7 @@ int compileProgram(const char *name, const uint16_t version, const char *code, c
  */
 int executeProgram(const char *name, const uint16_t version) {
 
-	if(pfds[1].fd != -1 || pfds[2].fd != -1)
+	if(program_pid != -1 || uprog_cmd_rfd != -1 || uprog_out_rfd != -1)
 		return -1;
 
 	// Retrieve program name and program version
@@ -236,12 +657,21 @@ int executeProgram(const char *name, const uint16_t version) {
 	int rpipe[2];
 	int wpipe[2];
 	int outpipe[2];
+	int eventpipe[2];
 	if(pipe(rpipe) < 0)
 		bailOut("Failed to open read pipe\n");
 	if(pipe(wpipe) < 0)
 		bailOut("Failed to open write pipe\n");
 	if(pipe(outpipe) < 0)
 		bailOut("Failed to open out pipe\n");
+	// Absorbs bursts of output while andrixswc is busy, so the program doesn't block; fails harmlessly if too large
+	fcntl(outpipe[0], F_SETPIPE_SZ, PROGRAM_OUT_PIPE_SIZE);
+	if(pipe(eventpipe) < 0)
+		bailOut("Failed to open event pipe\n");
+	// The pipes are still passed to the program if the rings are used, as their hangup tells that a side is gone
+	int ring_fd = -1;
+	if(use_program_ring && shmChannelCreate(&uprog_ring, &ring_fd) == -1)
+		printf("Failed to create program rings, using pipes\n");
 
 	// Start child process
 	int pid = fork();
@@ -249,9 +679,11 @@ int executeProgram(const char *name, const uint16_t version) {
 		bailOut("Failed to fork\n");
 	} else if(pid == 0) {
 		// Redirect child fds and start user program
+		reactorResetSignals();
 		close(rpipe[0]);
 		close(wpipe[1]);
 		close(outpipe[0]);
+		close(eventpipe[1]);
 		if(dup2(rpipe[1], PROGRAM_OUT_FD) == -1)
 			bailOut("Child write dup2 failed\n");
 		if(dup2(wpipe[0], PROGRAM_IN_FD) == -1)
@@ -260,9 +692,18 @@ int executeProgram(const char *name, const uint16_t version) {
 			bailOut("Child stdout dup2 failed\n");
 		if(dup2(outpipe[1], STDERR_FILENO) == -1)
 			bailOut("Child stderr dup2 failed\n");
+		if(shared_state_fd != -1 && dup2(shared_state_fd, SHARED_STATE_FD) == -1)
+			bailOut("Child shared state dup2 failed\n");
+		if(dup2(eventpipe[0], PROGRAM_EVENT_FD) == -1)
+			bailOut("Child event dup2 failed\n");
+		if(ring_fd != -1 && (dup2(ring_fd, PROGRAM_RING_FD) == -1 ||
+				dup2(uprog_ring.notifyFd, PROGRAM_RING_WAKE_FD) == -1 ||
+				dup2(uprog_ring.wakeFd, PROGRAM_RING_NOTIFY_FD) == -1))
+			bailOut("Child ring dup2 failed\n");
 		close(rpipe[1]);
 		close(wpipe[0]);
 		close(outpipe[1]);
+		close(eventpipe[0]);
 		execlp("stdbuf", "stdbuf", "-o0", "-e0", path, NULL);
 		bailOut("Child exec fail\n");
 	}
@@ -271,13 +712,28 @@ int executeProgram(const char *name, const uint16_t version) {
 	close(rpipe[1]);
 	close(wpipe[0]);
 	close(outpipe[1]);
+	close(eventpipe[0]);
 	uprog_cmd_wfd = wpipe[1];
-	pfds[1].fd = rpipe[0];
-	pfds[2].fd = outpipe[0];
+	uprog_event_wfd = eventpipe[1];
+	fcntl(uprog_event_wfd, F_SETFL, fcntl(uprog_event_wfd, F_GETFL) | O_NONBLOCK);
+	uprog_cmd_rfd = rpipe[0];
+	uprog_out_rfd = outpipe[0];
+	fcntl(uprog_cmd_rfd, F_SETFL, fcntl(uprog_cmd_rfd, F_GETFL) | O_NONBLOCK);
+	if(reactorAdd(uprog_cmd_rfd, uprog_cmd_readable) == -1 || reactorAdd(uprog_out_rfd, uprog_out_readable) == -1)
+		bailOut("Failed to register program pipes\n");
+	if(ring_fd != -1) {
+		close(ring_fd);
+		uprog_ring.hangupFd = uprog_cmd_rfd;
+		// andrixswc sleeps in the reactor until the program signals a command, see uprog_ring_readable()
+		shmChannelIdle(&uprog_ring);
+		if(reactorAdd(uprog_ring.wakeFd, uprog_ring_readable) == -1)
+			bailOut("Failed to register program rings\n");
+		uprog_ring_open = 1;
+	}
 	program_pid = pid;
 	currVersion = version;
 	memcpy(currName, name, 32);
-	customDataBuffer = createFIFO(CUSTOM_DATA_BUFFER_SIZE);
+	customDataBuffer = createGrowableFIFO(CUSTOM_DATA_BUFFER_SIZE, custom_data_max_size);
 	printf("Program %s successfully started with pid %d\n", localName, program_pid); // <---
 
   // Prepare debugger for executable
@@ -294,65 +750,429 @@ int executeProgram(const char *name, const uint16_t version) {
 	return 0;
 }
 
+/*
+ * Executes the program 'name' in 'version' and reports the result to the HLC, i.e. EXECUTION_STARTED_ACTION
+ * on success or an ERROR_ACTION caused by 'opcode' otherwise.
+ */
+void startProgram(const char *name, const uint16_t version, uint8_t opcode) {
+	int result = executeProgram(name, version);
+	// If a program is already running
+	if(result == -1) {
+		uint8_t send[3];
+		writeUART(send, axcpBuildError(send, ERRORCODE_A_PROGRAM_IS_ALREADY_RUNNING, opcode));
+		return;
+	}
+	// If the program wasn't found
+	if(result == -2) {
+		uint8_t send[3];
+		writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_NOT_FOUND, opcode));
+		return;
+	}
+
+	uint8_t send[36];
+	send[0] = EXECUTION_STARTED_ACTION;
+	memcpy(send + 1, currName, 32);
+	send[33] = (currVersion >> 8) & 0xFF;
+	send[34] = currVersion & 0xFF;
+	if(!compact_execution) {
+		writeUART(send, 35);
+		return;
+	}
+	// Every execution gets a new handle, so commands of a previous execution can't be mistaken for this one's
+	last_execution_handle = last_execution_handle == 255 ? 1 : last_execution_handle + 1;
+	execution_handle = last_execution_handle;
+	send[0] = EXECUTION_STARTED_COMPACT_ACTION;
+	send[35] = execution_handle;
+	writeUART(send, 36);
+}
+
+/*
+ * Tells 'requesters' that their request with 'opcode' and 'tag' won't be answered.
+ */
+void requestFailed(uint32_t requesters, uint8_t opcode, uint8_t tag, uint8_t errorCode) {
+	if(requesters & PENDING_REQUESTER_PROGRAM) {
+		uint8_t send[3];
+		writeUprogTag(tag);
+		writeUprog(send, axcpBuildError(send, errorCode, opcode));
+	}
+}
+
+/*
+ * Sends the 'request' of 'length' bytes tagged 'tag' to the hardware controller on behalf of 'requester', unless
+ * the same request is already in flight. The reply is routed back by routeReply(). 'port' is the port the reply
+ * carries or PENDING_NO_PORT.
+ */
+void requestFromHWC(uint8_t *request, uint32_t length, int port, uint32_t requester, uint8_t tag) {
+	// The reply opcode always directly follows the request opcode
+	int result = pendingAdd(request[0] + 1, port, requester, tag, request, length, timeMillis());
+	if(result == 1)
+		return;
+	if(result == -1) {
+		printf("Too many requests in flight\n");
+		requestFailed(requester, request[0], tag, ERRORCODE_UNSPECIFIED_ERROR);
+		return;
+	}
+	writeUART(request, length);
+	if(!request_timer_armed) {
+		reactorArmTimer(request_timer, REQUEST_TIMEOUT_MS);
+		request_timer_armed = 1;
+	}
+}
+
+/*
+ * Passes the 'reply' of 'length' bytes from the hardware controller to everyone who requested it. 'port' is
+ * the port the reply carries or PENDING_NO_PORT. Replies nobody waits for are dropped.
+ */
+void routeReply(uint8_t *reply, uint32_t length, int port) {
+	mirrorStore(reply, length, port, timeMillis());
+	uint8_t tag;
+	uint32_t requesters = pendingComplete(reply[0], port, &tag);
+	if(requesters & PENDING_REQUESTER_PROGRAM) {
+		writeUprogTag(tag);
+		writeUprog(reply, length);
+	}
+}
+
+/*
+ * Answers the program's state 'request' of 'length' bytes from the mirror if the value is at most mirror_max_age
+ * milliseconds old, or requests it from the hardware controller otherwise. 'port' is as for requestFromHWC().
+ */
+void requestState(uint8_t *request, uint32_t length, int port) {
+	uint8_t reply[MIRROR_MAX_REPLY_LENGTH];
+	uint32_t replyLength = 0;
+	if(mirror_max_age > 0)
+		replyLength = mirrorLookup(request[0] + 1, port, timeMillis(), mirror_max_age, reply);
+	if(replyLength > 0) {
+		mirror_hits++;
+		writeUprogTag(uprog_request_tag);
+		writeUprog(reply, replyLength);
+		return;
+	}
+	mirror_misses++;
+	requestFromHWC(request, length, port, PENDING_REQUESTER_PROGRAM, uprog_request_tag);
+}
+
+// Sends a timed out request again or gives up on it after REQUEST_MAX_RETRIES, see pendingExpire()
+int request_expired(pending_request_t *entry) {
+	if(entry->retries < REQUEST_MAX_RETRIES) {
+		printf("Request %d timed out, sending again\n", entry->request[0]); // <---
+		entry->retries++;
+		request_retries++;
+		writeUART(entry->request, entry->requestLength);
+		return 1;
+	}
+	printf("Request %d failed\n", entry->request[0]); // <---
+	request_failures++;
+	requestFailed(entry->requesters, entry->request[0], entry->tag, ERRORCODE_REQUEST_TIMEOUT);
+	return 0;
+}
+
+void request_timeout(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	int next = pendingExpire(timeMillis(), REQUEST_TIMEOUT_MS, request_expired);
+	reactorArmTimer(request_timer, next);
+	request_timer_armed = next > 0;
+}
+
+/*
+ * Return: the index in program_subscriptions of a subscription or update 'opcode' or -1 if it is neither.
+ */
+int subscriptionSlot(uint8_t opcode) {
+	switch(opcode) {
+	case ANALOG_SENSOR_SUBSCRIPTION:
+	case ANALOG_SENSOR_UPDATE:
+		return 0;
+	case DIGITAL_SENSOR_SUBSCRIPTION:
+	case DIGITAL_SENSOR_UPDATE:
+		return 1;
+	case MOTOR_POSITION_SUBSCRIPTION:
+	case MOTOR_POSITION_UPDATE:
+		return 2;
+	case MOTOR_VELOCITY_SUBSCRIPTION:
+	case MOTOR_VELOCITY_UPDATE:
+		return 3;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Records the ports of the program's subscription 'command' of 'length' bytes. Its payload is a list of
+ * [port, interval high byte, interval low byte] records, where an interval of 0 cancels the subscription.
+ */
+void recordSubscription(uint8_t *command, uint32_t length) {
+	int slot = subscriptionSlot(command[0]);
+	uint32_t i;
+	for(i=1; i + 3 <= length; i += 3) {
+		if(command[i] >= 16)
+			continue;
+		if(command[i + 1] == 0 && command[i + 2] == 0)
+			program_subscriptions[slot] &= ~(1 << command[i]);
+		else
+			program_subscriptions[slot] |= 1 << command[i];
+	}
+}
+
+/*
+ * Cancels all subscriptions of the terminated program at the hardware controller, so that it stops sending
+ * updates nobody listens to.
+ */
+void cancelSubscriptions() {
+	int slot;
+	for(slot=0; slot<SUBSCRIPTION_SLOTS; slot++) {
+		if(program_subscriptions[slot] == 0)
+			continue;
+		uint8_t send[1 + 16 * 3];
+		uint32_t length = 1;
+		uint8_t port;
+		send[0] = subscription_opcodes[slot];
+		for(port=0; port<16; port++) {
+			if((program_subscriptions[slot] & (1 << port)) == 0)
+				continue;
+			send[length++] = port;
+			send[length++] = 0;
+			send[length++] = 0;
+		}
+		writeUART(send, length);
+		program_subscriptions[slot] = 0;
+	}
+}
+
+/*
+ * Passes the event 'command' of 'length' bytes to the running program via its event pipe. Events the program
+ * doesn't read fast enough are dropped instead of blocking andrixswc; the latest values are still available
+ * in the shared state.
+ */
+void forwardEvent(uint8_t *command, uint32_t length) {
+	if(uprog_event_wfd == -1)
+		return;
+	// Events are smaller than PIPE_BUF, so a non-blocking write is either complete or fails with EAGAIN
+	if(axcpEncodeAndSend(uprog_event_wfd, command, length) == -1)
+		updates_dropped++;
+	else
+		updates_forwarded++;
+}
+
+/*
+ * Passes the update 'command' of 'length' bytes to the program if it subscribed to any port of it.
+ */
+void forwardUpdate(uint8_t *command, uint32_t length) {
+	if(program_subscriptions[subscriptionSlot(command[0])] != 0)
+		forwardEvent(command, length);
+}
+
+/*
+ * Handles all commands in the ring from the program. Everything the program sent at once is forwarded to the UART
+ * in one burst, as for the pipe in uprog_cmd_readable().
+ */
+void uprogRingDrain() {
+	const uint8_t *data;
+	uint32_t length;
+	uart_corked = 1;
+	do {
+		while(uprog_ring_open && (length = shmChannelPeek(&uprog_ring, &data)) > 0) {
+			uprog_decoder.reads++;
+			axcpDecode(&uprog_decoder, data, length);
+			shmChannelConsume(&uprog_ring, length);
+		}
+	// The program only signals commands sent after andrixswc announced to sleep
+	} while(uprog_ring_open && !shmChannelIdle(&uprog_ring));
+	uart_corked = 0;
+	uartSend();
+}
+
+void uprog_ring_readable(int fd, uint32_t events) {
+	(void) events;
+	eventfd_t count;
+	eventfd_read(fd, &count);
+	uprogRingDrain();
+}
+
+/*
+ * Closes the rings of a terminated program. Commands still in the ring are handled first.
+ */
+void closeProgramRing() {
+	if(!uprog_ring_open)
+		return;
+	uprogRingDrain();
+	uprog_ring_open = 0;
+	uprog_ring_notifications += uprog_ring.notifications;
+	uprog_ring_sleeps += uprog_ring.sleeps;
+	reactorRemove(uprog_ring.wakeFd);
+	shmChannelClose(&uprog_ring);
+}
+
+/*
+ * Closes the pipes and rings of a terminated program. Commands and output still buffered in them are handled
+ * first.
+ */
+void closeProgramPipes() {
+	if(uprog_out_rfd != -1) {
+		// Don't block if a child of the program still holds the pipe open
+		fcntl(uprog_out_rfd, F_SETFL, fcntl(uprog_out_rfd, F_GETFL) | O_NONBLOCK);
+		uint8_t uprog_out_buffer[512];
+		int uprog_out_length;
+		while((uprog_out_length = read(uprog_out_rfd, uprog_out_buffer, 512)) > 0)
+			uprog_out_received(uprog_out_buffer, uprog_out_length);
+		reactorRemove(uprog_out_rfd);
+		close(uprog_out_rfd);
+		uprog_out_rfd = -1;
+	}
+	// The output has to be sent before the termination is reported and the next program starts
+	printoutFlush(1, 1);
+	closeProgramRing();
+	if(uprog_cmd_rfd != -1) {
+		// Handle the commands the program sent right before terminating
+		axcpDecodeAvailable(&uprog_decoder, uprog_cmd_rfd);
+		axcpDecoderReset(&uprog_decoder);
+		reactorRemove(uprog_cmd_rfd);
+		close(uprog_cmd_rfd);
+		close(uprog_cmd_wfd);
+		uprog_cmd_rfd = -1;
+		uprog_cmd_wfd = -1;
+	}
+	if(uprog_event_wfd != -1) {
+		close(uprog_event_wfd);
+		uprog_event_wfd = -1;
+	}
+	// Replies to requests of the terminated program must not reach the next one
+	pendingCancel(PENDING_REQUESTER_PROGRAM);
+	cancelSubscriptions();
+	cancelCustomDataWait();
+	destroyFIFO(customDataBuffer);
+	customDataBuffer = NULL;
+}
+
+/*
+ * Called when the user program terminated with 'status'. Reports the termination to the HLC and restarts
+ * the program if a restart was requested.
+ */
+void programTerminated(int status) {
+	program_pid = -1;
+	debugger_attached = 0;
+	debugger_breaked = 0;
+	closeProgramPipes();
+	// A stopped program was already stopped and couldn't move anything since
+	if(!program_stopping)
+		emergencyStop();
+	program_stopping = 0;
+
+	if(WIFSIGNALED(status) != 0 && WTERMSIG(status) == SIGTERM) {
+		printf("Program signaled via SIGTERM!\n"); // <---
+		uint8_t send[35];
+		send[0] = EXECUTION_STOPPED_ACTION;
+		memcpy(send + 1, currName, 32);
+		send[33] = (currVersion >> 8) & 0xFF;
+		send[34] = currVersion & 0xFF;
+		writeUART(send, 35);
+	} else {
+		// A program killed by any other signal crashed, report it like a shell: 128 + signal number
+		int retVal = WIFEXITED(status) != 0 ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		printf("Program exited with status %d\n", status); // <---
+		uint8_t send[39];
+		send[0] = EXECUTION_DONE_ACTION;
+		memcpy(send + 1, currName, 32);
+		send[33] = (currVersion >> 8) & 0xFF;
+		send[34] = currVersion & 0xFF;
+		send[35] = (retVal >> 24) & 0xFF;
+		send[36] = (retVal >> 16) & 0xFF;
+		send[37] = (retVal >> 8) & 0xFF;
+		send[38] = retVal & 0xFF;
+		writeUART(send, 39);
+	}
+	// The handle expires with the execution
+	execution_handle = 0;
+
+	if(restart) {
+		restart = 0;
+		startProgram(currName, currVersion, EXECUTION_RESTART_ACTION);
+	}
+}
+
 int uart_cmd_received(uint8_t* command, uint32_t length) {
 	switch(command[0]) {
 	case ANALOG_SENSOR_REPLY:
 	case DIGITAL_SENSOR_REPLY:
 	case MOTOR_POSITION_REPLY:
 	case MOTOR_VELOCITY_REPLY:
-		if(replyOpcode == command[0] && replyPort == command[1]) {
-			replyOpcode = -1;
-			replyPort = -1;
-      if(uprog_cmd_wfd != -1) {
-        int result = axcpEncodeAndSend(uprog_cmd_wfd, command, length);
-			  if(result == -1)
-			 	  bailOut("I/O error when forwarding to pipe\n");
-			  if(result == -2)
-				  bailOut("Payload length inconsistency when forwarding to pipe\n");
-      }
-		}
+		routeReply(command, length, command[1]);
 		break;
 	case CONTROLLER_BATTERY_CHARGE_REPLY:
 	case CONTROLLER_BATTERY_CHARGING_STATE_REPLY:
 	case PHONE_BATTERY_CHARGE_REPLY:
 	case PHONE_BATTERY_CHARGING_STATE_REPLY:
-		if(replyOpcode == command[0]) {
-      replyOpcode = -1;
-      if(uprog_cmd_wfd != -1) {
-			  int result = axcpEncodeAndSend(uprog_cmd_wfd, command, length);
-			  if(result == -1)
-				  bailOut("I/O error when forwarding to pipe\n");
-			  if(result == -2)
-				  bailOut("Payload length inconsistency when forwarding to pipe\n");
-			}
-		}
+	case ANALOG_SENSOR_ALL_REPLY:
+	case DIGITAL_SENSOR_ALL_REPLY:
+		routeReply(command, length, PENDING_NO_PORT);
 		break;
 	case ANALOG_SENSOR_UPDATE:
 		printf("ANALOG SENSOR UPDATE\n");
+		mirrorStoreUpdate(ANALOG_SENSOR_REPLY, command + 1, length - 1, timeMillis());
+		forwardUpdate(command, length);
 		break;
 	case DIGITAL_SENSOR_UPDATE:
 		printf("DIGITAL SENSOR UPDATE\n");
+		mirrorStoreUpdate(DIGITAL_SENSOR_REPLY, command + 1, length - 1, timeMillis());
+		forwardUpdate(command, length);
 		break;
 	case MOTOR_POSITION_UPDATE:
 		printf("MOTOR POSITION UPDATE\n");
+		mirrorStoreUpdate(MOTOR_POSITION_REPLY, command + 1, length - 1, timeMillis());
+		forwardUpdate(command, length);
 		break;
 	case MOTOR_VELOCITY_UPDATE:
 		printf("MOTOR VELOCITY UPDATE\n");
+		mirrorStoreUpdate(MOTOR_VELOCITY_REPLY, command + 1, length - 1, timeMillis());
+		forwardUpdate(command, length);
+		break;
+	case MOTOR_POSITION_REACHED_ACTION:
+		forwardEvent(command, length);
 		break;
+	case CONTROLLER_BATTERY_UPDATE: {
+		// Carries the charge and the charging state
+		uint8_t reply[2];
+		reply[0] = CONTROLLER_BATTERY_CHARGE_REPLY;
+		reply[1] = command[1];
+		mirrorStore(reply, 2, PENDING_NO_PORT, timeMillis());
+		reply[0] = CONTROLLER_BATTERY_CHARGING_STATE_REPLY;
+		reply[1] = command[2];
+		mirrorStore(reply, 2, PENDING_NO_PORT, timeMillis());
+		break;
+	}
 	case SW_CONTROLLER_RESET_ACTION:
 		system("ls -d ./*/ | xargs rm -r");
 		hwctype = 0;
+		mirrorClear();
 		break;
 	case SW_CONTROLLER_OFF_ACTION:
-		free(command);
 		return 1;
-	case ERROR_ACTION:
+	case ERROR_ACTION: {
 		printf("ERROR ACTION\n");
 		printf("Error code: %d\n", command[1]);
 		printf("Causing opcode: %d\n", command[2]);
+		// A rejected request is never answered, so its requesters get the error right away instead of a timeout
+		uint8_t tag;
+		uint32_t requesters = pendingFail(command[2] + 1, &tag);
+		if(requesters != 0)
+			requestFailed(requesters, command[2], tag, command[1]);
+		if(command[1] == ERRORCODE_UNSPECIFIED_OPCODE &&
+				(command[2] == MOTOR_MULTI_ACTION || command[2] == SERVO_MULTI_ACTION)) {
+			hwc_multi_actions = 0;
+			// The last emergency stop didn't stop anything, so it is repeated with single port actions
+			if(estop_multi_sent) {
+				estop_multi_sent = 0;
+				queueStop(0);
+				uartSend();
+			}
+		}
 		break;
-	case HW_CONTROLLER_TYPE_REPLY:
+	} case HW_CONTROLLER_TYPE_REPLY:
+		// Sent after the hardware controller (re)started, so its previous state is gone
 		hwctype = command[1];
+		hwc_multi_actions = 1;
+		estop_multi_sent = 0;
+		mirrorClear();
 		break;
 	case SW_CONTROLLER_TYPE_REQUEST: {
 		uint8_t answer[2];
@@ -363,133 +1183,34 @@ int uart_cmd_received(uint8_t* command, uint32_t length) {
 	} case PROGRAM_COMPILE_REQUEST: {
 		printf("PROGRAM COMPILE REQUEST\n"); // <---
 
-		// Compose answer and send to HLC
-		uint8_t* msg;
-		uint32_t msgLength;
+		// The reply is sent to the HLC once compiling and linking are done
 		uint16_t version = (command[33] << 8) | command[34];
-		int result = compileProgram((char*) (command + 1), version, (char*) (command + 35), length - 35, &msg, &msgLength);
-
-		// if there's no hardware controller to compile against
-		if(result == -1) {
-			// Request a hardware controller sign.
-			uint8_t send1[1];
-			send1[0] = HW_CONTROLLER_TYPE_REQUEST;
-			writeUART(send1, 1);
-			// Send to HLC that operation failed.
-			uint8_t send2[3];
-			send2[0] = ERROR_ACTION;
-			send2[1] = ERRORCODE_NO_HW_CONTROLLER_CONNECTED;
-			send2[2] = PROGRAM_COMPILE_REQUEST;
-			writeUART(send2, 3);
-			break;
-		}
-
-		uint8_t answer[msgLength + 36];
-		answer[0] = PROGRAM_COMPILE_REPLY;
-		memcpy(answer + 1, command + 1, 32);
-		memcpy(answer + 33, command + 33, 2);
-		answer[35] = (uint8_t) result;
-		memcpy(answer + 36, msg, msgLength);
-		free(msg);
-		writeUART(answer, msgLength + 36);
-
+		int result = compileProgram((char*) (command + 1), version, (char*) (command + 35), length - 35, PROGRAM_COMPILE_REQUEST);
+		if(result < 0)
+			compileProgramFailed(result, PROGRAM_COMPILE_REQUEST);
 		break;
 	} case PROGRAM_EXECUTE_ACTION: {
 
 		printf("PROGRAM EXECUTE ACTION\n"); // <---
 
 		uint16_t version = (command[33] << 8) | command[34];
-		int result = executeProgram((char*) (command + 1), version);
-		// If a program is already running
-		if(result == -1) {
-			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_A_PROGRAM_IS_ALREADY_RUNNING;
-			send[2] = PROGRAM_EXECUTE_ACTION;
-			writeUART(send, 3);
-			break;
-		}
-		// If the program wasn't found
-		if(result == -2) {
-			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_NOT_FOUND;
-			send[2] = PROGRAM_EXECUTE_ACTION;
-			writeUART(send, 3);
-			break;
-		}
-
-		uint8_t send[35];
-		send[0] = EXECUTION_STARTED_ACTION;
-		memcpy(send + 1, currName, 32);
-		send[33] = (currVersion >> 8) & 0xFF;
-		send[34] = currVersion & 0xFF;
-		writeUART(send, 35);
+		startProgram((char*) (command + 1), version, PROGRAM_EXECUTE_ACTION);
 		break;
 	} case PROGRAM_COMPILE_EXECUTE_REQUEST: {
 
 		printf("PROGRAM COMPILE EXECUTE REQUEST\n"); // <---
 
-		uint8_t* msg;
-		uint32_t msgLength;
+		// The reply is sent and the program executed once compiling and linking are done
 		uint16_t version = (command[33] << 8) | command[34];
-		int result = compileProgram((char*) (command + 1), version, (char*) (command + 35), length - 35, &msg, &msgLength);
-
-		// if there's no hardware controller to compile against
-		if(result == -1) {
-			// Request a hardware controller sign.
-			uint8_t send1[1];
-			send1[0] = HW_CONTROLLER_TYPE_REQUEST;
-			writeUART(send1, 1);
-			// Send to HLC that operation failed.
-			uint8_t send2[3];
-			send2[0] = ERROR_ACTION;
-			send2[1] = ERRORCODE_NO_HW_CONTROLLER_CONNECTED;
-			send2[2] = PROGRAM_COMPILE_EXECUTE_REQUEST;
-			writeUART(send2, 3);
-			break;
-		}
-
-		// Compose compilation answer and send to HLC
-		uint8_t answer[msgLength + 36];
-		answer[0] = PROGRAM_COMPILE_EXECUTE_REPLY;
-		memcpy(answer + 1, command + 1, 32);
-		memcpy(answer + 33, command + 33, 2);
-		answer[35] = (uint8_t) result;
-		memcpy(answer + 36, msg, msgLength);
-		free(msg);
-		writeUART(answer, msgLength + 36);
-
-		// If compilation was unsuccessfuly, stop
-		if(answer[35] != 0)
-			break;
-
-		result = executeProgram((char*) (command + 1), version);
-		// If a program is already running
-		if(result == -1) {
-			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_A_PROGRAM_IS_ALREADY_RUNNING;
-			send[2] = PROGRAM_COMPILE_EXECUTE_REQUEST;
-			writeUART(send, 3);
-			break;
-		}
-		// If the program wasn't found
-		if(result == -2) {
-			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_NOT_FOUND;
-			send[2] = PROGRAM_COMPILE_EXECUTE_REQUEST;
-			writeUART(send, 3);
-			break;
-		}
+		int result = compileProgram((char*) (command + 1), version, (char*) (command + 35), length - 35, PROGRAM_COMPILE_EXECUTE_REQUEST);
+		if(result < 0)
+			compileProgramFailed(result, PROGRAM_COMPILE_EXECUTE_REQUEST);
+		break;
+	} case EXECUTION_COMPACT_SUBSCRIPTION: {
+		printf("EXECUTION COMPACT SUBSCRIPTION\n"); // <---
 
-		uint8_t send[35];
-		send[0] = EXECUTION_STARTED_ACTION;
-		memcpy(send + 1, currName, 32);
-		send[33] = (currVersion >> 8) & 0xFF;
-		send[34] = currVersion & 0xFF;
-		writeUART(send, 35);
+		// Takes effect with the next EXECUTION_STARTED_COMPACT_ACTION, a running execution keeps its header
+		compact_execution = command[1] != 0;
 		break;
 	} case PROGRAMS_FETCH_SUBSCRIPTION: {
 		printf("PROGRAMS FETCH SUBSCRIPTION\n"); // <---
@@ -534,18 +1255,26 @@ int uart_cmd_received(uint8_t* command, uint32_t length) {
 				int filelen = lseek(temp_fd, 0, SEEK_END) - startOffset;
 				lseek(temp_fd, startOffset, SEEK_SET);
 
-				uint8_t send[filelen + 35];
-				send[0] = PROGRAMS_FETCH_UPDATE;
+				uint8_t header[35];
+				header[0] = PROGRAMS_FETCH_UPDATE;
 				len = strlen(root -> d_name);
-				memcpy((char*)(send + 1), root -> d_name, len);
+				memcpy((char*)(header + 1), root -> d_name, len);
 				for(i = 1 + len; i < 33; i++)
-					send[i] = ' ';
-				send[33] = (version >> 8) & 0xFF;
-				send[34] = version & 0xFF;
+					header[i] = ' ';
+				header[33] = (version >> 8) & 0xFF;
+				header[34] = version & 0xFF;
 
-				if(fullRead(temp_fd, send+35, filelen) == -1)
+				uint8_t *source = (uint8_t*) malloc(filelen);
+				if(fullRead(temp_fd, source, filelen) == -1)
 					bailOut("Failed to read source file\n");
-				writeUART(send, filelen + 35);
+				close(temp_fd);
+				struct iovec parts[2];
+				parts[0].iov_base = header;
+				parts[0].iov_len = 35;
+				parts[1].iov_base = source;
+				parts[1].iov_len = filelen;
+				writeUARTv(parts, 2);
+				free(source);
 			}
 		}
 
@@ -559,13 +1288,13 @@ int uart_cmd_received(uint8_t* command, uint32_t length) {
 
 		if(program_pid < 0) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_RUNNING;
-			send[2] = EXECUTION_STOP_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_RUNNING, EXECUTION_STOP_ACTION));
 			break;
 		}
 
+		// Stop the actuators right away instead of when the termination is reported
+		emergencyStop();
+		program_stopping = 1;
 		if (!debugger_breaked) {
 			// Signal child process; SIGTERM also automatically detaches the debugger
 			kill(program_pid, SIGTERM);
@@ -580,58 +1309,43 @@ int uart_cmd_received(uint8_t* command, uint32_t length) {
 		printf("EXECUTION RESTART ACTION\n"); // <---
 
 		if(program_pid < 0) {
-			int result = executeProgram(currName, currVersion);
-			if(result == -2) {
-				uint8_t send[3];
-				send[0] = ERROR_ACTION;
-				send[1] = ERRORCODE_PROGRAM_NOT_FOUND;
-				send[2] = EXECUTION_RESTART_ACTION;
-				writeUART(send, 3);
-			} else if(result == 0) {
-				uint8_t send[35];
-				send[0] = EXECUTION_STARTED_ACTION;
-				memcpy(send + 1, currName, 32);
-				send[33] = (currVersion >> 8) & 0xFF;
-				send[34] = currVersion & 0xFF;
-				writeUART(send, 35);
-			} else {
-				bailOut("Impossible return value from executeProgram\n");
-			}
+			startProgram(currName, currVersion, EXECUTION_RESTART_ACTION);
 		} else {
-			// Signal child process; SIGTERM also automatically detaches the debugger
+			// Signal child process; SIGTERM also automatically detaches the debugger.
+			// The program is started again as soon as its termination is reported.
+			emergencyStop();
+			program_stopping = 1;
 			kill(program_pid, SIGTERM);
 			restart = 1;
 		}
 		break;
-	} case EXECUTION_DATA_ACTION: {
+	} case EXECUTION_DATA_ACTION:
+	case EXECUTION_DATA_COMPACT_ACTION: {
 		printf("EXECUTION DATA ACTION\n"); // <---
 
-		if(program_pid < 0) {
+		uint32_t headerLength = command[0] == EXECUTION_DATA_COMPACT_ACTION ? 2 : 35;
+		// A compact command is only accepted with the handle of the current execution
+		if(program_pid < 0 || length < headerLength ||
+				(headerLength == 2 && (execution_handle == 0 || command[1] != execution_handle))) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_RUNNING;
-			send[2] = EXECUTION_DATA_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_RUNNING, command[0]));
 			break;
 		}
-		int customDataLength = length - 35;
-		int i;
-		for(i=0; i<customDataLength; i++) {
-			if(appendFIFO(command[35+i], customDataBuffer) == -1) {
-				// TODO buffer full: send error action
-				break;
-			}
+		int customDataLength = length - headerLength;
+		int added = appendFIFOBytes(command + headerLength, customDataLength, customDataBuffer);
+		// Without a buffer nothing is added, and if the program doesn't read fast enough the rest is dropped
+		if(added < customDataLength) {
+			uint8_t send[3];
+			writeUART(send, axcpBuildError(send, ERRORCODE_CUSTOM_DATA_BUFFER_FULL, command[0]));
 		}
+		completeCustomDataWait(0);
 		break;
 	} case DEBUGGING_BREAK_ACTION: {
 		printf("DEBUGGING BREAK ACTION\n"); // <---
 
 		if(program_pid < 0) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_RUNNING;
-			send[2] = DEBUGGING_BREAK_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_RUNNING, DEBUGGING_BREAK_ACTION));
 			break;
 		}
 
@@ -653,19 +1367,13 @@ int uart_cmd_received(uint8_t* command, uint32_t length) {
 
 		if(program_pid < 0) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_RUNNING;
-			send[2] = DEBUGGING_CONTINUE_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_RUNNING, DEBUGGING_CONTINUE_ACTION));
 			break;
 		}
 
 		if(!debugger_breaked) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_BREAKED;
-			send[2] = DEBUGGING_CONTINUE_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_BREAKED, DEBUGGING_CONTINUE_ACTION));
 			break;
 		}
 
@@ -681,19 +1389,13 @@ int uart_cmd_received(uint8_t* command, uint32_t length) {
 
 		if(program_pid < 0) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_RUNNING;
-			send[2] = DEBUGGING_ADD_BREAKPOINT_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_RUNNING, DEBUGGING_ADD_BREAKPOINT_ACTION));
 			break;
 		}
 
 		if(!debugger_breaked) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_BREAKED;
-			send[2] = DEBUGGING_ADD_BREAKPOINT_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_BREAKED, DEBUGGING_ADD_BREAKPOINT_ACTION));
 			break;
 		}
 
@@ -710,19 +1412,13 @@ int uart_cmd_received(uint8_t* command, uint32_t length) {
 
 		if(program_pid < 0) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_RUNNING;
-			send[2] = DEBUGGING_REMOVE_BREAKPOINT_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_RUNNING, DEBUGGING_REMOVE_BREAKPOINT_ACTION));
 			break;
 		}
 
 		if(!debugger_breaked) {
 			uint8_t send[3];
-			send[0] = ERROR_ACTION;
-			send[1] = ERRORCODE_PROGRAM_IS_NOT_BREAKED;
-			send[2] = DEBUGGING_REMOVE_BREAKPOINT_ACTION;
-			writeUART(send, 3);
+			writeUART(send, axcpBuildError(send, ERRORCODE_PROGRAM_IS_NOT_BREAKED, DEBUGGING_REMOVE_BREAKPOINT_ACTION));
 			break;
 		}
 
@@ -738,13 +1434,76 @@ int uart_cmd_received(uint8_t* command, uint32_t length) {
 		break;
 	}
 
-	free(command);
 	return 0;
 
 }
 
+/*
+ * Answers the program's custom data request tagged 'tag' with the reply 'opcode' and up to 'capacity' buffered
+ * bytes, which are passed on directly from the custom data buffer.
+ */
+void replyCustomData(uint8_t opcode, uint8_t tag, uint32_t capacity) {
+	struct iovec parts[3];
+	uint32_t length = 0;
+	int count = 1;
+	parts[0].iov_base = &opcode;
+	parts[0].iov_len = 1;
+	// The bytes may wrap around the end of the buffer, i.e. consist of two spans
+	while(count < 3 && length < capacity) {
+		uint8_t *span;
+		uint32_t n = readSpanFIFO(&span, customDataBuffer);
+		if(n == 0)
+			break;
+		if(n > capacity - length)
+			n = capacity - length;
+		parts[count].iov_base = span;
+		parts[count].iov_len = n;
+		count++;
+		// Nothing is written to the buffer before the reply is sent
+		consumeFIFO(n, customDataBuffer);
+		length += n;
+	}
+	writeUprogTag(tag);
+	writeUprogv(parts, count);
+}
+
+/*
+ * Sends the deferred reply to the program's WAIT_CUSTOM_DATA_REQUEST_SWCINTERN if enough custom data arrived or
+ * the wait 'expired'.
+ */
+void completeCustomDataWait(int expired) {
+	if(!custom_data_waiting)
+		return;
+	int available = availableFIFO(customDataBuffer);
+	if(!expired && available >= 0 && (uint32_t) available < custom_data_minimum)
+		return;
+	custom_data_waiting = 0;
+	reactorArmTimer(custom_data_timer, 0);
+	replyCustomData(WAIT_CUSTOM_DATA_REPLY_SWCINTERN, custom_data_tag, custom_data_capacity);
+}
+
+void custom_data_timeout(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	completeCustomDataWait(1);
+}
+
+/*
+ * Forgets a deferred custom data request of a terminated program.
+ */
+void cancelCustomDataWait() {
+	custom_data_waiting = 0;
+	reactorArmTimer(custom_data_timer, 0);
+}
+
 void uprog_cmd_received(uint8_t* command, uint32_t length) {
+	// A stopped program must not move anything after the emergency stop
+	if(program_stopping && uartPriority(command[0]) == OUTQUEUE_CONTROL)
+		return;
 	switch(command[0]) {
+	case REQUEST_TAG_SWCINTERN:
+		uprog_request_tag = command[1];
+		return;
 	case CUSTOM_DATA_AVAILABLE_REQUEST_SWCINTERN: {
 		uint8_t reply[5];
 		reply[0] = CUSTOM_DATA_AVAILABLE_REPLY_SWCINTERN;
@@ -753,74 +1512,163 @@ void uprog_cmd_received(uint8_t* command, uint32_t length) {
 		reply[2] = ((size >> 16) & 0xFF);
 		reply[3] = ((size >> 8) & 0xFF);
 		reply[4] = (size & 0xFF);
-		if(axcpEncodeAndSend(uprog_cmd_wfd, reply, 5) == -1)
-			bailOut("Unable to write to pipe\n");
+		writeUprogTag(uprog_request_tag);
+		writeUprog(reply, 5);
 		return;
 	} case READ_CUSTOM_DATA_REQUEST_SWCINTERN: {
 		uint32_t size = (command[1] << 24) | (command[2] << 16) | (command[3] << 8) | command[4];
-		uint8_t reply[size + 1];
-		reply[0] = READ_CUSTOM_DATA_REPLY_SWCINTERN;
-		uint32_t i;
-		for(i=0; i<size; i++) {
-			if(readFIFO(reply + 1 + i, customDataBuffer) == -1) {
-				reply[1 + i] = 0;
-			}
-		}
-		if(axcpEncodeAndSend(uprog_cmd_wfd, reply, size + 1) == -1)
-			bailOut("Unable to write to pipe\n");
+		replyCustomData(READ_CUSTOM_DATA_REPLY_SWCINTERN, uprog_request_tag, size);
+		return;
+	} case WAIT_CUSTOM_DATA_REQUEST_SWCINTERN: {
+		custom_data_minimum = (command[1] << 24) | (command[2] << 16) | (command[3] << 8) | command[4];
+		custom_data_capacity = (command[5] << 24) | (command[6] << 16) | (command[7] << 8) | command[8];
+		uint32_t timeout = (command[9] << 24) | (command[10] << 16) | (command[11] << 8) | command[12];
+		// The reply may carry less than 'minimum' bytes, the program reads the rest afterwards, see waitCustomData().
+		// More than the buffer can hold never arrives though.
+		if(custom_data_minimum > customDataBuffer->maxSize)
+			custom_data_minimum = customDataBuffer->maxSize;
+		custom_data_tag = uprog_request_tag;
+		custom_data_waiting = 1;
+		// A timeout of 0xFFFFFFFF waits infinitely
+		if(timeout != 0 && timeout != 0xFFFFFFFF)
+			reactorArmTimer(custom_data_timer, timeout < INT_MAX ? (int) timeout : INT_MAX);
+		completeCustomDataWait(timeout == 0);
 		return;
   } case SEND_CUSTOM_DATA_ACTION_SWCINTERN: {
-		uint32_t size = length - 1;
-		uint8_t send[size + 35];
-    send[0] = EXECUTION_DATA_ACTION;
-		memcpy(send + 1, currName, 32);
-		send[33] = (currVersion >> 8) & 0xFF;
-		send[34] = currVersion & 0xFF;
-    memcpy(send + 35, command + 1, size);
-    writeUART(send, size + 35);
+		printoutFlush(1, 1);
+		uint8_t header[35];
+		uint32_t headerLength = composeExecutionHeader(header, EXECUTION_DATA_ACTION);
+		writeUARTStream(header, headerLength, command + 1, length - 1);
 		return;
 	} case ANALOG_SENSOR_REQUEST:
-		replyOpcode = ANALOG_SENSOR_REPLY;
-		replyPort = command[1];
-		break;
 	case DIGITAL_SENSOR_REQUEST:
-		replyOpcode = DIGITAL_SENSOR_REPLY;
-		replyPort = command[1];
-		break;
 	case MOTOR_POSITION_REQUEST:
-		replyOpcode = MOTOR_POSITION_REPLY;
-		replyPort = command[1];
-		break;
 	case MOTOR_VELOCITY_REQUEST:
-		replyOpcode = MOTOR_VELOCITY_REPLY;
-		replyPort = command[1];
-		break;
+		requestState(command, length, command[1]);
+		return;
 	case CONTROLLER_BATTERY_CHARGE_REQUEST:
-		replyOpcode = CONTROLLER_BATTERY_CHARGE_REPLY;
-		break;
 	case CONTROLLER_BATTERY_CHARGING_STATE_REQUEST:
-		replyOpcode = CONTROLLER_BATTERY_CHARGING_STATE_REPLY;
-		break;
 	case PHONE_BATTERY_CHARGE_REQUEST:
-		replyOpcode = PHONE_BATTERY_CHARGE_REPLY;
-		break;
 	case PHONE_BATTERY_CHARGING_STATE_REQUEST:
-		replyOpcode = PHONE_BATTERY_CHARGING_STATE_REPLY;
+	case ANALOG_SENSOR_ALL_REQUEST:
+	case DIGITAL_SENSOR_ALL_REQUEST:
+		requestState(command, length, PENDING_NO_PORT);
+		return;
+	case MOTOR_POWER_ACTION:
+	case MOTOR_VELOCITY_ACTION:
+	case SERVO_DRIVE_ACTION:
+		// Sent with the next opportunity, replacing an older value that is still waiting
+		if(coalesceStore(command, length)) {
+			if(!uart_corked)
+				uartSend();
+			return;
+		}
+		break;
+	case MOTOR_CLEAR_POSITION_ACTION:
+		mirrorInvalidate(MOTOR_POSITION_REPLY, command[1]);
+		break;
+	case ANALOG_SENSOR_SUBSCRIPTION:
+	case DIGITAL_SENSOR_SUBSCRIPTION:
+	case MOTOR_POSITION_SUBSCRIPTION:
+	case MOTOR_VELOCITY_SUBSCRIPTION:
+		recordSubscription(command, length);
 		break;
 	default:
 		break;
 	}
+	// Coalesced actions must not be overtaken by other commands, only requests may pass them
+	coalesceFlush(queueUART);
 	writeUART(command, length);
 }
 
+/*
+ * Notes in the collected output how many bytes were dropped since the last note, if there is room for it.
+ * Return: 1 if the note was added or 0 if not.
+ */
+int printoutNoteDropped() {
+	if(printout_unreported == 0)
+		return 0;
+	char note[48];
+	int noteLength = snprintf(note, sizeof(note), "\n[%u bytes of output dropped]\n", printout_unreported);
+	if(freeFIFO(printout_buffer) < noteLength)
+		return 0;
+	appendFIFOBytes((uint8_t*) note, noteLength, printout_buffer);
+	printout_unreported = 0;
+	return 1;
+}
+
+/*
+ * Sends the collected output of the program to the HLC in EXECUTION_PRINTOUT_ACTIONs of up to
+ * UART_BULK_PIECE_BYTES, as long as at least 'minimum' bytes are collected. Unless 'force' is set, output is only
+ * queued while less than PRINTOUT_MAX_BACKLOG bytes of bulk commands wait for the UART; the rest stays collected
+ * until printout_timer expires. Must be forced before any other EXECUTION_* or DEBUGGING_* command of the program
+ * is sent, so that they stay in order.
+ */
+void printoutFlush(uint32_t minimum, int force) {
+	uint8_t header[35];
+	uint32_t headerLength = composeExecutionHeader(header, EXECUTION_PRINTOUT_ACTION);
+	// Forced, the collected output is sent completely, including the note about output dropped at its end
+	do {
+		while((uint32_t) availableFIFO(printout_buffer) >= minimum && availableFIFO(printout_buffer) > 0) {
+			if(!force && outqueueQueuedBytes(OUTQUEUE_BULK) - outqueueWrittenBytes(OUTQUEUE_BULK) >= PRINTOUT_MAX_BACKLOG)
+				break;
+			// The piece may wrap around the end of the buffer, i.e. consist of two spans
+			struct iovec parts[3];
+			uint32_t piece = 0;
+			int count = 1;
+			parts[0].iov_base = header;
+			parts[0].iov_len = headerLength;
+			while(count < 3 && piece < UART_BULK_PIECE_BYTES) {
+				uint8_t *span;
+				uint32_t n = readSpanFIFO(&span, printout_buffer);
+				if(n == 0)
+					break;
+				if(n > UART_BULK_PIECE_BYTES - piece)
+					n = UART_BULK_PIECE_BYTES - piece;
+				parts[count].iov_base = span;
+				parts[count].iov_len = n;
+				count++;
+				// outqueuePushv() copies the spans before anything is written to the buffer again
+				consumeFIFO(n, printout_buffer);
+				piece += n;
+			}
+			queueUARTv(parts, count);
+			printout_bytes += piece;
+			printout_frames++;
+		}
+	} while(force && printoutNoteDropped());
+	if(!uart_corked)
+		uartSend();
+	// Whatever is left is sent by the deadline at the latest
+	int left = availableFIFO(printout_buffer) > 0;
+	if(left && !printout_timer_armed)
+		reactorArmTimer(printout_timer, printout_deadline);
+	else if(!left && printout_timer_armed)
+		reactorArmTimer(printout_timer, 0);
+	printout_timer_armed = left;
+}
+
+void printout_timeout(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	printout_timer_armed = 0;
+	printoutFlush(1, 0);
+}
+
+/*
+ * Collects the 'text' of 'length' bytes the program printed, which is sent by printoutFlush() once enough is
+ * collected. If the program prints more than the UART takes, the collected output is full and the rest is dropped,
+ * which is noted in the output once there is room again.
+ */
 void uprog_out_received(uint8_t *text, uint32_t length) {
-	uint8_t send[35 + length];
-	send[0] = EXECUTION_PRINTOUT_ACTION;
-	memcpy(send + 1, currName, 32);
-	send[33] = (currVersion >> 8) & 0xFF;
-	send[34] = currVersion & 0xFF;
-	memcpy(send + 35, text, length);
-	writeUART(send, 35 + length);
+	// Output after a gap must not be sent before the note about it
+	printoutNoteDropped();
+	int added = printout_unreported > 0 ? 0 : appendFIFOBytes(text, length, printout_buffer);
+	if((uint32_t) added < length) {
+		printout_dropped += length - added;
+		printout_unreported += length - added;
+	}
+	printoutFlush(printout_threshold, 0);
 }
 
 void gdb_out_received_command(char **lines, uint32_t numberOfLines) {
@@ -841,28 +1689,25 @@ void gdb_out_received_command(char **lines, uint32_t numberOfLines) {
 		debugger_breaked = 1;
 
 		uint16_t lineNumber = (uint16_t) (atoi(lines[2])) - 3; // minus 2 because of added includes
-		uint32_t locLen = 0;
+		uint8_t header[37];
+		printoutFlush(1, 1);
+		uint32_t headerLength = composeExecutionHeader(header, DEBUGGING_BREAKED_ACTION);
+		header[headerLength] = (lineNumber >> 8) & 0xFF;
+		header[headerLength + 1] = lineNumber & 0xFF;
+		// The location lines are sent directly from the line buffers, separated by \n
+		struct iovec *parts = (struct iovec*) malloc((numberOfLines - 3) * sizeof(struct iovec));
+		parts[0].iov_base = header;
+		parts[0].iov_len = headerLength + 2;
 		uint32_t i;
-		for(i=3; i < numberOfLines - 1; i++)
-			locLen += strlen(lines[i]) + 1; // include \n separator
-		locLen--; // exclude last \n separator
-		uint8_t send[37 + locLen];
-		send[0] = DEBUGGING_BREAKED_ACTION;
-		memcpy(send + 1, currName, 32);
-		send[33] = (currVersion >> 8) & 0xFF;
-		send[34] = currVersion & 0xFF;
-		send[35] = (lineNumber >> 8) & 0xFF;
-		send[36] = lineNumber & 0xFF;
-		int curPos = 37;
 		for(i=3; i < numberOfLines - 1; i++) {
-			memcpy(send + curPos, lines[i], strlen(lines[i]));
-			curPos += strlen(lines[i]);
-			if(i < numberOfLines - 2) {
-				send[curPos] = '\n';
-				curPos++;
-			}
+			uint32_t lineLen = strlen(lines[i]);
+			if(i < numberOfLines - 2)
+				lines[i][lineLen++] = '\n';
+			parts[i - 2].iov_base = lines[i];
+			parts[i - 2].iov_len = lineLen;
 		}
-		writeUART(send, 37 + locLen);
+		writeUARTv(parts, numberOfLines - 3);
+		free(parts);
 	} else if(strcmp(command, "ignore") == 0) {
 		printf("GDB INJECTED IGNORE COMMAND\n"); // <---
 	} else {
@@ -875,13 +1720,337 @@ void gdb_out_received_command(char **lines, uint32_t numberOfLines) {
 	free(lines);
 }
 
-int main() {
+void uart_cmd_decoded(uint8_t *rx_buffer, uint32_t rx_length) {
+	// Commands following SW_CONTROLLER_OFF_ACTION are not handled anymore
+	if(!running)
+		return;
+	// The rest of the line can't be decoded anymore. Report the opcode and drop everything until the HLC
+	// pauses, see uart_frame_timeout().
+	if(payloadLength(rx_buffer[0]) == -2) {
+	        printf("Unknown opcode from UART %d\n", rx_buffer[0]);
+		uint8_t send[3];
+		writeUART(send, axcpBuildError(send, ERRORCODE_UNSPECIFIED_OPCODE, rx_buffer[0]));
+		axcpDecoderDiscard(&uart_decoder);
+		return;
+	}
+
+	printf("Received from UART opcode %d: ", rx_buffer[0]);
+	uint32_t i;
+	for(i=1; i<rx_length; i++)
+		printf("%d,", rx_buffer[i]);
+	printf("\n");
+	if(uart_cmd_received(rx_buffer, rx_length) == 1)
+		running = 0;
+}
+
+void uart_readable(int fd, uint32_t events) {
+	if((events & EPOLLIN) == 0)
+		bailOut("Error flag after poll uart\n");
+
+	// Only read what is available; incomplete commands are continued on the next call
+	int length = axcpDecodeAvailable(&uart_decoder, fd);
+	if(length == -1)
+		bailOut("UART receive failed\n");
+
+	// Every byte of an incomplete command restarts the deadline for the next one
+	if(!axcpDecoderIdle(&uart_decoder) && length > 0) {
+		reactorArmTimer(uart_frame_timer, UART_FRAME_TIMEOUT_MS);
+		uart_frame_timer_armed = 1;
+	} else if(axcpDecoderIdle(&uart_decoder) && uart_frame_timer_armed) {
+		reactorArmTimer(uart_frame_timer, 0);
+		uart_frame_timer_armed = 0;
+	}
+}
+
+/*
+ * The UART was silent for UART_FRAME_TIMEOUT_MS in the middle of a command, i.e. bytes were lost. The partial
+ * command is dropped and reported, so that the next byte is treated as opcode again. If the decoder was
+ * discarding after an unknown opcode, the line is quiet now and decoding resumes.
+ */
+void uart_frame_timeout(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	uart_frame_timer_armed = 0;
+	if(uart_decoder.state == AXCP_DECODER_DISCARD) {
+		printf("UART resynchronized, %u bytes discarded so far\n", uart_decoder.discarded);
+	} else if(!axcpDecoderIdle(&uart_decoder)) {
+		uint8_t opcode = uart_decoder.command[0];
+		printf("Incomplete command from UART, opcode %d\n", opcode);
+		uart_frame_timeouts++;
+		uint8_t send[3];
+		writeUART(send, axcpBuildError(send, ERRORCODE_INCOMPLETE_COMMAND_TIMEOUT, opcode));
+	}
+	axcpDecoderReset(&uart_decoder);
+}
+
+void uprog_cmd_decoded(uint8_t *uprog_cmd_buffer, uint32_t uprog_cmd_length) {
+	if(payloadLength(uprog_cmd_buffer[0]) == -2)
+		bailOut("Unknown opcode from pipe\n");
+
+	printf("Received from uprog cmd opcode %d: ", uprog_cmd_buffer[0]);
+	uint32_t i;
+	for(i=1; i<uprog_cmd_length; i++)
+		printf("%d,", uprog_cmd_buffer[i]);
+	printf("\n");
+	uprog_cmd_received(uprog_cmd_buffer, uprog_cmd_length);
+}
+
+void uprog_cmd_readable(int fd, uint32_t events) {
+	int length = 0;
+	if((events & EPOLLIN) > 0) {
+		// Everything the program sent at once, e.g. a batch, is forwarded to the UART in one burst
+		uart_corked = 1;
+		length = axcpDecodeAvailable(&uprog_decoder, fd);
+		uart_corked = 0;
+		uartSend();
+		if(length == -1)
+			bailOut("Pipe receive failed\n");
+	}
+	// Nothing was available although signaled, wait for the next event
+	if(length == -2)
+		return;
+	if(length == 0) {
+		// The program closed its end of the pipe, most likely because it terminated. Everything else is torn
+		// down by closeProgramPipes() once it is reaped, so custom data for it is still buffered until then.
+		reactorRemove(fd);
+		printf("Cmd pipe has been closed by the program\n");
+	}
+	// It is assumed that no error flag happens for the pipe connection
+}
+
+void uprog_out_readable(int fd, uint32_t events) {
+	uint8_t uprog_out_buffer[PRINTOUT_BUFFER_SIZE];
+	int uprog_out_length = 0;
+	if((events & EPOLLIN) > 0) {
+		uprog_out_length = read(fd, uprog_out_buffer, sizeof(uprog_out_buffer));
+		if(uprog_out_length < 0)
+			bailOut("Unable to read from out buffer\n");
+	}
+	if(uprog_out_length > 0) {
+		uprog_out_received(uprog_out_buffer, uprog_out_length);
+	} else {
+		// The program closed its end of the pipe, most likely because it terminated
+		reactorRemove(fd);
+		close(fd);
+		uprog_out_rfd = -1;
+		printf("Out pipe has been closed\n");
+	}
+	// It is assumed that no error flag happens for the pipe connection
+}
+
+void gdb_readable(int fd, uint32_t events) {
+	// The debugger closed its output, its termination will be handled via SIGCHLD
+	if((events & EPOLLIN) == 0) {
+		reactorRemove(fd);
+		return;
+	}
+
+	char **gdb_out_buffer = (char**) malloc(sizeof(char*));
+	char *firstLine = (char*) malloc(256);
+	gdb_out_buffer[0] = firstLine;
+	int curPos = 0, res = 0;
+	do {
+		res = fullRead(fd, (uint8_t*) (gdb_out_buffer[0] + curPos), 1);
+		if(res == -1)
+			bailOut("Failed to read from gdb\n");
+		curPos++;
+	} while(gdb_out_buffer[0][curPos - 1] != '\n');
+	gdb_out_buffer[0][curPos - 1] = '\0';
+	if(curPos >= 10 && strncmp(gdb_out_buffer[0], "Breakpoint", 10) == 0) {
+		char *gdbsend = "echo _Hedgehog_:breaked\\n\nframe\ninfo locals\necho _Hedgehog_\\n\n";
+		fullWrite(debugger_wfd, (uint8_t*) gdbsend, strlen(gdbsend));
+		free(gdb_out_buffer[0]);
+		free(gdb_out_buffer);
+
+		printf("Recognized Breakpoint in gdb output and injected command\n"); // <---
+
+		// Command injection :D
+	} else if(curPos >= 10 && strncmp(gdb_out_buffer[0], "_Hedgehog_", 10) == 0) {
+		printf("Recognized injected gdb command, beginning to capture...\n"); // <---
+		int curLine = 1;
+		while(1) {
+			char *nextLine = (char*) malloc(256);
+			gdb_out_buffer = (char**) realloc(gdb_out_buffer, (curLine+1) * sizeof(char*));
+			gdb_out_buffer[curLine] = nextLine;
+			curPos = 0, res = 0;
+			do {
+				res = fullRead(fd, (uint8_t*) (gdb_out_buffer[curLine] + curPos), 1);
+				if(res == -1)
+					bailOut("Failed to read from gdb\n");
+				curPos++;
+			} while(gdb_out_buffer[curLine][curPos - 1] != '\n');
+			gdb_out_buffer[curLine][curPos - 1] = '\0';
+			if (curPos == 11 && strncmp(gdb_out_buffer[curLine], "_Hedgehog_", 10) == 0) {
+				printf("Capture done!\n"); // <---
+				gdb_out_received_command(gdb_out_buffer, curLine + 1);
+				break;
+			}
+			curLine++;
+		}
+	} else {
+		printf("gdb line ignored.\n");  //<----
+		free(gdb_out_buffer[0]);
+		free(gdb_out_buffer);
+	}
+}
+
+void stdin_readable(int fd, uint32_t events) {
+	if((events & EPOLLIN) == 0)
+		return;
+
+	uint8_t stdin_buffer[256];
+	int stdin_length = -1;
+	do {
+		stdin_length++;
+		if(fullRead(fd, stdin_buffer + stdin_length, 1) == -1)
+			bailOut("Unable to read from stdin\n");
+	} while(stdin_buffer[stdin_length] != '\n');
+	stdin_buffer[stdin_length] = '\0';
+	if(stdin_length == 0)
+		return;
+
+	uint8_t stdin_send[256];
+	char* current = strtok((char*) stdin_buffer, " ");
+	int i;
+	for(i=0; current != NULL; i++) {
+		stdin_send[i] = (uint8_t) atoi(current);
+		current = strtok(NULL, " ");
+	}
+	if(payloadLength(stdin_send[0]) == -2)
+		fullWrite(uart_fd, stdin_send, i);
+	else
+		writeUART(stdin_send, i);
+}
+
+void print_statistics(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	printf("UART: %u commands in %u reads (%.2f per read)\n", uart_decoder.commands, uart_decoder.reads,
+		uart_decoder.reads > 0 ? (double) uart_decoder.commands / uart_decoder.reads : 0.0);
+	printf("Program: %u commands in %u reads (%.2f per read)\n", uprog_decoder.commands, uprog_decoder.reads,
+		uprog_decoder.reads > 0 ? (double) uprog_decoder.commands / uprog_decoder.reads : 0.0);
+	printf("Program rings: %u wakeups sent, %u sleeps\n",
+		uprog_ring_notifications + (uprog_ring_open ? uprog_ring.notifications : 0),
+		uprog_ring_sleeps + (uprog_ring_open ? uprog_ring.sleeps : 0));
+	printf("UART: %u incomplete commands dropped, %u bytes discarded\n", uart_frame_timeouts, uart_decoder.discarded);
+	printf("UART: %u commands sent in %u writes, %u bytes waiting\n", outqueueCommands, outqueueWrites, outqueueLength());
+	printf("UART: %u actuator actions replaced by newer ones, %u waiting\n", coalesceReplaced, coalesceCount());
+	printf("Emergency stops: %u, last took %llu us, slowest %llu us\n", estops,
+		(unsigned long long) estop_latency_last, (unsigned long long) estop_latency_max);
+	printf("Requests: %d in flight, %u sent again, %u failed\n", pendingCount(), request_retries, request_failures);
+	printf("Mirror: %u requests answered locally, %u forwarded\n", mirror_hits, mirror_misses);
+	printf("Events: %u forwarded to the program, %u dropped\n", updates_forwarded, updates_dropped);
+	printf("Printouts: %u bytes in %u commands, %u bytes dropped\n", printout_bytes, printout_frames,
+		printout_dropped);
+	if(customDataBuffer != NULL)
+		printf("Custom data: %u overflows, %u bytes dropped, buffer of %u bytes\n", customDataBuffer->overflows,
+			customDataBuffer->droppedBytes, customDataBuffer->size);
+	printf("Decoder allocations: %u\n", axcpAllocations);
+}
+
+void pipe_broken(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	// Writing to a pipe of a terminated child fails with EPIPE instead of killing andrixswc
+}
+
+void child_exited(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	int status;
+
+	// Multiple SIGCHLDs may be merged into one, so every tracked child is checked
+	if(program_pid > -1) {
+		int result = waitpid(program_pid, &status, WNOHANG);
+		if(result == -1)
+			bailOut("Couldn't wait for child\n");
+		if(result > 0 && (WIFEXITED(status) != 0 || WIFSIGNALED(status) != 0))
+			programTerminated(status);
+	}
+	if(compile_pid > -1) {
+		int result = waitpid(compile_pid, &status, WNOHANG);
+		if(result == -1)
+			bailOut("Couldn't wait for compiler\n");
+		if(result > 0)
+			compileStageDone(status);
+	}
+	if(waitpid(debugger_pid, &status, WNOHANG) != 0)
+		bailOut("Debugger terminated\n");
+}
+
+int main(int argc, char *argv[]) {
+
+	int option;
+	while((option = getopt(argc, argv, "a:c:d:o:r")) != -1) {
+		switch(option) {
+		case 'a':
+			mirror_max_age = atoi(optarg);
+			break;
+		case 'c':
+			custom_data_max_size = atoi(optarg);
+			break;
+		case 'd':
+			printout_deadline = atoi(optarg);
+			break;
+		case 'o':
+			printout_threshold = atoi(optarg);
+			break;
+		case 'r':
+			use_program_ring = 1;
+			break;
+		default:
+			printf("Usage: %s [-a max age in ms of mirrored values used instead of requests, default 10, 0 to disable]"
+				" [-c max size of the custom data buffer] [-d max delay of program output in ms]"
+				" [-o bytes of program output sent at once] [-r talk to programs via shared memory rings]\n", argv[0]);
+			return 1;
+		}
+	}
 
 	printf("Hedgehog successfully started.\n");
 
 
 	setvbuf(stdout, NULL, _IONBF, 0);
 
+	if(reactorInit() == -1)
+		bailOut("Failed to create reactor\n");
+	axcpDecoderInit(&uart_decoder, uart_cmd_decoded);
+	axcpDecoderInit(&uprog_decoder, uprog_cmd_decoded);
+	uart_frame_timer = reactorCreateTimer(uart_frame_timeout);
+	if(uart_frame_timer == -1)
+		bailOut("Failed to create UART frame timer\n");
+	request_timer = reactorCreateTimer(request_timeout);
+	if(request_timer == -1)
+		bailOut("Failed to create request timer\n");
+	custom_data_timer = reactorCreateTimer(custom_data_timeout);
+	if(custom_data_timer == -1)
+		bailOut("Failed to create custom data timer\n");
+	printout_timer = reactorCreateTimer(printout_timeout);
+	if(printout_timer == -1)
+		bailOut("Failed to create printout timer\n");
+	printout_buffer = createFIFO(PRINTOUT_BUFFER_SIZE);
+	if(printout_threshold < 1 || printout_threshold > UART_BULK_PIECE_BYTES)
+		printout_threshold = UART_BULK_PIECE_BYTES;
+	uart_send_timer = reactorCreateTimer(uart_send_timeout);
+	if(uart_send_timer == -1)
+		bailOut("Failed to create UART send timer\n");
+	// Without the shared state, programs request every value via the pipes
+	shared_state = sharedStateCreate(&shared_state_fd);
+	if(shared_state == NULL) {
+		printf("Failed to create shared state\n");
+	} else {
+		fcntl(shared_state_fd, F_SETFD, FD_CLOEXEC);
+		mirrorPublish(shared_state);
+	}
+	// Child terminations are delivered via the reactor. Must be set up before forking, so that all
+	// children inherit the blocked signal mask and reset it via reactorResetSignals().
+	if(reactorCreateSignal(SIGCHLD, child_exited) == -1)
+		bailOut("Failed to register SIGCHLD\n");
+	if(reactorCreateSignal(SIGPIPE, pipe_broken) == -1)
+		bailOut("Failed to register SIGPIPE\n");
+	// Statistics are printed on request, e.g. via "kill -USR1 <pid>"
+	if(reactorCreateSignal(SIGUSR1, print_statistics) == -1)
+		bailOut("Failed to register SIGUSR1\n");
+
 	// Open communication pipes to the debugger process
 	int rpipe[2];
 	int wpipe[2];
@@ -891,11 +2060,12 @@ int main() {
 		bailOut("Failed to open debugger write pipe\n");
 
 	// Start child process
-	int pid = fork();
-	if(pid < 0) {
+	debugger_pid = fork();
+	if(debugger_pid < 0) {
 		bailOut("Failed to fork\n");
-	} else if(pid == 0) {
+	} else if(debugger_pid == 0) {
 		// Redirect child fds and start user program
+		reactorResetSignals();
 		close(rpipe[0]);
 		close(wpipe[1]);
 		if(dup2(rpipe[1], STDOUT_FILENO) == -1)
@@ -912,284 +2082,58 @@ int main() {
 	close(rpipe[1]);
 	close(wpipe[0]);
 	debugger_wfd = wpipe[1];
-	pfds[3].fd = rpipe[0];
+	debugger_rfd = rpipe[0];
+	if(reactorAdd(debugger_rfd, gdb_readable) == -1)
+		bailOut("Failed to register debugger pipe\n");
 	printf("Debugger successfully started.\n");
 
-	// pfds[0].fd = open("./input", O_RDONLY);
-	// pfds[0].fd = open("/dev/ttyAMA0", O_RDWR | O_NOCTTY | O_NDELAY);
-	pfds[0].fd = open("/dev/ttyAMA0", O_RDWR | O_NOCTTY);
-	if(pfds[0].fd == -1)
+	// uart_fd = open("./input", O_RDONLY);
+	// uart_fd = open("/dev/ttyAMA0", O_RDWR | O_NOCTTY | O_NDELAY);
+	uart_fd = open("/dev/ttyAMA0", O_RDWR | O_NOCTTY);
+	if(uart_fd == -1)
 		bailOut("Unable to open uart input\n");
+	// Commands are written without blocking, see uartSend()
+	fcntl(uart_fd, F_SETFL, fcntl(uart_fd, F_GETFL) | O_NONBLOCK);
 
 	struct termios options;
-	tcgetattr(pfds[0].fd, &options);
+	tcgetattr(uart_fd, &options);
 	options.c_cflag = B115200 | CS8 | CLOCAL | CREAD;
+	uartSetSpeed(UART_BAUD_RATE);
 	options.c_iflag = IGNPAR;
 	options.c_oflag = 0;
 	options.c_lflag = 0;
-	tcflush(pfds[0].fd, TCIFLUSH);
-	tcsetattr(pfds[0].fd, TCSANOW, &options);
-
-	pfds[0].events = POLLIN;
-	pfds[0].revents = 0;
-	pfds[1].fd = -1;
-	pfds[1].events = POLLIN;
-	pfds[1].revents = 0;
-	pfds[2].fd = -1;
-	pfds[2].events = POLLIN;
-	pfds[2].revents = 0;
-	pfds[3].events = POLLIN;
-	pfds[3].revents = 0;
-	pfds[4].fd = STDIN_FILENO;
-	pfds[4].events = POLLIN;
-	pfds[4].revents = 0;
-
-  uint8_t stdin_buffer[256];
-	uint8_t uprog_out_buffer[512];
-
-  uint8_t send[1];
+	// Reads return immediately with what is available, so the reactor is never blocked by the UART
+	options.c_cc[VMIN] = 0;
+	options.c_cc[VTIME] = 0;
+	tcflush(uart_fd, TCIFLUSH);
+	tcsetattr(uart_fd, TCSANOW, &options);
+
+	if(reactorAdd(uart_fd, uart_readable) == -1)
+		bailOut("Failed to register uart\n");
+	// stdin may not be pollable, e.g. if redirected from /dev/null or a file
+	if(reactorAdd(STDIN_FILENO, stdin_readable) == -1)
+		printf("Commands from stdin are not available\n");
+
+	uint8_t send[1];
 	send[0] = HW_CONTROLLER_TYPE_REQUEST;
 	writeUART(send, 1);
 
-	while(1) {
-		uint32_t rx_length = 0, uprog_cmd_length = 0;
-		int stdin_length = -1, uprog_out_length = 0, gdb_out_length = 0;
-		uint8_t *rx_buffer, *uprog_cmd_buffer;
-		char **gdb_out_buffer;
-
-		if(program_pid > -1) {
-			int status;
-			int result = waitpid(program_pid, &status, WNOHANG);
-			if(result == -1)
-				bailOut("Couldn't wait for child\n");
-			if(result > 0 && WIFEXITED(status) != 0) {
-				printf("Program exited with status %d\n", status); // <---
-				uint8_t send[39];
-				send[0] = EXECUTION_DONE_ACTION;
-				memcpy(send + 1, currName, 32);
-				send[33] = (currVersion >> 8) & 0xFF;
-				send[34] = currVersion & 0xFF;
-				int retVal = WEXITSTATUS(status);
-				send[35] = (retVal >> 24) & 0xFF;
-				send[36] = (retVal >> 16) & 0xFF;
-				send[37] = (retVal >> 8) & 0xFF;
-				send[38] = retVal & 0xFF;
-				writeUART(send, 39);
-				destroyFIFO(customDataBuffer);
-				customDataBuffer = NULL;
-				program_pid = -1;
-				debugger_attached = 0;
-				debugger_breaked = 0;
-			} else if(result > 0 && WIFSIGNALED(status) != 0) {
-				// Check if terminating signal was SIGINT
-				if(WTERMSIG(status) == SIGTERM) {
-					printf("Program signaled via SIGTERM!\n"); // <---
-					uint8_t send[35];
-					send[0] = EXECUTION_STOPPED_ACTION;
-					memcpy(send + 1, currName, 32);
-					send[33] = (currVersion >> 8) & 0xFF;
-					send[34] = currVersion & 0xFF;
-					writeUART(send, 35);
-					program_pid = -1;
-					debugger_attached = 0;
-					debugger_breaked = 0;
-				}
-			}
-		}
-
-		if(restart) {
-			int result = executeProgram(currName, currVersion);
-			if(result == -2) {
-				uint8_t send[3];
-				send[0] = ERROR_ACTION;
-				send[1] = ERRORCODE_PROGRAM_NOT_FOUND;
-				send[2] = EXECUTION_RESTART_ACTION;
-				writeUART(send, 3);
-				restart = 0;
-			} else if(result == 0) {
-				uint8_t send[35];
-				send[0] = EXECUTION_STARTED_ACTION;
-				memcpy(send + 1, currName, 32);
-				send[33] = (currVersion >> 8) & 0xFF;
-				send[34] = currVersion & 0xFF;
-				writeUART(send, 35);
-				restart = 0;
-			}
-			// If result = -1, the program hasn't shutdown completely yet - try again later
-		}
-
-		pfds[0].revents = 0;
-		pfds[1].revents = 0;
-		pfds[2].revents = 0;
-		pfds[3].revents = 0;
-		pfds[4].revents = 0;
-		int res = poll(pfds, 5, 0);
-		if(res < 0) {
+	// Sleep until the UART, a pipe, stdin or a child exit needs attention
+	while(running) {
+		if(reactorDispatch(-1) == -1)
 			bailOut("Failed to poll\n");
-		}
-		if(pfds[0].revents > 0) {
-			if((pfds[0].revents & POLLIN) > 0) {
-				int result = axcpReceiveAndDecode(pfds[0].fd, &rx_buffer, &rx_length);
-				if(result == -1)
-					bailOut("UART receive failed\n");
-				if(result == -2) {
-				        printf("Unknown opcode from UART %d\n", rx_buffer[0]);
-					//uint8_t send[3];
-					//send[0] = ERROR_ACTION;
-					//send[1] = ERRORCODE_UNSPECIFIED_OPCODE;
-					//send[2] = rx_buffer[0];
-					//writeUART(send, 3);
-					//usleep(600000);
-					//uint8_t buf[10];
-					//while(read(pfds[0].fd, buf, 10) > 0);
-					//printf("Done waiting and flushing\n");
-				}
-			} else {
-				bailOut("Error flag after poll uart\n");
-			}
-		}
-		if(pfds[1].revents > 0) {
-			if((pfds[1].revents & POLLIN) > 0) {
-				int result = axcpReceiveAndDecode(pfds[1].fd, &uprog_cmd_buffer, &uprog_cmd_length);
-				if(result == -1)
-					bailOut("UART receive failed\n");
-				if(result == -2)
-					bailOut("Unknown opcode from pipe\n");
-			} else if(program_pid == -1) {
-        destroyFIFO(customDataBuffer);
-			  customDataBuffer = NULL;	
-				pfds[1].fd = -1;
-				uprog_cmd_wfd = -1;
-				printf("Cmd pipes have been closed\n");
-			}
-			// It is assumed that no error flag happens for the pipe connection
-		}
-		if(pfds[2].revents > 0) {
-			if((pfds[2].revents & POLLIN) > 0) {
-				uprog_out_length = read(pfds[2].fd, uprog_out_buffer, 512);
-				if(uprog_out_length < 0)
-					bailOut("Unable to read from out buffer\n");
-			} else if(program_pid == -1) {
-				pfds[2].fd = -1;
-				printf("Out pipe has been closed\n");
-			}
-			// It is assumed that no error flag happens for the pipe connection
-		}
-		if(pfds[3].revents > 0) {
-			if((pfds[3].revents & POLLIN) > 0) {
-				gdb_out_buffer = (char**) malloc(sizeof(char*));
-				char *firstLine = (char*) malloc(256);
-				gdb_out_buffer[0] = firstLine;
-				int curPos = 0, res = 0;
-				do {
-					res = fullRead(pfds[3].fd, (uint8_t*) (gdb_out_buffer[0] + curPos), 1);
-					if(res == -1)
-						bailOut("Failed to read from gdb\n");
-					curPos++;
-				} while(gdb_out_buffer[0][curPos - 1] != '\n');
-				gdb_out_buffer[0][curPos - 1] = '\0';
-				if(curPos >= 10 && strncmp(gdb_out_buffer[0], "Breakpoint", 10) == 0) {
-					char *gdbsend = "echo _Hedgehog_:breaked\\n\nframe\ninfo locals\necho _Hedgehog_\\n\n";
-					fullWrite(debugger_wfd, (uint8_t*) gdbsend, strlen(gdbsend));
-					free(gdb_out_buffer[0]);
-					free(gdb_out_buffer);
-
-					printf("Recognized Breakpoint in gdb output and injected command\n"); // <---
-
-					// Command injection :D
-				} else if(curPos >= 10 && strncmp(gdb_out_buffer[0], "_Hedgehog_", 10) == 0) {
-					printf("Recognized injected gdb command, beginning to capture...\n"); // <---
-					int curLine = 1;
-					while(1) {
-						char *nextLine = (char*) malloc(256);
-						gdb_out_buffer = (char**) realloc(gdb_out_buffer, (curLine+1) * sizeof(char*));
-						gdb_out_buffer[curLine] = nextLine;
-						curPos = 0, res = 0;
-						do {
-							res = fullRead(pfds[3].fd, (uint8_t*) (gdb_out_buffer[curLine] + curPos), 1);
-							if(res == -1)
-								bailOut("Failed to read from gdb\n");
-							curPos++;
-						} while(gdb_out_buffer[curLine][curPos - 1] != '\n');
-						gdb_out_buffer[curLine][curPos - 1] = '\0';
-						if (curPos == 11 && strncmp(gdb_out_buffer[curLine], "_Hedgehog_", 10) == 0) {
-							printf("Capture done!\n"); // <---
-							gdb_out_length = curLine + 1;
-							break;
-						}
-						curLine++;
-					}
-				} else {
-					printf("gdb line ignored.\n");  //<----
-					free(gdb_out_buffer[0]);
-					free(gdb_out_buffer);
-				}
-			}
-			// It is assumed that no error flag happens for the pipe connection
-		}
-		if(pfds[4].revents > 0) {
-			if((pfds[4].revents & POLLIN) > 0) {
-				do {
-					stdin_length++;
-					if(fullRead(pfds[4].fd, stdin_buffer + stdin_length, 1) == -1)
-						bailOut("Unable to read from stdin\n");
-				} while(stdin_buffer[stdin_length] != '\n');
-				stdin_buffer[stdin_length] = '\0';
-			}
-		}
-
-
-		if(rx_length > 0) {
-      printf("Received from UART opcode %d: ", rx_buffer[0]);
-      uint32_t i;
-      for(i=1; i<rx_length; i++)
-        printf("%d,", rx_buffer[i]);
-      printf("\n");
-			if(uart_cmd_received(rx_buffer, rx_length) == 1)
-				break;
-		}
-
-		if(uprog_cmd_length > 0) {
-			printf("Received from uprog cmd opcode %d: ", uprog_cmd_buffer[0]);
-      uint32_t i;
-      for(i=1; i<uprog_cmd_length; i++)
-        printf("%d,", uprog_cmd_buffer[i]);
-      printf("\n");
-      uprog_cmd_received(uprog_cmd_buffer, uprog_cmd_length);
-		}
-
-		if(uprog_out_length > 0) {
-			uprog_out_received(uprog_out_buffer, uprog_out_length);
-		}
-
-		if(gdb_out_length > 0) {
-			gdb_out_received_command(gdb_out_buffer, gdb_out_length);
-		}
-
-		if(stdin_length > 0) {
-			uint8_t stdin_send[256];
-			char* current = strtok((char*) stdin_buffer, " ");
-			int i;
-			for(i=0; current != NULL; i++) {
-				stdin_send[i] = (uint8_t) atoi(current);
-				current = strtok(NULL, " ");
-			}
-                        if(payloadLength(stdin_send[0]) == -2)
-				fullWrite(pfds[0].fd, stdin_send, i);
-			else
-				writeUART(stdin_send, i);
-		}
-
 	}
 
-	if(pfds[0].fd != -1)
-		close(pfds[0].fd);
-	if(pfds[1].fd != -1)
-		close(pfds[1].fd);
-	if(pfds[2].fd != -1)
-		close(pfds[2].fd);
-	if(pfds[3].fd != -1)
-		close(pfds[3].fd);
+	if(uart_fd != -1) {
+		uartDrain();
+		close(uart_fd);
+	}
+	if(uprog_cmd_rfd != -1)
+		close(uprog_cmd_rfd);
+	if(uprog_out_rfd != -1)
+		close(uprog_out_rfd);
+	if(debugger_rfd != -1)
+		close(debugger_rfd);
 	if(uprog_cmd_wfd != -1)
 		close(uprog_cmd_wfd);
 
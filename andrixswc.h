@@ -20,16 +20,76 @@
 
 #include "axcp.h"
 #include "ringbuffer.h"
+#include "reactor.h"
+#include "pending.h"
+#include "mirror.h"
+#include "coalesce.h"
+#include "outqueue.h"
 
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <termios.h>
-#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <signal.h>
+#include <limits.h>
 
+// Initial size of the buffer for custom data from the HLC and default size it may grow to, see option -c
 #define CUSTOM_DATA_BUFFER_SIZE 4096
+#define CUSTOM_DATA_BUFFER_DEFAULT_MAX_SIZE 65536
+// Maximum silence on the UART within a command before it is dropped as incomplete. At 115200 baud a byte
+// takes less than 0.1 ms, so this only expires if bytes were lost. Also the quiet period that ends discarding
+// after an unknown opcode.
+#define UART_FRAME_TIMEOUT_MS 20
+// Time the hardware controller has to reply to a request before it is sent again, and the number of times it
+// is sent again before the requester is told that it failed
+#define REQUEST_TIMEOUT_MS 50
+#define REQUEST_MAX_RETRIES 2
+// Default maximum age of a mirrored value that is used to answer a request locally, see option -a. A request
+// may wait about as long behind the UART queue anyway, see UART_QUEUE_MS, and values of subscriptions with an
+// interval of up to that many milliseconds are always fresh. 0 disables the mirror, i.e. every request reaches
+// the hardware controller.
+#define MIRROR_DEFAULT_MAX_AGE_MS 10
+// The UART driver's output queue is only filled with what the line sends in UART_QUEUE_MS, so that a command of
+// a higher priority class waits for at most that long, see uartSend(). It is refilled when half of it is sent,
+// i.e. bulk transfers wake andrixswc about every UART_QUEUE_MS / 2. The number of bytes follows from the baud
+// rate, see uartSetSpeed(); the queue holds at least UART_QUEUE_MIN_BYTES.
+#define UART_QUEUE_MS 10
+#define UART_QUEUE_MIN_BYTES 32
+#define UART_BAUD_RATE 115200
+// Printouts and custom data are sent to the UART in pieces of at most this many bytes, see writeUARTStream()
+#define UART_BULK_PIECE_BYTES 128
+// Program output is collected in a buffer of PRINTOUT_BUFFER_SIZE bytes and sent once enough is there or at the
+// latest after the deadline, see option -d. Output is only queued for the UART while less than
+// PRINTOUT_MAX_BACKLOG bytes of bulk commands are waiting, i.e. about 90 ms at 115200 baud.
+#define PRINTOUT_BUFFER_SIZE 4096
+#define PRINTOUT_DEFAULT_DEADLINE_MS 20
+#define PRINTOUT_MAX_BACKLOG 1024
+// Size of the pipe the program's stdout and stderr are read from
+#define PROGRAM_OUT_PIPE_SIZE 262144
+// Linux-specific and therefore not declared in strict mode
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+// Number of motor and servo ports switched off by an emergency stop, see emergencyStop()
+#define ESTOP_PORTS 6
+// Number of subscription opcodes whose ports are tracked per program, see subscriptionSlot()
+#define SUBSCRIPTION_SLOTS 4
+
+void startProgram(const char *name, const uint16_t version, uint8_t opcode);
+void uprog_out_received(uint8_t *text, uint32_t length);
+void writeUprogv(const struct iovec *parts, int count);
+void completeCustomDataWait(int expired);
+void cancelCustomDataWait();
+int printoutNoteDropped();
+void printoutFlush(uint32_t minimum, int force);
+
+// Reactor callbacks for the pipes of a running user program, registered by executeProgram()
+void uprog_cmd_readable(int fd, uint32_t events);
+void uprog_out_readable(int fd, uint32_t events);
+void uprog_ring_readable(int fd, uint32_t events);
@@ -37,167 +37,203 @@
 
 #include "axcp.h"
 
-int payloadLength(uint8_t opcode) {
-	switch(opcode) {
-		case NOP: return 0;
-		case NOP2: return 0;
-		case ANALOG_SENSOR_REQUEST: return 1;
-		case ANALOG_SENSOR_REPLY: return 3;
-		case ANALOG_SENSOR_SUBSCRIPTION: return -1;
-		case ANALOG_SENSOR_UPDATE: return -1;
-		case ANALOG_PULLUP_ACTION: return -1;
-		case DIGITAL_SENSOR_REQUEST: return 1;
-		case DIGITAL_SENSOR_REPLY: return 2;
-		case DIGITAL_SENSOR_SUBSCRIPTION: return -1;
-		case DIGITAL_SENSOR_UPDATE: return -1;
-		case DIGITAL_PULLUP_ACTION: return -1;
-		case DIGITAL_OUTPUT_MODE_ACTION: return -1;
-		case DIGITAL_OUTPUT_LEVEL_ACTION: return 2;
-		case MOTOR_POWER_ACTION: return 3;
-		case MOTOR_VELOCITY_ACTION: return 3;
-		case MOTOR_POWER_ABSOLUTE_POSITION_ACTION: return 6;
-		case MOTOR_VELOCITY_ABSOLUTE_POSITION_ACTION: return 6;
-		case MOTOR_POWER_RELATIVE_POSITION_ACTION: return 6;
-		case MOTOR_VELOCITY_RELATIVE_POSITION_ACTION: return 6;
-		case MOTOR_FREEZE_ACTION: return 1;
-		case MOTOR_BRAKE_ACTION: return 2;
-		case MOTOR_OFF_ACTION: return 1;
-		case MOTOR_POSITION_REQUEST: return 1;
-		case MOTOR_POSITION_REPLY: return 5;
-		case MOTOR_POSITION_REACHED_ACTION: return 1;
-		case MOTOR_POSITION_SUBSCRIPTION: return -1;
-		case MOTOR_POSITION_UPDATE: return -1;
-		case MOTOR_CLEAR_POSITION_ACTION: return 1;
-		case MOTOR_VELOCITY_REQUEST: return 1;
-		case MOTOR_VELOCITY_REPLY: return 3;
-		case MOTOR_VELOCITY_SUBSCRIPTION: return -1;
-		case MOTOR_VELOCITY_UPDATE: return -1;
-		case SERVO_ONOFF_ACTION: return 2;
-		case SERVO_DRIVE_ACTION: return 2;
-		case CONTROLLER_BATTERY_CHARGE_REQUEST: return 0;
-		case CONTROLLER_BATTERY_CHARGE_REPLY: return 1;
-		case CONTROLLER_BATTERY_CHARGING_STATE_REQUEST: return 0;
-		case CONTROLLER_BATTERY_CHARGING_STATE_REPLY: return 1;
-		case PHONE_BATTERY_CHARGE_REQUEST: return 0;
-		case PHONE_BATTERY_CHARGE_REPLY: return 1;
-		case PHONE_BATTERY_CHARGING_STATE_REQUEST: return 0;
-		case PHONE_BATTERY_CHARGING_STATE_REPLY: return 1;
-		case CONTROLLER_BATTERY_UPDATE: return 2;
-		case PHONE_SENSOR_REQUEST: return 1;
-		case PHONE_SENSOR_REPLY: return -1;
-		case PHONE_SENSOR_AVAILABILITY_REQUEST: return 0;
-		case PHONE_SENSOR_AVAILABILITY_REPLY: return 4;
-		case PHONE_CAMERA_TAKE_PICTURE_ACTION: return 0;
-		case PHONE_CAMERA_GET_BLOB_COUNT_REQUEST: return 1;
-		case PHONE_CAMERA_GET_BLOB_COUNT_REPLY: return 2;
-		case PHONE_CAMERA_GET_BLOB_REQUEST: return 2;
-		case PHONE_CAMERA_GET_BLOB_REPLY: return 10;
-		case PHONE_CAMERA_SET_CHANNEL_ACTION: return 7;
-		case HW_CONTROLLER_OFF_ACTION: return 0;
-		case HW_CONTROLLER_RESET_ACTION: return 0;
-		case SW_CONTROLLER_OFF_ACTION: return 0;
-		case SW_CONTROLLER_RESET_ACTION: return 0;
-		case PHONE_OFF_ACTION: return 0;
-		case PHONE_RESET_ACTION: return 0;
-		case ERROR_ACTION: return 2;
-		case CUSTOM_ACTION: return -1;
-		case DEBUG_INFORMATION_UPDATE: return -1;
-		case HW_CONTROLLER_TYPE_REQUEST: return 0;
-		case HW_CONTROLLER_TYPE_REPLY: return 1;
-		case SW_CONTROLLER_TYPE_REQUEST: return 0;
-		case SW_CONTROLLER_TYPE_REPLY: return 1;
-		case PHONE_TYPE_REQUEST: return 0;
-		case PHONE_TYPE_REPLY: return 1;
-		case HW_CONTROLLER_SET_MEMORY_ACTION: return -1;
-		case ENVIRONMENT_SCAN_SUBSCRIPTION: return 0;
-		case ENVIRONMENT_SCAN_HW_CONTROLLER_UPDATE: return 33;
-		case ENVIRONMENT_SCAN_SW_CONTROLLER_UPDATE: return 1;
-		case ENVIRONMENT_SCAN_PHONE_UPDATE: return 1;
-		case CONTROLLER_AUTHENTICATE_REQUEST: return -1;
-		case CONTROLLER_AUTHENTICATE_REPLY: return 1;
-		case HW_CONTROLLER_GET_MEMORY_REQUEST: return 1;
-		case HW_CONTROLLER_GET_MEMORY_REPLY: return -1;
-		case PROGRAM_COMPILE_REQUEST: return -1;
-		case PROGRAM_COMPILE_REPLY: return -1;
-		case PROGRAM_EXECUTE_ACTION: return 34;
-		case PROGRAM_COMPILE_EXECUTE_REQUEST: return -1;
-		case PROGRAM_COMPILE_EXECUTE_REPLY: return -1;
-		case PROGRAMS_FETCH_SUBSCRIPTION: return 0;
-		case PROGRAMS_FETCH_UPDATE: return -1;
-		case PROGRAMS_FETCH_DONE_UPDATE: return 0;
-		case EXECUTION_STARTED_ACTION: return 34;
-		case EXECUTION_STOP_ACTION: return 34;
-		case EXECUTION_RESTART_ACTION: return 34;
-		case EXECUTION_STOPPED_ACTION: return 34;
-		case EXECUTION_DONE_ACTION: return 38;
-		case EXECUTION_PRINTOUT_ACTION: return -1;
-		case EXECUTION_DATA_ACTION: return -1;
-		case DEBUGGING_BREAK_ACTION: return 34;
-		case DEBUGGING_BREAKED_ACTION: return -1;
-		case DEBUGGING_CONTINUE_ACTION: return 34;
-		case DEBUGGING_ADD_BREAKPOINT_ACTION: return 36;
-		case DEBUGGING_REMOVE_BREAKPOINT_ACTION: return 36;
-
-		case CUSTOM_DATA_AVAILABLE_REQUEST_SWCINTERN: return 0;
-		case CUSTOM_DATA_AVAILABLE_REPLY_SWCINTERN: return 4;
-		case READ_CUSTOM_DATA_REQUEST_SWCINTERN: return 4;
-		case READ_CUSTOM_DATA_REPLY_SWCINTERN: return -1;
-    case SEND_CUSTOM_DATA_ACTION_SWCINTERN: return -1;
-		default: return -2;
+#include <errno.h>
+#include <poll.h>
+
+uint32_t axcpAllocations = 0;
+
+#define AXCP_PAYLOAD_LENGTH_ENTRY(name, opcode, length) [opcode] = (length) + 2,
+const uint8_t axcpPayloadLengths[256] = {
+	AXCP_OPCODES(AXCP_PAYLOAD_LENGTH_ENTRY)
+};
+#undef AXCP_PAYLOAD_LENGTH_ENTRY
+
+int axcpEncodeAndSend(int fd, uint8_t* command, uint32_t length) {
+	struct iovec part;
+	part.iov_base = command;
+	part.iov_len = length;
+	return axcpEncodeAndSendv(fd, &part, 1);
+}
+
+void axcpBatchInit(axcp_batch_t *batch, int fd, uint8_t *buffer, uint32_t capacity) {
+	batch->fd = fd;
+	batch->channel = NULL;
+	batch->sink = NULL;
+	batch->sinkContext = NULL;
+	batch->buffer = buffer;
+	batch->capacity = capacity;
+	batch->length = 0;
+	batch->commands = 0;
+	batch->writes = 0;
+	batch->written = 0;
+}
+
+// Writes 'length' bytes of 'data' to the fd, ring or sink of 'batch'
+static int axcpBatchWrite(axcp_batch_t *batch, const uint8_t *data, uint32_t length) {
+	if(batch->sink != NULL)
+		return batch->sink(batch->sinkContext, data, length);
+	if(batch->channel == NULL)
+		return fullWrite(batch->fd, data, length);
+	struct iovec part;
+	part.iov_base = (void*) data;
+	part.iov_len = length;
+	return shmChannelWritev(batch->channel, &part, 1);
+}
+
+int axcpBatchFlush(axcp_batch_t *batch) {
+	if(batch->length == 0)
+		return 0;
+	int result = axcpBatchWrite(batch, batch->buffer, batch->length);
+	batch->writes++;
+	batch->written += batch->commands;
+	batch->length = 0;
+	batch->commands = 0;
+	return result;
+}
+
+// Copies a buffer to 'batch', see axcpBatchEncodev()
+static int axcpBatchAppend(axcp_batch_t *batch, const uint8_t *base, uint32_t length) {
+	if(batch->length + length > batch->capacity && axcpBatchFlush(batch) == -1)
+		return -1;
+	if(length > batch->capacity) {
+		batch->writes++;
+		return axcpBatchWrite(batch, base, length);
 	}
+	memcpy(batch->buffer + batch->length, base, length);
+	batch->length += length;
+	return 0;
 }
 
-int axcpEncodeAndSend(int fd, uint8_t* command, uint32_t length) {
+/*
+ * Appends a buffer to the encoded command in 'iov' and writes 'iov' if it is full. If 'batch' is not NULL, the
+ * buffer is copied to it instead.
+ */
+static int axcpAppend(int fd, axcp_batch_t *batch, struct iovec *iov, int *count, const uint8_t *base,
+		uint32_t length) {
+	if(length == 0)
+		return 0;
+	if(batch != NULL)
+		return axcpBatchAppend(batch, base, length);
+	if(*count == AXCP_MAX_IOV) {
+		if(fullWritev(fd, iov, *count) == -1)
+			return -1;
+		*count = 0;
+	}
+	iov[*count].iov_base = (void*) base;
+	iov[*count].iov_len = length;
+	(*count)++;
+	return 0;
+}
+
+// Encodes a command, see axcpEncodeAndSendv(), and writes it to 'fd' or appends it to 'batch' if not NULL
+static int axcpEncode(int fd, axcp_batch_t *batch, const struct iovec *parts, int count) {
+	static const uint8_t fullChunk = 255;
+	struct iovec iov[AXCP_MAX_IOV];
+	int n = 0, p, pl = payloadLength(((uint8_t*) parts[0].iov_base)[0]);
+
+	uint32_t length = 0;
+	for(p=0; p<count; p++)
+		length += parts[p].iov_len;
 
 	// If command has variable payload length
-	if(payloadLength(command[0]) == -1) {
-                uint8_t pl[1];
-
-		// write opcode
-                if(fullWrite(fd, command, 1) == -1)
-                        return -1;
-
-		// loop that is executed as long as full 255-byte payloads are to be sent
-                int curIndex = 1;
-                while(length - curIndex >= 255) {
-                        pl[0] = 255;
-                        if(fullWrite(fd, pl, 1) == -1)
-                                return -1;
-                        if(fullWrite(fd, command+curIndex, pl[0]) == -1)
-                                return -1;
-                        curIndex += pl[0];
-                }
-
-		// Send remaining payload which is smaller than 255 bytes or even zero
-                pl[0] = length - curIndex;
-                if(fullWrite(fd, pl, 1) == -1)
-                        return -1;
-                if(fullWrite(fd, command+curIndex, pl[0]) == -1)
-                        return -1;
+	if(pl == -1) {
+		// opcode
+		if(axcpAppend(fd, batch, iov, &n, (uint8_t*) parts[0].iov_base, 1) == -1)
+			return -1;
+
+		// Split the payload into 255-byte chunks, each preceded by its length. The last chunk is smaller
+		// than 255 bytes or even zero. Chunks may span several parts.
+		uint32_t remaining = length - 1, offset = 1;
+		uint8_t lastChunk;
+		p = 0;
+		while(1) {
+			uint32_t chunk = remaining >= 255 ? 255 : remaining;
+			lastChunk = (uint8_t) chunk;
+			if(axcpAppend(fd, batch, iov, &n, chunk == 255 ? &fullChunk : &lastChunk, 1) == -1)
+				return -1;
+			remaining -= chunk;
+			while(chunk > 0) {
+				if(offset == parts[p].iov_len) {
+					p++;
+					offset = 0;
+					continue;
+				}
+				uint32_t piece = parts[p].iov_len - offset < chunk ? parts[p].iov_len - offset : chunk;
+				if(axcpAppend(fd, batch, iov, &n, (uint8_t*) parts[p].iov_base + offset, piece) == -1)
+					return -1;
+				offset += piece;
+				chunk -= piece;
+			}
+			if(lastChunk < 255)
+				break;
+		}
 
 	// Send full command at once
-        } else if (payloadLength(command[0]) > -1) {
+	} else if(pl > -1) {
 		// Check if specified length equals command length definitions
-		if((uint32_t) payloadLength(command[0]) != length - 1)
+		if((uint32_t) pl != length - 1)
 			return -2;
-                if(fullWrite(fd, command, length) == -1)
-			return -1;
+		for(p=0; p<count; p++)
+			if(axcpAppend(fd, batch, iov, &n, (uint8_t*) parts[p].iov_base, parts[p].iov_len) == -1)
+				return -1;
 	}
 
-	//uint32_t i;
-	//for(i=0; i < length; i++)
-  	//	printf("%d, ", command[i]);
-	//printf("written to %d!\n", fd);     // <----
+	if(n > 0 && fullWritev(fd, iov, n) == -1)
+		return -1;
 
 	return 0;
 }
 
-int axcpReceiveAndDecode(int fd, uint8_t **command, uint32_t *length) {
+int axcpEncodeAndSendv(int fd, const struct iovec *parts, int count) {
+	return axcpEncode(fd, NULL, parts, count);
+}
+
+int axcpEncodedLength(const struct iovec *parts, int count) {
+	int pl = payloadLength(((uint8_t*) parts[0].iov_base)[0]), p;
+	uint32_t length = 0;
+	for(p=0; p<count; p++)
+		length += parts[p].iov_len;
+	// One length byte per full chunk and one for the last, smaller chunk
+	if(pl == -1)
+		return length + (length - 1) / 255 + 1;
+	if(pl < -1)
+		return 0;
+	return (uint32_t) pl == length - 1 ? (int) length : -2;
+}
+
+int axcpBatchEncodev(axcp_batch_t *batch, const struct iovec *parts, int count) {
+	int result = axcpEncode(batch->fd, batch, parts, count);
+	if(result == 0)
+		batch->commands++;
+	return result;
+}
+
+int axcpEncodeAndWriteRingv(shm_channel_t *channel, const struct iovec *parts, int count) {
+	uint8_t buffer[AXCP_RING_ENCODE_SIZE];
+	axcp_batch_t batch;
+	axcpBatchInit(&batch, -1, buffer, sizeof(buffer));
+	batch.channel = channel;
+	int result = axcpEncode(-1, &batch, parts, count);
+	if(result == 0)
+		result = axcpBatchFlush(&batch);
+	return result;
+}
+
+// Reads exactly 'length' bytes from 'channel' if not NULL or from 'fd' otherwise
+static int axcpRead(int fd, shm_channel_t *channel, uint8_t *buffer, uint32_t length) {
+	if(channel != NULL)
+		return shmChannelRead(channel, buffer, length);
+	return fullRead(fd, buffer, length);
+}
+
+// See axcpReceiveAndDecode(), but reads from 'channel' if not NULL
+static int axcpReceive(int fd, shm_channel_t *channel, uint8_t **command, uint32_t *length) {
 
 	uint8_t *buffer = (uint8_t*) malloc(256);
+	axcpAllocations++;
 
 	// read opcode
-        if(fullRead(fd, buffer, 1) == -1)
+        if(axcpRead(fd, channel, buffer, 1) == -1)
         	return -1;
 
         int pl = payloadLength(buffer[0]);
@@ -215,17 +251,18 @@ int axcpReceiveAndDecode(int fd, uint8_t **command, uint32_t *length) {
 		int curIndex = 1;
 		// Loop that is executed as long as 255 byte payload pieces come in
 		do {
-	       		if(fullRead(fd, pl_rx, 1) == -1)
+	       		if(axcpRead(fd, channel, pl_rx, 1) == -1)
 				return -1;
 			buffer = (uint8_t*) realloc(buffer, curIndex + pl_rx[0]);
-	                if(fullRead(fd, buffer+curIndex, pl_rx[0]) == -1)
+			axcpAllocations++;
+	                if(axcpRead(fd, channel, buffer+curIndex, pl_rx[0]) == -1)
 				return -1;
 			curIndex += pl_rx[0];
 		} while(pl_rx[0] == 255);
 		*length = curIndex;
 	// Read entire command
 	} else if(pl > -1) {
-        	if(fullRead(fd, buffer+1, pl) == -1)
+        	if(axcpRead(fd, channel, buffer+1, pl) == -1)
 			return -1;
 		*length = pl + 1;
 	}
@@ -239,21 +276,348 @@ int axcpReceiveAndDecode(int fd, uint8_t **command, uint32_t *length) {
 	return 0;
 }
 
+int axcpReceiveAndDecode(int fd, uint8_t **command, uint32_t *length) {
+	return axcpReceive(fd, NULL, command, length);
+}
+
+// Reads and drops 'length' bytes from 'fd' or 'channel'
+static int axcpDiscard(int fd, shm_channel_t *channel, uint32_t length) {
+	uint8_t scratch[256];
+	while(length > 0) {
+		uint32_t n = length < sizeof(scratch) ? length : sizeof(scratch);
+		if(axcpRead(fd, channel, scratch, n) == -1)
+			return -1;
+		length -= n;
+	}
+	return 0;
+}
+
+// See axcpReceiveAndDecodeInto(), but reads from 'channel' if not NULL
+static int axcpReceiveInto(int fd, shm_channel_t *channel, uint8_t *command, uint32_t capacity, uint32_t *length) {
+	int truncated = 0;
+
+	// read opcode
+	if(axcpRead(fd, channel, command, 1) == -1)
+		return -1;
+	*length = 1;
+
+	int pl = payloadLength(command[0]);
+	// unknown opcode
+	if(pl == -2)
+		return -2;
+
+	if(pl == -1) {
+		// Loop that is executed as long as 255 byte payload pieces come in
+		uint8_t pl_rx[1];
+		do {
+			if(axcpRead(fd, channel, pl_rx, 1) == -1)
+				return -1;
+			uint32_t fits = capacity - *length < pl_rx[0] ? capacity - *length : pl_rx[0];
+			if(axcpRead(fd, channel, command + *length, fits) == -1 ||
+					axcpDiscard(fd, channel, pl_rx[0] - fits) == -1)
+				return -1;
+			*length += fits;
+			if(fits < pl_rx[0])
+				truncated = 1;
+		} while(pl_rx[0] == 255);
+	} else if(pl > 0) {
+		uint32_t fits = capacity - 1 < (uint32_t) pl ? capacity - 1 : (uint32_t) pl;
+		if(axcpRead(fd, channel, command + 1, fits) == -1 || axcpDiscard(fd, channel, pl - fits) == -1)
+			return -1;
+		*length += fits;
+		if(fits < (uint32_t) pl)
+			truncated = 1;
+	}
+	return truncated ? -3 : 0;
+}
+
+int axcpReceiveAndDecodeInto(int fd, uint8_t *command, uint32_t capacity, uint32_t *length) {
+	return axcpReceiveInto(fd, NULL, command, capacity, length);
+}
+
+void axcpDecoderInit(axcp_decoder_t *decoder, axcp_command_callback_t callback) {
+	decoder->state = AXCP_DECODER_OPCODE;
+	decoder->command = NULL;
+	decoder->capacity = 0;
+	decoder->length = 0;
+	decoder->remaining = 0;
+	decoder->chunkLength = 0;
+	decoder->callback = callback;
+	decoder->reads = 0;
+	decoder->commands = 0;
+	decoder->discarded = 0;
+}
+
+void axcpDecoderReset(axcp_decoder_t *decoder) {
+	decoder->state = AXCP_DECODER_OPCODE;
+	decoder->length = 0;
+	decoder->remaining = 0;
+	decoder->chunkLength = 0;
+}
+
+void axcpDecoderDiscard(axcp_decoder_t *decoder) {
+	axcpDecoderReset(decoder);
+	decoder->state = AXCP_DECODER_DISCARD;
+}
+
+int axcpDecoderIdle(axcp_decoder_t *decoder) {
+	return decoder->state == AXCP_DECODER_OPCODE;
+}
+
+// Makes sure the decoder's buffer holds at least 'capacity' bytes. The buffer only ever grows, so at steady state
+// no allocation is done at all.
+static void axcpDecoderReserve(axcp_decoder_t *decoder, uint32_t capacity) {
+	if(capacity <= decoder->capacity)
+		return;
+	uint32_t newCapacity = decoder->capacity > 0 ? decoder->capacity : AXCP_DECODER_INITIAL_CAPACITY;
+	while(newCapacity < capacity)
+		newCapacity *= 2;
+	decoder->command = (uint8_t*) realloc(decoder->command, newCapacity);
+	decoder->capacity = newCapacity;
+	axcpAllocations++;
+}
+
+// Passes the completed command to the callback and prepares 'decoder' for the next opcode
+static void axcpDecoderDeliver(axcp_decoder_t *decoder) {
+	uint32_t length = decoder->length;
+	axcpDecoderReset(decoder);
+	decoder->commands++;
+	decoder->callback(decoder->command, length);
+}
+
+void axcpDecode(axcp_decoder_t *decoder, const uint8_t *data, uint32_t length) {
+	uint32_t i = 0;
+	while(i < length) {
+		switch(decoder->state) {
+		case AXCP_DECODER_DISCARD:
+			decoder->discarded += length - i;
+			i = length;
+			break;
+		case AXCP_DECODER_OPCODE: {
+			int pl = payloadLength(data[i]);
+			// Unknown opcodes are passed with length 1, fixed payloads are reserved at once
+			axcpDecoderReserve(decoder, pl > 0 ? pl + 1 : 1);
+			decoder->command[0] = data[i++];
+			decoder->length = 1;
+			if(pl == -1) {
+				decoder->state = AXCP_DECODER_CHUNK_LENGTH;
+			} else if(pl > 0) {
+				decoder->remaining = pl;
+				decoder->state = AXCP_DECODER_FIXED_PAYLOAD;
+			} else {
+				axcpDecoderDeliver(decoder);
+			}
+			break;
+		} case AXCP_DECODER_CHUNK_LENGTH:
+			decoder->chunkLength = data[i++];
+			decoder->remaining = decoder->chunkLength;
+			axcpDecoderReserve(decoder, decoder->length + decoder->chunkLength);
+			decoder->state = AXCP_DECODER_CHUNK;
+			if(decoder->chunkLength == 0)
+				axcpDecoderDeliver(decoder);
+			break;
+		case AXCP_DECODER_FIXED_PAYLOAD:
+		case AXCP_DECODER_CHUNK: {
+			// Copy as much of the missing payload as available
+			uint32_t n = length - i < decoder->remaining ? length - i : decoder->remaining;
+			memcpy(decoder->command + decoder->length, data + i, n);
+			decoder->length += n;
+			decoder->remaining -= n;
+			i += n;
+			if(decoder->remaining > 0)
+				break;
+			if(decoder->state == AXCP_DECODER_CHUNK && decoder->chunkLength == 255)
+				decoder->state = AXCP_DECODER_CHUNK_LENGTH;
+			else
+				axcpDecoderDeliver(decoder);
+			break;
+		}
+		}
+	}
+}
+
+int axcpDecodeAvailable(axcp_decoder_t *decoder, int fd) {
+	uint8_t buffer[AXCP_READ_BLOCK_SIZE];
+	int total = 0, length;
+	// A block that was filled completely indicates that there is more to read
+	do {
+		length = read(fd, buffer, AXCP_READ_BLOCK_SIZE);
+		if(length == -1) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			return total > 0 ? total : -2;
+		}
+		decoder->reads++;
+		axcpDecode(decoder, buffer, length);
+		total += length;
+	} while(length == AXCP_READ_BLOCK_SIZE);
+	return total;
+}
+
+// Rings to andrixswc, see userProgramChannel()
+static shm_channel_t userProgramRing;
+static int userProgramRingOpen = -1;
+
+/*
+ * Maps the rings andrixswc passed on the first call.
+ * Return: the channel to andrixswc or NULL if the pipes have to be used.
+ */
+static shm_channel_t *userProgramChannel() {
+	// The pipes stay open, so a hangup of PROGRAM_IN_FD tells that andrixswc is gone
+	if(userProgramRingOpen == -1)
+		userProgramRingOpen = shmChannelOpen(&userProgramRing, PROGRAM_IN_FD) == 0;
+	return userProgramRingOpen ? &userProgramRing : NULL;
+}
+
+// Commands collected between userProgramBeginBatch() and userProgramCommitBatch()
+static uint8_t userProgramBatchBuffer[USER_PROGRAM_BATCH_SIZE];
+static axcp_batch_t userProgramBatch;
+static int userProgramBatching = 0;
+
+// Sends a batch the program didn't commit before exiting
+static void userProgramCommitAtExit() {
+	userProgramCommitBatch();
+}
+
+int userProgramBeginBatch() {
+	static int registered = 0;
+	if(userProgramBatching)
+		return 0;
+	if(!registered) {
+		atexit(userProgramCommitAtExit);
+		registered = 1;
+	}
+	axcpBatchInit(&userProgramBatch, PROGRAM_OUT_FD, userProgramBatchBuffer, sizeof(userProgramBatchBuffer));
+	userProgramBatch.channel = userProgramChannel();
+	userProgramBatching = 1;
+	return 1;
+}
+
+int userProgramCommitBatch() {
+	if(!userProgramBatching)
+		return 0;
+	userProgramBatching = 0;
+	return axcpBatchFlush(&userProgramBatch);
+}
+
 int userProgramSend(uint8_t* command, uint32_t length) {
-	return axcpEncodeAndSend(PROGRAM_OUT_FD, command, length);
+	struct iovec part;
+	part.iov_base = command;
+	part.iov_len = length;
+	return userProgramSendv(&part, 1);
+}
+
+int userProgramSendv(const struct iovec *parts, int count) {
+	if(userProgramBatching)
+		return axcpBatchEncodev(&userProgramBatch, parts, count);
+	shm_channel_t *channel = userProgramChannel();
+	if(channel != NULL)
+		return axcpEncodeAndWriteRingv(channel, parts, count);
+	return axcpEncodeAndSendv(PROGRAM_OUT_FD, parts, count);
+}
+
+// Sequence number of the last request, see userProgramRequest()
+static uint8_t userProgramTag = 0;
+uint8_t userProgramErrorCode = 0;
+
+// Sends a request preceded by its tag, together with the commands of the current batch if any
+static int userProgramSendRequest(uint8_t* send, uint32_t sendLen) {
+	uint8_t tag[2];
+	tag[0] = REQUEST_TAG_SWCINTERN;
+	tag[1] = ++userProgramTag;
+	// Tag and request are written at once
+	int started = userProgramBeginBatch();
+	int result = userProgramSend(tag, 2);
+	if(result == 0)
+		result = userProgramSend(send, sendLen);
+	if(result == 0)
+		result = axcpBatchFlush(&userProgramBatch);
+	if(started)
+		userProgramBatching = 0;
+	return result;
 }
 
 int userProgramRequest(uint8_t* send, uint32_t sendLen, uint8_t** answer, uint32_t* answerLen) {
-	int result = axcpEncodeAndSend(PROGRAM_OUT_FD, send, sendLen);
+	int result = userProgramSendRequest(send, sendLen);
 	if(result < 0)
 		return result;
 	// It is assumed that the pipe connection between user programs and andrixswc answers
         // directly to requests, i.e. no other commands can be transmitted between request and reply.
 	// This assumption is guaranteed by the user progams via only calling this function when requesting
-        // and by andrixswc via ensuring that no commands can intervene.
-	result = axcpReceiveAndDecode(PROGRAM_IN_FD, answer, answerLen);
+        // and by andrixswc via ensuring that no commands can intervene. Only replies to requests that timed out
+	// before may come first; they carry another tag and are dropped.
+	shm_channel_t *channel = userProgramChannel();
+	int tag = -1;
+	while(1) {
+		result = axcpReceive(PROGRAM_IN_FD, channel, answer, answerLen);
+		if(result != 0)
+			break;
+		if((*answer)[0] == REQUEST_TAG_SWCINTERN) {
+			tag = (*answer)[1];
+		} else if(tag == userProgramTag) {
+			break;
+		} else {
+			tag = -1;
+		}
+		free(*answer);
+	}
 	if(result == -2)
 		return -3;
 	return result;
 }
 
+int userProgramRequestInto(uint8_t* send, uint32_t sendLen, uint8_t* answer, uint32_t capacity, uint32_t* answerLen) {
+	return userProgramRequestTimeout(send, sendLen, answer, capacity, answerLen, -1);
+}
+
+int userProgramRequestTimeout(uint8_t* send, uint32_t sendLen, uint8_t* answer, uint32_t capacity, uint32_t* answerLen,
+		int timeout) {
+	int result = userProgramSendRequest(send, sendLen);
+	if(result < 0)
+		return result;
+	shm_channel_t *channel = userProgramChannel();
+	uint64_t deadline = timeMillis() + timeout;
+	int tag = -1;
+	// Same assumption as in userProgramRequest(): the reply directly follows the request or stale replies
+	while(1) {
+		// andrixswc writes whole commands, so once the first byte is there, reading the command doesn't block
+		if(timeout >= 0) {
+			uint64_t now = timeMillis();
+			int remaining = now < deadline ? (int) (deadline - now) : 0, ready;
+			if(channel != NULL) {
+				ready = shmChannelWait(channel, remaining);
+			} else {
+				struct pollfd pfd;
+				pfd.fd = PROGRAM_IN_FD;
+				pfd.events = POLLIN;
+				ready = poll(&pfd, 1, remaining);
+			}
+			if(ready == -1 && errno == EINTR)
+				continue;
+			if(ready == -1)
+				return -1;
+			if(ready == 0)
+				return -6;
+		}
+		result = axcpReceiveInto(PROGRAM_IN_FD, channel, answer, capacity, answerLen);
+		if(result == -1 || result == -2)
+			break;
+		if(result == 0 && answer[0] == REQUEST_TAG_SWCINTERN) {
+			tag = answer[1];
+			continue;
+		}
+		if(tag == userProgramTag)
+			break;
+		tag = -1;
+	}
+	if(result == -2)
+		return -3;
+	if(result == -3)
+		return -4;
+	if(result == 0 && answer[0] == ERROR_ACTION) {
+		userProgramErrorCode = answer[1];
+		memset(answer + 1, 0, capacity - 1);
+		return -5;
+	}
+	return result;
+}
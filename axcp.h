@@ -18,7 +18,11 @@
  * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef AXCP_H
+#define AXCP_H
+
 #include "tools.h"
+#include "shmring.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -26,111 +30,142 @@
 
 #define PROGRAM_IN_FD 202
 #define PROGRAM_OUT_FD 203
+// Updates of the program's subscriptions, see receiveUpdate()
+#define PROGRAM_EVENT_FD 205
+
+// Number of sensor ports reported by ANALOG_SENSOR_ALL_REPLY and DIGITAL_SENSOR_ALL_REPLY
+#define AXCP_SENSOR_PORTS 16
 
-// AXCP (and AXDP) opcode definitions
-#define NOP 0
-#define NOP2 248
-#define SEND_CUSTOM_DATA_ACTION_SWCINTERN 5
-#define CUSTOM_DATA_AVAILABLE_REQUEST_SWCINTERN 6
-#define CUSTOM_DATA_AVAILABLE_REPLY_SWCINTERN 7
-#define READ_CUSTOM_DATA_REQUEST_SWCINTERN 8
-#define READ_CUSTOM_DATA_REPLY_SWCINTERN 9
-#define ANALOG_SENSOR_REQUEST 10
-#define ANALOG_SENSOR_REPLY 11
-#define ANALOG_SENSOR_SUBSCRIPTION 12
-#define ANALOG_SENSOR_UPDATE 13
-#define ANALOG_PULLUP_ACTION 14
-#define DIGITAL_SENSOR_REQUEST 20
-#define DIGITAL_SENSOR_REPLY 21
-#define DIGITAL_SENSOR_SUBSCRIPTION 22
-#define DIGITAL_SENSOR_UPDATE 23
-#define DIGITAL_PULLUP_ACTION 24
-#define DIGITAL_OUTPUT_MODE_ACTION 25
-#define DIGITAL_OUTPUT_LEVEL_ACTION 26
-#define MOTOR_POWER_ACTION 30
-#define MOTOR_VELOCITY_ACTION 31
-#define MOTOR_POWER_ABSOLUTE_POSITION_ACTION 32
-#define MOTOR_VELOCITY_ABSOLUTE_POSITION_ACTION 33
-#define MOTOR_POWER_RELATIVE_POSITION_ACTION 34
-#define MOTOR_VELOCITY_RELATIVE_POSITION_ACTION 35
-#define MOTOR_FREEZE_ACTION 36
-#define MOTOR_BRAKE_ACTION 37
-#define MOTOR_OFF_ACTION 38
-#define MOTOR_POSITION_REQUEST 40
-#define MOTOR_POSITION_REPLY 41
-#define MOTOR_POSITION_REACHED_ACTION 42
-#define MOTOR_POSITION_SUBSCRIPTION 43
-#define MOTOR_POSITION_UPDATE 44
-#define MOTOR_CLEAR_POSITION_ACTION 45
-#define MOTOR_VELOCITY_REQUEST 46
-#define MOTOR_VELOCITY_REPLY 47
-#define MOTOR_VELOCITY_SUBSCRIPTION 48
-#define MOTOR_VELOCITY_UPDATE 49
-#define SERVO_ONOFF_ACTION 50
-#define SERVO_DRIVE_ACTION 51
-#define CONTROLLER_BATTERY_CHARGE_REQUEST 60
-#define CONTROLLER_BATTERY_CHARGE_REPLY 61
-#define CONTROLLER_BATTERY_CHARGING_STATE_REQUEST 62
-#define CONTROLLER_BATTERY_CHARGING_STATE_REPLY 63
-#define PHONE_BATTERY_CHARGE_REQUEST 64
-#define PHONE_BATTERY_CHARGE_REPLY 65
-#define PHONE_BATTERY_CHARGING_STATE_REQUEST 66
-#define PHONE_BATTERY_CHARGING_STATE_REPLY 67
-#define CONTROLLER_BATTERY_UPDATE 68
-#define PHONE_SENSOR_REQUEST 70
-#define PHONE_SENSOR_REPLY 71
-#define PHONE_SENSOR_AVAILABILITY_REQUEST 72
-#define PHONE_SENSOR_AVAILABILITY_REPLY 73
-#define PHONE_CAMERA_TAKE_PICTURE_ACTION 80
-#define PHONE_CAMERA_GET_BLOB_COUNT_REQUEST 81
-#define PHONE_CAMERA_GET_BLOB_COUNT_REPLY 82
-#define PHONE_CAMERA_GET_BLOB_REQUEST 83
-#define PHONE_CAMERA_GET_BLOB_REPLY 84
-#define PHONE_CAMERA_SET_CHANNEL_ACTION 85
-#define HW_CONTROLLER_OFF_ACTION 90
-#define HW_CONTROLLER_RESET_ACTION 91
-#define SW_CONTROLLER_OFF_ACTION 92
-#define SW_CONTROLLER_RESET_ACTION 93
-#define PHONE_OFF_ACTION 94
-#define PHONE_RESET_ACTION 95
-#define ERROR_ACTION 96
-#define CUSTOM_ACTION 97
-#define DEBUG_INFORMATION_UPDATE 100
-#define HW_CONTROLLER_TYPE_REQUEST 110
-#define HW_CONTROLLER_TYPE_REPLY 111
-#define SW_CONTROLLER_TYPE_REQUEST 112
-#define SW_CONTROLLER_TYPE_REPLY 113
-#define PHONE_TYPE_REQUEST 114
-#define PHONE_TYPE_REPLY 115
-#define HW_CONTROLLER_SET_MEMORY_ACTION 116
-#define ENVIRONMENT_SCAN_SUBSCRIPTION 120
-#define ENVIRONMENT_SCAN_HW_CONTROLLER_UPDATE 121
-#define ENVIRONMENT_SCAN_SW_CONTROLLER_UPDATE 122
-#define ENVIRONMENT_SCAN_PHONE_UPDATE 123
-#define CONTROLLER_AUTHENTICATE_REQUEST 124
-#define CONTROLLER_AUTHENTICATE_REPLY 125
-#define HW_CONTROLLER_GET_MEMORY_REQUEST 126
-#define HW_CONTROLLER_GET_MEMORY_REPLY 127
-#define PROGRAM_COMPILE_REQUEST 150
-#define PROGRAM_COMPILE_REPLY 151
-#define PROGRAM_EXECUTE_ACTION 152
-#define PROGRAM_COMPILE_EXECUTE_REQUEST 153
-#define PROGRAM_COMPILE_EXECUTE_REPLY 154
-#define PROGRAMS_FETCH_SUBSCRIPTION 155
-#define PROGRAMS_FETCH_UPDATE 156
-#define PROGRAMS_FETCH_DONE_UPDATE 157
-#define EXECUTION_STARTED_ACTION 160
-#define EXECUTION_STOP_ACTION 161
-#define EXECUTION_RESTART_ACTION 162
-#define EXECUTION_STOPPED_ACTION 163
-#define EXECUTION_DONE_ACTION 164
-#define EXECUTION_PRINTOUT_ACTION 165
-#define EXECUTION_DATA_ACTION 166
-#define DEBUGGING_BREAK_ACTION 170
-#define DEBUGGING_BREAKED_ACTION 171
-#define DEBUGGING_CONTINUE_ACTION 172
-#define DEBUGGING_ADD_BREAKPOINT_ACTION 173
-#define DEBUGGING_REMOVE_BREAKPOINT_ACTION 174
+/*
+ * AXCP (and AXDP) opcode specification: X(name, opcode, payload length) for every known command. The payload
+ * length is -1 for commands with variable payload length. This list is the only place opcodes and lengths
+ * are defined, the opcode constants and the payload length table are generated from it.
+ */
+#define AXCP_OPCODES(X) \
+	X(NOP, 0, 0) \
+	X(NOP2, 248, 0) \
+	X(REQUEST_TAG_SWCINTERN, 1, 1) \
+	X(WAIT_CUSTOM_DATA_REQUEST_SWCINTERN, 3, 12) \
+	X(WAIT_CUSTOM_DATA_REPLY_SWCINTERN, 4, -1) \
+	X(SEND_CUSTOM_DATA_ACTION_SWCINTERN, 5, -1) \
+	X(CUSTOM_DATA_AVAILABLE_REQUEST_SWCINTERN, 6, 0) \
+	X(CUSTOM_DATA_AVAILABLE_REPLY_SWCINTERN, 7, 4) \
+	X(READ_CUSTOM_DATA_REQUEST_SWCINTERN, 8, 4) \
+	X(READ_CUSTOM_DATA_REPLY_SWCINTERN, 9, -1) \
+	X(ANALOG_SENSOR_REQUEST, 10, 1) \
+	X(ANALOG_SENSOR_REPLY, 11, 3) \
+	X(ANALOG_SENSOR_SUBSCRIPTION, 12, -1) \
+	X(ANALOG_SENSOR_UPDATE, 13, -1) \
+	X(ANALOG_PULLUP_ACTION, 14, -1) \
+	X(ANALOG_SENSOR_ALL_REQUEST, 15, 0) \
+	X(ANALOG_SENSOR_ALL_REPLY, 16, 20) \
+	X(DIGITAL_SENSOR_REQUEST, 20, 1) \
+	X(DIGITAL_SENSOR_REPLY, 21, 2) \
+	X(DIGITAL_SENSOR_SUBSCRIPTION, 22, -1) \
+	X(DIGITAL_SENSOR_UPDATE, 23, -1) \
+	X(DIGITAL_PULLUP_ACTION, 24, -1) \
+	X(DIGITAL_OUTPUT_MODE_ACTION, 25, -1) \
+	X(DIGITAL_OUTPUT_LEVEL_ACTION, 26, 2) \
+	X(DIGITAL_SENSOR_ALL_REQUEST, 27, 0) \
+	X(DIGITAL_SENSOR_ALL_REPLY, 28, 2) \
+	X(MOTOR_POWER_ACTION, 30, 3) \
+	X(MOTOR_VELOCITY_ACTION, 31, 3) \
+	X(MOTOR_POWER_ABSOLUTE_POSITION_ACTION, 32, 6) \
+	X(MOTOR_VELOCITY_ABSOLUTE_POSITION_ACTION, 33, 6) \
+	X(MOTOR_POWER_RELATIVE_POSITION_ACTION, 34, 6) \
+	X(MOTOR_VELOCITY_RELATIVE_POSITION_ACTION, 35, 6) \
+	X(MOTOR_FREEZE_ACTION, 36, 1) \
+	X(MOTOR_BRAKE_ACTION, 37, 2) \
+	X(MOTOR_OFF_ACTION, 38, 1) \
+	X(MOTOR_MULTI_ACTION, 39, -1) \
+	X(MOTOR_POSITION_REQUEST, 40, 1) \
+	X(MOTOR_POSITION_REPLY, 41, 5) \
+	X(MOTOR_POSITION_REACHED_ACTION, 42, 1) \
+	X(MOTOR_POSITION_SUBSCRIPTION, 43, -1) \
+	X(MOTOR_POSITION_UPDATE, 44, -1) \
+	X(MOTOR_CLEAR_POSITION_ACTION, 45, 1) \
+	X(MOTOR_VELOCITY_REQUEST, 46, 1) \
+	X(MOTOR_VELOCITY_REPLY, 47, 3) \
+	X(MOTOR_VELOCITY_SUBSCRIPTION, 48, -1) \
+	X(MOTOR_VELOCITY_UPDATE, 49, -1) \
+	X(SERVO_ONOFF_ACTION, 50, 2) \
+	X(SERVO_DRIVE_ACTION, 51, 2) \
+	X(SERVO_MULTI_ACTION, 52, -1) \
+	X(CONTROLLER_BATTERY_CHARGE_REQUEST, 60, 0) \
+	X(CONTROLLER_BATTERY_CHARGE_REPLY, 61, 1) \
+	X(CONTROLLER_BATTERY_CHARGING_STATE_REQUEST, 62, 0) \
+	X(CONTROLLER_BATTERY_CHARGING_STATE_REPLY, 63, 1) \
+	X(PHONE_BATTERY_CHARGE_REQUEST, 64, 0) \
+	X(PHONE_BATTERY_CHARGE_REPLY, 65, 1) \
+	X(PHONE_BATTERY_CHARGING_STATE_REQUEST, 66, 0) \
+	X(PHONE_BATTERY_CHARGING_STATE_REPLY, 67, 1) \
+	X(CONTROLLER_BATTERY_UPDATE, 68, 2) \
+	X(PHONE_SENSOR_REQUEST, 70, 1) \
+	X(PHONE_SENSOR_REPLY, 71, -1) \
+	X(PHONE_SENSOR_AVAILABILITY_REQUEST, 72, 0) \
+	X(PHONE_SENSOR_AVAILABILITY_REPLY, 73, 4) \
+	X(PHONE_CAMERA_TAKE_PICTURE_ACTION, 80, 0) \
+	X(PHONE_CAMERA_GET_BLOB_COUNT_REQUEST, 81, 1) \
+	X(PHONE_CAMERA_GET_BLOB_COUNT_REPLY, 82, 2) \
+	X(PHONE_CAMERA_GET_BLOB_REQUEST, 83, 2) \
+	X(PHONE_CAMERA_GET_BLOB_REPLY, 84, 10) \
+	X(PHONE_CAMERA_SET_CHANNEL_ACTION, 85, 7) \
+	X(HW_CONTROLLER_OFF_ACTION, 90, 0) \
+	X(HW_CONTROLLER_RESET_ACTION, 91, 0) \
+	X(SW_CONTROLLER_OFF_ACTION, 92, 0) \
+	X(SW_CONTROLLER_RESET_ACTION, 93, 0) \
+	X(PHONE_OFF_ACTION, 94, 0) \
+	X(PHONE_RESET_ACTION, 95, 0) \
+	X(ERROR_ACTION, 96, 2) \
+	X(CUSTOM_ACTION, 97, -1) \
+	X(DEBUG_INFORMATION_UPDATE, 100, -1) \
+	X(HW_CONTROLLER_TYPE_REQUEST, 110, 0) \
+	X(HW_CONTROLLER_TYPE_REPLY, 111, 1) \
+	X(SW_CONTROLLER_TYPE_REQUEST, 112, 0) \
+	X(SW_CONTROLLER_TYPE_REPLY, 113, 1) \
+	X(PHONE_TYPE_REQUEST, 114, 0) \
+	X(PHONE_TYPE_REPLY, 115, 1) \
+	X(HW_CONTROLLER_SET_MEMORY_ACTION, 116, -1) \
+	X(ENVIRONMENT_SCAN_SUBSCRIPTION, 120, 0) \
+	X(ENVIRONMENT_SCAN_HW_CONTROLLER_UPDATE, 121, 33) \
+	X(ENVIRONMENT_SCAN_SW_CONTROLLER_UPDATE, 122, 1) \
+	X(ENVIRONMENT_SCAN_PHONE_UPDATE, 123, 1) \
+	X(CONTROLLER_AUTHENTICATE_REQUEST, 124, -1) \
+	X(CONTROLLER_AUTHENTICATE_REPLY, 125, 1) \
+	X(HW_CONTROLLER_GET_MEMORY_REQUEST, 126, 1) \
+	X(HW_CONTROLLER_GET_MEMORY_REPLY, 127, -1) \
+	X(PROGRAM_COMPILE_REQUEST, 150, -1) \
+	X(PROGRAM_COMPILE_REPLY, 151, -1) \
+	X(PROGRAM_EXECUTE_ACTION, 152, 34) \
+	X(PROGRAM_COMPILE_EXECUTE_REQUEST, 153, -1) \
+	X(PROGRAM_COMPILE_EXECUTE_REPLY, 154, -1) \
+	X(PROGRAMS_FETCH_SUBSCRIPTION, 155, 0) \
+	X(PROGRAMS_FETCH_UPDATE, 156, -1) \
+	X(PROGRAMS_FETCH_DONE_UPDATE, 157, 0) \
+	X(EXECUTION_STARTED_ACTION, 160, 34) \
+	X(EXECUTION_STOP_ACTION, 161, 34) \
+	X(EXECUTION_RESTART_ACTION, 162, 34) \
+	X(EXECUTION_STOPPED_ACTION, 163, 34) \
+	X(EXECUTION_DONE_ACTION, 164, 38) \
+	X(EXECUTION_PRINTOUT_ACTION, 165, -1) \
+	X(EXECUTION_DATA_ACTION, 166, -1) \
+	X(DEBUGGING_BREAK_ACTION, 170, 34) \
+	X(DEBUGGING_BREAKED_ACTION, 171, -1) \
+	X(DEBUGGING_CONTINUE_ACTION, 172, 34) \
+	X(DEBUGGING_ADD_BREAKPOINT_ACTION, 173, 36) \
+	X(DEBUGGING_REMOVE_BREAKPOINT_ACTION, 174, 36) \
+	X(EXECUTION_COMPACT_SUBSCRIPTION, 175, 1) \
+	X(EXECUTION_STARTED_COMPACT_ACTION, 176, 35) \
+	X(EXECUTION_PRINTOUT_COMPACT_ACTION, 177, -1) \
+	X(EXECUTION_DATA_COMPACT_ACTION, 178, -1) \
+	X(DEBUGGING_BREAKED_COMPACT_ACTION, 179, -1)
+
+// Opcode constants, e.g. MOTOR_POWER_ACTION
+#define AXCP_OPCODE_CONSTANT(name, opcode, length) name = opcode,
+enum axcp_opcode {
+	AXCP_OPCODES(AXCP_OPCODE_CONSTANT)
+};
+#undef AXCP_OPCODE_CONSTANT
 
 // AXCP (and AXDP) error code definition
 #define ERRORCODE_UNSPECIFIED_OPCODE 1
@@ -151,13 +186,179 @@
 #define ERRORCODE_NO_HW_CONTROLLER_CONNECTED 152
 #define ERRORCODE_PROGRAM_IS_NOT_RUNNING 153
 #define ERRORCODE_PROGRAM_IS_NOT_BREAKED 154
+#define ERRORCODE_COMPILATION_IN_PROGRESS 155
+#define ERRORCODE_REQUEST_TIMEOUT 156
+#define ERRORCODE_CUSTOM_DATA_BUFFER_FULL 157
 #define ERRORCODE_UNSPECIFIED_ERROR 255
 
 /*
- * Returns the payload length of the command with the specified 'opcode'.
+ * Payload length of every opcode plus 2, generated from AXCP_OPCODES. The offset makes the implicit 0 of
+ * unknown opcodes read as -2, see payloadLength().
+ */
+extern const uint8_t axcpPayloadLengths[256];
+
+/*
+ * Returns the payload length of the command with the specified 'opcode'. A single table lookup.
  * Return: the payload length, -1 if the command has a variable payload length or -2 if the command is unknown.
  */
-int payloadLength(uint8_t opcode);
+static inline int payloadLength(uint8_t opcode) {
+	return (int) axcpPayloadLengths[opcode] - 2;
+}
+
+/*
+ * Typed builders for the fixed length commands sent on hot paths. Each one writes the plain command straight
+ * into 'command', which must hold at least payload length + 1 bytes.
+ * Return: the length of the plain command.
+ */
+
+// Any command whose only payload is a port, e.g. ANALOG_SENSOR_REQUEST or MOTOR_OFF_ACTION
+static inline uint32_t axcpBuildPortCommand(uint8_t *command, uint8_t opcode, uint8_t port) {
+	command[0] = opcode;
+	command[1] = port;
+	return 2;
+}
+
+// Any command whose payload is a port and one value byte, e.g. SERVO_DRIVE_ACTION or MOTOR_BRAKE_ACTION
+static inline uint32_t axcpBuildPortValueCommand(uint8_t *command, uint8_t opcode, uint8_t port, uint8_t value) {
+	command[0] = opcode;
+	command[1] = port;
+	command[2] = value;
+	return 3;
+}
+
+// MOTOR_POWER_ACTION or MOTOR_VELOCITY_ACTION; 'direction' is 0 for forward and 1 for backward
+static inline uint32_t axcpBuildMotorCommand(uint8_t *command, uint8_t opcode, uint8_t port, uint8_t direction,
+		uint8_t magnitude) {
+	command[0] = opcode;
+	command[1] = port;
+	command[2] = direction;
+	command[3] = magnitude;
+	return 4;
+}
+
+// One of the MOTOR_*_POSITION_ACTION commands, moving at 'magnitude' to or by 'position'
+static inline uint32_t axcpBuildMotorPositionCommand(uint8_t *command, uint8_t opcode, uint8_t port, uint8_t magnitude,
+		int32_t position) {
+	command[0] = opcode;
+	command[1] = port;
+	command[2] = magnitude;
+	command[3] = (position >> 24) & 0xFF;
+	command[4] = (position >> 16) & 0xFF;
+	command[5] = (position >> 8) & 0xFF;
+	command[6] = position & 0xFF;
+	return 7;
+}
+
+// ANALOG_PULLUP_ACTION, DIGITAL_PULLUP_ACTION or DIGITAL_OUTPUT_MODE_ACTION; bit n of 'mask' is port n
+static inline uint32_t axcpBuildPortMaskCommand(uint8_t *command, uint8_t opcode, uint16_t mask) {
+	command[0] = opcode;
+	command[1] = (mask >> 8) & 0xFF;
+	command[2] = mask & 0xFF;
+	return 3;
+}
+
+/*
+ * MOTOR_MULTI_ACTION or SERVO_MULTI_ACTION applying the single port 'action' to all ports in 'mask' at once, bit n
+ * is port n. The payload is 'action', 'mask' and the payload of 'action' without the port for every port in
+ * 'mask' in ascending order. 'values' holds that payload for every port, payloadLength(action) - 1 bytes each,
+ * indexed by port; only the ports in 'mask' are used, and it may be NULL if that payload is empty. 'command' must
+ * hold 3 + 8 * (payloadLength(action) - 1) bytes.
+ */
+static inline uint32_t axcpBuildMultiAction(uint8_t *command, uint8_t opcode, uint8_t action, uint8_t mask,
+		const uint8_t *values) {
+	uint32_t valueLength = payloadLength(action) - 1;
+	uint32_t length = 3;
+	int port;
+	command[0] = opcode;
+	command[1] = action;
+	command[2] = mask;
+	for(port=0; port<8 && valueLength > 0; port++) {
+		if(mask & (1 << port)) {
+			memcpy(command + length, values + port * valueLength, valueLength);
+			length += valueLength;
+		}
+	}
+	return length;
+}
+
+// One of the *_SUBSCRIPTION commands for 'port' with an update 'interval' in milliseconds; 0 cancels it
+static inline uint32_t axcpBuildSubscription(uint8_t *command, uint8_t opcode, uint8_t port, uint16_t interval) {
+	command[0] = opcode;
+	command[1] = port;
+	command[2] = (interval >> 8) & 0xFF;
+	command[3] = interval & 0xFF;
+	return 4;
+}
+
+// ERROR_ACTION reporting 'errorCode' for 'opcode'
+static inline uint32_t axcpBuildError(uint8_t *command, uint8_t errorCode, uint8_t opcode) {
+	command[0] = ERROR_ACTION;
+	command[1] = errorCode;
+	command[2] = opcode;
+	return 3;
+}
+
+// ANALOG_SENSOR_ALL_REPLY with the 10 bit 'values' of all AXCP_SENSOR_PORTS ports packed MSB first, port 0 first
+static inline uint32_t axcpBuildAnalogAllReply(uint8_t *command, const int *values) {
+	int port;
+	command[0] = ANALOG_SENSOR_ALL_REPLY;
+	for(port=1; port<=20; port++)
+		command[port] = 0;
+	for(port=0; port<AXCP_SENSOR_PORTS; port++) {
+		int bit = port * 10;
+		uint16_t shifted = (uint16_t) ((values[port] & 0x3FF) << (6 - bit % 8));
+		command[1 + bit / 8] |= shifted >> 8;
+		command[2 + bit / 8] |= shifted & 0xFF;
+	}
+	return 21;
+}
+
+// DIGITAL_SENSOR_ALL_REPLY with the levels of all ports as 'mask', bit n is port n
+static inline uint32_t axcpBuildDigitalAllReply(uint8_t *command, uint16_t mask) {
+	command[0] = DIGITAL_SENSOR_ALL_REPLY;
+	command[1] = mask >> 8;
+	command[2] = mask & 0xFF;
+	return 3;
+}
+
+/*
+ * Typed parsers for the replies to the requests above; 'reply' is the plain command including the opcode.
+ */
+
+// ANALOG_SENSOR_REPLY: the 10 bit value
+static inline int axcpParseAnalogReply(const uint8_t *reply) {
+	return (reply[2] << 8) | reply[3];
+}
+
+// DIGITAL_SENSOR_REPLY: the level
+static inline int axcpParseDigitalReply(const uint8_t *reply) {
+	return reply[2];
+}
+
+// MOTOR_POSITION_REPLY: the signed position
+static inline int32_t axcpParseMotorPositionReply(const uint8_t *reply) {
+	return (int32_t) (((uint32_t) reply[2] << 24) | (reply[3] << 16) | (reply[4] << 8) | reply[5]);
+}
+
+// MOTOR_VELOCITY_REPLY: the velocity magnitude; 'direction' is set to 0 for forward and 1 for backward
+static inline uint8_t axcpParseMotorVelocityReply(const uint8_t *reply, uint8_t *direction) {
+	*direction = reply[2];
+	return reply[3];
+}
+
+// ANALOG_SENSOR_ALL_REPLY: the 10 bit values of all AXCP_SENSOR_PORTS ports, stored to 'values'
+static inline void axcpParseAnalogAllReply(const uint8_t *reply, int *values) {
+	int port;
+	for(port=0; port<AXCP_SENSOR_PORTS; port++) {
+		int bit = port * 10;
+		values[port] = (((reply[1 + bit / 8] << 8) | reply[2 + bit / 8]) >> (6 - bit % 8)) & 0x3FF;
+	}
+}
+
+// DIGITAL_SENSOR_ALL_REPLY: the levels of all ports, bit n is port n
+static inline uint16_t axcpParseDigitalAllReply(const uint8_t *reply) {
+	return (reply[1] << 8) | reply[2];
+}
 
 /*
  * Takes the plain 'command' (opcode + payload) of length 'length', encodes it and sends it through 'fd'.
@@ -167,6 +368,78 @@ int payloadLength(uint8_t opcode);
  */
 int axcpEncodeAndSend(int fd, uint8_t* command, uint32_t length);
 
+/*
+ * Like axcpEncodeAndSend(), but the plain command is given as 'count' consecutive 'parts', e.g. a header
+ * and a payload that don't have to be copied into one buffer. The first part must contain at least the
+ * opcode. The encoded command, including the chunk length bytes, is written with a single writev() unless
+ * it consists of more than AXCP_MAX_IOV pieces.
+ * Return: 0 on success, -1 if there was an I/O error and -2 if the command has a fixed payload length which
+ * does not correspond to the given length.
+ */
+int axcpEncodeAndSendv(int fd, const struct iovec *parts, int count);
+
+/*
+ * Return: the length of the plain command consisting of 'count' consecutive 'parts' once it is encoded, i.e.
+ * including the chunk length bytes, 0 for an unknown opcode, which axcpEncodeAndSendv() doesn't send, or -2 if
+ * the command has a fixed payload length which does not correspond to the given length.
+ */
+int axcpEncodedLength(const struct iovec *parts, int count);
+
+/*
+ * Function a batch passes its encoded bytes to instead of writing them, see axcp_batch_t.
+ * Return: 0 on success or -1 on failure.
+ */
+typedef int (*axcp_batch_sink_t)(void *context, const uint8_t *data, uint32_t length);
+
+/*
+ * Batch of encoded commands that are collected in 'buffer' of 'capacity' bytes and written to 'fd' at once
+ * by axcpBatchFlush(), e.g. to send several actions with a single write().
+ */
+typedef struct {
+	int fd;
+	// Ring the batch is written to instead of 'fd' if not NULL, see shmring.h
+	shm_channel_t *channel;
+	// Function the batch is passed to with 'sinkContext' instead of 'fd' or 'channel' if not NULL. With a
+	// 'capacity' of 0, every piece of an encoded command is passed on directly, i.e. without being copied.
+	axcp_batch_sink_t sink;
+	void *sinkContext;
+	uint8_t *buffer;
+	uint32_t capacity;
+	// Number of bytes and commands in 'buffer'
+	uint32_t length;
+	uint32_t commands;
+	// Number of write() calls and commands written so far
+	uint32_t writes;
+	uint32_t written;
+} axcp_batch_t;
+
+/*
+ * Initializes the empty 'batch' for 'fd' using the caller-owned 'buffer' of 'capacity' bytes. To write it to a
+ * ring or a sink instead, 'channel' or 'sink' is set afterwards.
+ */
+void axcpBatchInit(axcp_batch_t *batch, int fd, uint8_t *buffer, uint32_t capacity);
+
+/*
+ * Like axcpEncodeAndSendv(), but appends the encoded command to 'batch' instead of writing it. If the batch
+ * runs full, it is flushed first; parts that exceed the whole capacity are written directly.
+ * Return: 0 on success, -1 if there was an I/O error and -2 if the command has a fixed payload length which
+ * does not correspond to the given length.
+ */
+int axcpBatchEncodev(axcp_batch_t *batch, const struct iovec *parts, int count);
+
+/*
+ * Writes all commands in 'batch' with a single write() and empties it. Does nothing if it is empty.
+ * Return: 0 on success or -1 if there was an I/O error.
+ */
+int axcpBatchFlush(axcp_batch_t *batch);
+
+/*
+ * Like axcpEncodeAndSendv(), but writes the encoded command to the outgoing ring of 'channel'. Commands of up to
+ * AXCP_RING_ENCODE_SIZE bytes are encoded on the stack and copied to the ring at once.
+ * Return: same as axcpEncodeAndSendv().
+ */
+int axcpEncodeAndWriteRingv(shm_channel_t *channel, const struct iovec *parts, int count);
+
 /*
  * Receives one full enconded command from 'fd', decodes it and saves the plain command (opcode + payload)
  * in an allocated memory whose address and length will be assigned to 'command' and 'length'. Therefore,
@@ -178,6 +451,107 @@ int axcpEncodeAndSend(int fd, uint8_t* command, uint32_t length);
  */
 int axcpReceiveAndDecode(int fd, uint8_t **command, uint32_t *length);
 
+/*
+ * Like axcpReceiveAndDecode(), but saves the plain command in the caller-owned 'command' of 'capacity' bytes
+ * (at least 1) instead of allocating memory. The length of the command is assigned to 'length'. If the
+ * command doesn't fit, the rest of it is read and dropped, so that the stream stays in sync.
+ * Return: 0 on success, -1 if there was an I/O error, -2 if an unknown opcode was received or -3 if the
+ * command was truncated to 'capacity' bytes.
+ */
+int axcpReceiveAndDecodeInto(int fd, uint8_t *command, uint32_t capacity, uint32_t *length);
+
+// Size of the buffer axcpEncodeAndWriteRingv() encodes a command in
+#define AXCP_RING_ENCODE_SIZE 256
+
+// Maximum number of buffers axcpEncodeAndSendv() passes to one writev()
+#define AXCP_MAX_IOV 64
+
+// Number of bytes axcpDecodeAvailable() reads at once
+#define AXCP_READ_BLOCK_SIZE 4096
+
+// States of the incremental AXCP decoder
+#define AXCP_DECODER_OPCODE 0
+#define AXCP_DECODER_FIXED_PAYLOAD 1
+#define AXCP_DECODER_CHUNK_LENGTH 2
+#define AXCP_DECODER_CHUNK 3
+#define AXCP_DECODER_DISCARD 4
+
+// Initial size of an incremental decoder's command buffer; doubled whenever a command doesn't fit
+#define AXCP_DECODER_INITIAL_CAPACITY 256
+
+// Number of heap allocations (malloc() or realloc()) done by the decoding functions so far
+extern uint32_t axcpAllocations;
+
+/*
+ * Callback invoked by the incremental decoder for every complete plain 'command' (opcode + payload) of
+ * 'length' bytes. Unknown opcodes are passed as commands of length 1, i.e. the callback has to check
+ * payloadLength() itself. The command is borrowed from the decoder's buffer and is only valid until the
+ * callback returns, i.e. the callback has to copy whatever it wants to keep and must not free() it.
+ */
+typedef void (*axcp_command_callback_t)(uint8_t *command, uint32_t length);
+
+// Struct that holds the state of an incremental decoder between calls to axcpDecode()
+typedef struct {
+	int state;
+	// Buffer for the command received so far; reused for every command and only grown if a command doesn't fit
+	uint8_t *command;
+	uint32_t capacity;
+	uint32_t length;
+	// Number of bytes that are still missing in the fixed payload or the current chunk
+	uint32_t remaining;
+	// Length of the current chunk; a chunk of 255 bytes is followed by another one
+	uint8_t chunkLength;
+	axcp_command_callback_t callback;
+	// Statistics: number of reads done by axcpDecodeAvailable() and commands decoded
+	uint32_t reads;
+	uint32_t commands;
+	// Statistics: number of bytes dropped while discarding
+	uint32_t discarded;
+} axcp_decoder_t;
+
+/*
+ * Initializes 'decoder' to pass complete commands to 'callback'.
+ */
+void axcpDecoderInit(axcp_decoder_t *decoder, axcp_command_callback_t callback);
+
+/*
+ * Discards a partially received command, so that the next byte fed into 'decoder' is treated as opcode.
+ */
+void axcpDecoderReset(axcp_decoder_t *decoder);
+
+/*
+ * Makes 'decoder' drop every byte fed into it until axcpDecoderReset() is called, e.g. to resynchronize after
+ * an unknown opcode. May be called from within the decoder's callback.
+ */
+void axcpDecoderDiscard(axcp_decoder_t *decoder);
+
+/*
+ * Return: 1 if 'decoder' holds neither a partial command nor is discarding, i.e. the next byte is an opcode,
+ * 0 otherwise.
+ */
+int axcpDecoderIdle(axcp_decoder_t *decoder);
+
+/*
+ * Feeds 'length' encoded bytes from 'data' into 'decoder'. 'data' may hold any part of the byte stream, e.g.
+ * half a command or several commands. Every command completed by these bytes is passed to the decoder's
+ * callback, an incomplete command is kept in 'decoder' until the next call. Never blocks.
+ */
+void axcpDecode(axcp_decoder_t *decoder, const uint8_t *data, uint32_t length);
+
+/*
+ * Reads the bytes available from 'fd' in blocks of AXCP_READ_BLOCK_SIZE and feeds them into 'decoder', i.e. all
+ * commands received completely are handled with as few read() calls as possible. 'fd' must not block on read,
+ * either via O_NONBLOCK or (for a tty) VMIN = VTIME = 0.
+ * Return: the number of bytes read, 0 if 'fd' reached end of file, -1 if there was an I/O error or -2 if
+ * nothing was available.
+ */
+int axcpDecodeAvailable(axcp_decoder_t *decoder, int fd);
+
+/*
+ * The functions for user programs below talk to andrixswc via the shared memory rings if andrixswc set them up
+ * (see shmring.h) and via PROGRAM_OUT_FD and PROGRAM_IN_FD otherwise.
+ */
+
 /*
  * Must be used by user programs when sending a non-blocking AXCP command,
  * i.e. actions, replies, subscriptions and updates. Does not block and uses axcpEncodeAndSend() function.
@@ -187,12 +561,62 @@ int axcpReceiveAndDecode(int fd, uint8_t **command, uint32_t *length);
  */
 int userProgramSend(uint8_t* command, uint32_t length);
 
+/*
+ * Like userProgramSend(), but the command is given as 'count' consecutive 'parts'. See axcpEncodeAndSendv().
+ */
+int userProgramSendv(const struct iovec *parts, int count);
+
+// Size of the buffer userProgramBeginBatch() collects commands in
+#define USER_PROGRAM_BATCH_SIZE 1024
+
+/*
+ * Starts collecting the commands sent by userProgramSend() and userProgramSendv() instead of writing each of
+ * them, until userProgramCommitBatch() writes them at once. A request flushes the collected commands together
+ * with itself, so that the order of commands is kept. A batch that is still open when the program exits is
+ * written then. Does nothing if a batch is already started.
+ * Return: 1 if the batch was started or 0 if one was already started, i.e. the caller mustn't commit it.
+ */
+int userProgramBeginBatch();
+
+/*
+ * Writes the commands collected since userProgramBeginBatch() and stops collecting.
+ * Return: 0 on success or -1 if there was an I/O error.
+ */
+int userProgramCommitBatch();
+
 /*
  * Must be used by user programs when sending a blocking AXCP command,
  * i.e. requests. Does block until the reply was received. Uses axcpEncodeAndSend() for sending the request
  * and axcpReceiveAndDecode() for receiving the reply. See axcpEncodeAndSend() for the parameters 'send' and
  * 'sendLen' and axcpReceiveAndDecode() for the parameters 'answer' and 'answerLen' as the usage is the same.
+ * The request is preceded by a REQUEST_TAG_SWCINTERN carrying a sequence number, which andrixswc sends back
+ * before the reply or ERROR_ACTION answering it. Only the reply tagged with the number of this request is
+ * accepted, so replies to requests that timed out before are dropped.
  * Return: 0 on success, -1 if there was an I/O error, -2 if the command has a fixed payload length which
  * does not correspond to the given length or -3 if an unknown opcode was received.
  */
 int userProgramRequest(uint8_t* send, uint32_t sendLen, uint8_t** answer, uint32_t* answerLen);
+
+/*
+ * Like userProgramRequest(), but receives the reply into the caller-owned 'answer' of 'capacity' bytes via
+ * axcpReceiveAndDecodeInto(), i.e. without any heap allocation. If andrixswc answers with an ERROR_ACTION
+ * instead, e.g. because the hardware controller didn't reply in time, the payload part of 'answer' is zeroed and
+ * the error code is assigned to userProgramErrorCode.
+ * Return: same as userProgramRequest(), -4 if the reply was truncated to 'capacity' bytes or -5 if the request
+ * failed.
+ */
+int userProgramRequestInto(uint8_t* send, uint32_t sendLen, uint8_t* answer, uint32_t capacity, uint32_t* answerLen);
+
+// Error code of the ERROR_ACTION that made the last userProgramRequestInto() or userProgramRequestTimeout()
+// return -5
+extern uint8_t userProgramErrorCode;
+
+/*
+ * Like userProgramRequestInto(), but waits at most 'timeout' milliseconds for the reply; -1 waits infinitely.
+ * If the reply arrives later, it is dropped by the next request, see userProgramRequest().
+ * Return: same as userProgramRequestInto() or -6 if 'timeout' passed without a reply.
+ */
+int userProgramRequestTimeout(uint8_t* send, uint32_t sendLen, uint8_t* answer, uint32_t capacity, uint32_t* answerLen,
+		int timeout);
+
+#endif
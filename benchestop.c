@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Benchmark of the emergency stop of andrixswc, built by "make bench". A UART at UART_BAUD_RATE is simulated in
+ * virtual time, with a backlog of program output, requests and motor actions waiting in the outqueue and the
+ * driver's output queue refilled like uartSendQueued() does. Then the motors and servos are stopped like
+ * emergencyStop() does, once with the multi actions and once with single port actions, and the time until the
+ * last stop command left the line is measured. For comparison, the time a single first-in-first-out queue would
+ * have needed is printed as well.
+ * Return: 0 if both stops took at most ESTOP_BENCH_LIMIT_MS, 1 otherwise.
+ */
+
+#include "andrixswc.h"
+#include "tools.h"
+
+#include <stdio.h>
+
+// Backlog of each class when the stop happens
+#define ESTOP_BENCH_BULK_BYTES 16384
+#define ESTOP_BENCH_REQUESTS 20
+#define ESTOP_BENCH_ACTIONS 40
+// Virtual time the UART runs before the stop, so that a command is written partially, and step of the clock
+#define ESTOP_BENCH_WARMUP_US 3000
+#define ESTOP_BENCH_STEP_US 10
+// What the stop may take at most: the driver's queue, the burst itself and one bulk command in between
+#define ESTOP_BENCH_LIMIT_MS (UART_QUEUE_MS + 10)
+
+// Simulated UART: bytes in the driver's output queue and bytes the line sends per microsecond
+static double driverQueued = 0;
+static double lineBytesPerMicro = UART_BAUD_RATE / 10 / 1000000.0;
+static int driverQueueBytes;
+static int devNull;
+
+// Same as uartMotion() in andrixswc.c
+static int benchMotion(uint8_t opcode) {
+	return (opcode >= MOTOR_POWER_ACTION && opcode <= MOTOR_MULTI_ACTION) ||
+		(opcode >= SERVO_ONOFF_ACTION && opcode <= SERVO_MULTI_ACTION);
+}
+
+static void push(int priority, uint8_t *command, uint32_t length) {
+	struct iovec part;
+	part.iov_base = command;
+	part.iov_len = length;
+	if(outqueuePushv(priority, &part, 1) != 0)
+		printf("Can't queue opcode %d\n", command[0]);
+}
+
+// Advances the simulated UART by ESTOP_BENCH_STEP_US, refilling the driver's queue once half of it was sent
+static void step() {
+	driverQueued -= lineBytesPerMicro * ESTOP_BENCH_STEP_US;
+	if(driverQueued < 0)
+		driverQueued = 0;
+	if(driverQueued <= driverQueueBytes / 2 && outqueueLength() > 0)
+		driverQueued += outqueueSend(devNull, driverQueueBytes - (int) driverQueued);
+}
+
+// Fills the outqueue with the backlog of a busy program, lets the UART run and then stops like emergencyStop()
+// Return: the time in milliseconds until the stop commands left the line
+static double benchStop(int multi) {
+	uint8_t send[UART_BULK_PIECE_BYTES + 35];
+	uint32_t i;
+	int port;
+
+	// Program output in pieces like printoutFlush() sends them, requests and motor actions of a busy program
+	memset(send, 'x', sizeof(send));
+	send[0] = EXECUTION_PRINTOUT_ACTION;
+	for(i=0; i<ESTOP_BENCH_BULK_BYTES; i+=sizeof(send))
+		push(OUTQUEUE_BULK, send, sizeof(send));
+	for(i=0; i<ESTOP_BENCH_REQUESTS; i++)
+		push(OUTQUEUE_NORMAL, send, axcpBuildPortCommand(send, ANALOG_SENSOR_REQUEST, i % 16));
+	for(i=0; i<ESTOP_BENCH_ACTIONS; i++) {
+		send[0] = MOTOR_POWER_ACTION;
+		send[1] = i % 4;
+		send[2] = 0;
+		send[3] = 100;
+		push(OUTQUEUE_CONTROL, send, 4);
+	}
+	send[0] = DIGITAL_OUTPUT_LEVEL_ACTION;
+	send[1] = 0;
+	send[2] = 1;
+	push(OUTQUEUE_CONTROL, send, 3);
+
+	uint64_t now;
+	for(now=0; now<ESTOP_BENCH_WARMUP_US; now+=ESTOP_BENCH_STEP_US)
+		step();
+	uint32_t backlog = outqueueLength() + (uint32_t) driverQueued;
+
+	// The stop itself, as in emergencyStop() and queueStop()
+	static const uint8_t off[ESTOP_PORTS] = {0};
+	uint8_t ports = (1 << ESTOP_PORTS) - 1;
+	uint64_t burst = outqueueQueuedBytes(OUTQUEUE_CONTROL);
+	uint64_t cpu = timeMicros();
+	uint32_t dropped = outqueueDrop(OUTQUEUE_CONTROL, benchMotion);
+	if(multi) {
+		push(OUTQUEUE_CONTROL, send, axcpBuildMultiAction(send, MOTOR_MULTI_ACTION, MOTOR_OFF_ACTION, ports, NULL));
+		push(OUTQUEUE_CONTROL, send, axcpBuildMultiAction(send, SERVO_MULTI_ACTION, SERVO_ONOFF_ACTION, ports, off));
+	} else {
+		for(port=0; port<ESTOP_PORTS; port++) {
+			push(OUTQUEUE_CONTROL, send, axcpBuildPortCommand(send, MOTOR_OFF_ACTION, port));
+			push(OUTQUEUE_CONTROL, send, axcpBuildPortValueCommand(send, SERVO_ONOFF_ACTION, port, 0));
+		}
+	}
+	uint64_t target = outqueueQueuedBytes(OUTQUEUE_CONTROL);
+	cpu = timeMicros() - cpu;
+	burst = target - burst;
+
+	// Until the stop commands are in the driver's queue, then until the line sent them
+	uint64_t started = now;
+	while(outqueueWrittenBytes(OUTQUEUE_CONTROL) < target) {
+		step();
+		now += ESTOP_BENCH_STEP_US;
+	}
+	double latency = (now - started + driverQueued / lineBytesPerMicro) / 1000.0;
+	// A single queue would have sent the whole backlog first
+	double fifo = (backlog + burst) / lineBytesPerMicro / 1000.0;
+	printf("estop %s: %u bytes waiting, %u motor actions dropped, %llu bytes of stop commands queued in %llu us\n",
+		multi ? "multi" : "single", backlog, dropped, (unsigned long long) burst, (unsigned long long) cpu);
+	printf("estop %s: stopped after %.1f ms on the line, a single queue would take %.1f ms\n",
+		multi ? "multi" : "single", latency, fifo);
+
+	// The rest of the backlog leaves the line before the next stop
+	while(outqueueLength() > 0 || driverQueued > 0)
+		step();
+	return latency;
+}
+
+int main() {
+	devNull = open("/dev/null", O_WRONLY);
+	driverQueueBytes = UART_BAUD_RATE / 10000 * UART_QUEUE_MS;
+	if(driverQueueBytes < UART_QUEUE_MIN_BYTES)
+		driverQueueBytes = UART_QUEUE_MIN_BYTES;
+
+	double multi = benchStop(1);
+	double single = benchStop(0);
+	return multi > ESTOP_BENCH_LIMIT_MS || single > ESTOP_BENCH_LIMIT_MS;
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmark of the event loop of andrixswc, built by "make bench":
+ * - decoder: commands per second axcpDecode() handles when the stream arrives in pieces of the size UART reads
+ *   return, and whether every command comes out as it went in
+ * - wakeup: time from a write to a pipe until the reactor invokes the callback
+ * - idle: CPU time the reactor uses while nothing happens, which was 100% with the old polling loop
+ * Return: 0 if all commands were decoded correctly and all writes were noticed, 1 otherwise.
+ */
+
+#include "axcp.h"
+#include "reactor.h"
+#include "tools.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define BENCH_COMMANDS 300000
+#define BENCH_STREAM_SIZE (BENCH_COMMANDS * 12)
+#define BENCH_WAKEUPS 1000
+#define BENCH_IDLE_MS 500
+
+static uint8_t stream[BENCH_STREAM_SIZE];
+static uint32_t streamLength = 0;
+static uint32_t decoded = 0;
+static uint32_t corrupt = 0;
+
+static uint64_t wakeupTotal = 0;
+static uint64_t wakeupMax = 0;
+static int wakeups = 0;
+
+// Appends the encoded plain 'command' of 'length' bytes to the stream
+// Return: 0 on success or -1 if the stream is full
+static int streamAppend(const uint8_t *command, uint32_t length) {
+	// Opcode, at most 3 chunk length bytes and the payload
+	if(streamLength + length + 3 > sizeof(stream))
+		return -1;
+	stream[streamLength++] = command[0];
+	if(payloadLength(command[0]) != -1) {
+		memcpy(stream + streamLength, command + 1, length - 1);
+		streamLength += length - 1;
+		return 0;
+	}
+	uint32_t offset = 1, chunk;
+	// A chunk of 255 bytes is followed by another one
+	do {
+		chunk = length - offset < 255 ? length - offset : 255;
+		stream[streamLength++] = chunk;
+		memcpy(stream + streamLength, command + offset, chunk);
+		streamLength += chunk;
+		offset += chunk;
+	} while(chunk == 255);
+	return 0;
+}
+
+// Builds the 'i'th command of the stream into 'command'
+// Return: its length
+static uint32_t buildCommand(uint32_t i, uint8_t *command) {
+	switch(i % 4) {
+	case 0:
+		command[0] = MOTOR_POWER_ACTION;
+		command[1] = i % 4;
+		command[2] = (i >> 8) & 0xFF;
+		command[3] = i & 0xFF;
+		return 4;
+	case 1:
+		command[0] = ANALOG_SENSOR_REPLY;
+		command[1] = i % 16;
+		command[2] = (i >> 8) & 0xFF;
+		command[3] = i & 0xFF;
+		return 4;
+	case 2:
+		command[0] = DIGITAL_SENSOR_REQUEST;
+		command[1] = i % 16;
+		return 2;
+	default:
+		// Variable payload length, with a chunk of 255 bytes every now and then
+		command[0] = SEND_CUSTOM_DATA_ACTION_SWCINTERN;
+		memset(command + 1, i & 0xFF, 7);
+		return i % 400 == 3 ? 1 + 300 : 1 + 7;
+	}
+}
+
+static void commandDecoded(uint8_t *command, uint32_t length) {
+	uint8_t expected[1 + 300];
+	uint32_t expectedLength = buildCommand(decoded, expected);
+	// The payload of long commands isn't checked beyond the first bytes
+	if(length != expectedLength || memcmp(command, expected, length < 8 ? length : 8) != 0)
+		corrupt++;
+	decoded++;
+}
+
+static void benchDecoder() {
+	axcp_decoder_t decoder;
+	uint8_t command[1 + 300];
+	uint32_t i, offset, piece;
+
+	for(i=0; i<BENCH_COMMANDS; i++)
+		if(streamAppend(command, buildCommand(i, command)) == -1)
+			break;
+
+	axcpDecoderInit(&decoder, commandDecoded);
+	uint64_t start = timeMicros();
+	// Pieces of 1 to 64 bytes, like read() returns them from the UART
+	for(offset=0, piece=1; offset<streamLength; offset+=piece, piece=piece % 64 + 1) {
+		if(piece > streamLength - offset)
+			piece = streamLength - offset;
+		axcpDecode(&decoder, stream + offset, piece);
+	}
+	uint64_t took = timeMicros() - start;
+	printf("decoder: %u commands, %u bytes in %llu us, %.1f ns per command, %u corrupt\n", decoded, streamLength,
+		(unsigned long long) took, took * 1000.0 / (decoded > 0 ? decoded : 1), corrupt);
+	if(decoded != i)
+		corrupt++;
+}
+
+static void wakeupReadable(int fd, uint32_t events) {
+	(void) events;
+	uint64_t sent;
+	if(fullRead(fd, (uint8_t*) &sent, sizeof(sent)) == -1)
+		return;
+	uint64_t latency = timeMicros() - sent;
+	wakeupTotal += latency;
+	if(latency > wakeupMax)
+		wakeupMax = latency;
+	wakeups++;
+}
+
+static void benchWakeup() {
+	int fds[2];
+	if(pipe(fds) == -1)
+		return;
+	pid_t pid = fork();
+	if(pid == 0) {
+		int i;
+		close(fds[0]);
+		for(i=0; i<BENCH_WAKEUPS; i++) {
+			usleep(1000);
+			uint64_t now = timeMicros();
+			fullWrite(fds[1], (uint8_t*) &now, sizeof(now));
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	reactorAdd(fds[0], wakeupReadable);
+	while(wakeups < BENCH_WAKEUPS)
+		if(reactorDispatch(1000) <= 0)
+			break;
+	reactorRemove(fds[0]);
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+	printf("wakeup: %d writes, %.1f us on average, %llu us at most\n", wakeups,
+		(double) wakeupTotal / (wakeups > 0 ? wakeups : 1), (unsigned long long) wakeupMax);
+}
+
+static int idleDone = 0;
+
+static void idleTimeout(int fd, uint32_t events) {
+	(void) fd;
+	(void) events;
+	idleDone = 1;
+}
+
+// Return: the CPU time used by the process so far in microseconds
+static uint64_t cpuMicros() {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL + usage.ru_utime.tv_usec +
+		usage.ru_stime.tv_usec;
+}
+
+static void benchIdle() {
+	int timer = reactorCreateTimer(idleTimeout);
+	uint64_t cpu = cpuMicros();
+	reactorArmTimer(timer, BENCH_IDLE_MS);
+	while(!idleDone)
+		if(reactorDispatch(-1) == -1)
+			break;
+	printf("idle: %llu us of CPU time in %d ms\n", (unsigned long long) (cpuMicros() - cpu), BENCH_IDLE_MS);
+}
+
+int main() {
+	if(reactorInit() == -1) {
+		printf("Can't create the reactor\n");
+		return 1;
+	}
+	benchDecoder();
+	benchWakeup();
+	benchIdle();
+	return corrupt > 0 || wakeups < BENCH_WAKEUPS;
+}
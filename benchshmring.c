@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Benchmark of the shared memory rings between andrixswc and user programs, built by "make bench". A child
+ * process plays andrixswc and answers every request of the parent with a reply, once through the rings and once
+ * through a pair of pipes, which programs fall back to without the rings. Like andrixswc, the child waits for
+ * requests in poll(). Prints the round trip times and how often the sides had to signal each other.
+ * Return: 0 if every reply arrived intact, 1 otherwise.
+ */
+
+#include "shmring.h"
+#include "axcp.h"
+#include "tools.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+
+#define SHMRING_BENCH_ROUNDS 20000
+
+static uint32_t roundTrips[SHMRING_BENCH_ROUNDS];
+static int failures = 0;
+
+static int compareRoundTrips(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+// Reads exactly 'length' bytes from 'channel' if not NULL or from 'fd' otherwise
+static int benchRead(shm_channel_t *channel, int fd, uint8_t *buffer, uint32_t length) {
+	if(channel != NULL)
+		return shmChannelRead(channel, buffer, length);
+	return fullRead(fd, buffer, length);
+}
+
+// Writes 'length' bytes of 'buffer' to 'channel' if not NULL or to 'fd' otherwise
+static int benchWrite(shm_channel_t *channel, int fd, uint8_t *buffer, uint32_t length) {
+	struct iovec part;
+	if(channel == NULL)
+		return fullWrite(fd, buffer, length);
+	part.iov_base = buffer;
+	part.iov_len = length;
+	return shmChannelWritev(channel, &part, 1);
+}
+
+// Sleeps in poll() until a request arrives, like andrixswc's reactor does, see uprog_ring_readable()
+static int benchWait(shm_channel_t *channel, int fd) {
+	struct pollfd ready;
+	ready.fd = channel != NULL ? channel->wakeFd : fd;
+	ready.events = POLLIN;
+	if(channel == NULL)
+		return poll(&ready, 1, -1) == -1 ? -1 : 0;
+	while(shmChannelIdle(channel)) {
+		eventfd_t count;
+		if(poll(&ready, 1, -1) == -1)
+			return -1;
+		eventfd_read(channel->wakeFd, &count);
+	}
+	return 0;
+}
+
+// andrixswc: answers every ANALOG_SENSOR_REQUEST with an ANALOG_SENSOR_REPLY carrying the round
+static void answerRequests(shm_channel_t *channel, int in, int out) {
+	uint8_t request[2], reply[4];
+	int i;
+	for(i=0; i<SHMRING_BENCH_ROUNDS; i++) {
+		if(benchWait(channel, in) == -1 || benchRead(channel, in, request, 2) == -1)
+			break;
+		reply[0] = ANALOG_SENSOR_REPLY;
+		reply[1] = request[1];
+		reply[2] = (i >> 8) & 0xFF;
+		reply[3] = i & 0xFF;
+		if(benchWrite(channel, out, reply, 4) == -1)
+			break;
+	}
+}
+
+// Sends the requests and prints the round trip times for 'transport'
+static void sendRequests(const char *transport, shm_channel_t *channel, int in, int out) {
+	uint8_t request[2], reply[4];
+	int i;
+	for(i=0; i<SHMRING_BENCH_ROUNDS; i++) {
+		request[0] = ANALOG_SENSOR_REQUEST;
+		request[1] = i % 16;
+		uint64_t start = timeMicros();
+		if(benchWrite(channel, out, request, 2) == -1 || benchRead(channel, in, reply, 4) == -1) {
+			printf("%s: transport failed after %d round trips\n", transport, i);
+			failures++;
+			return;
+		}
+		roundTrips[i] = timeMicros() - start;
+		if(reply[0] != ANALOG_SENSOR_REPLY || reply[1] != i % 16 || ((reply[2] << 8) | reply[3]) != (i & 0xFFFF))
+			failures++;
+	}
+	qsort(roundTrips, SHMRING_BENCH_ROUNDS, sizeof(uint32_t), compareRoundTrips);
+	uint64_t total = 0;
+	for(i=0; i<SHMRING_BENCH_ROUNDS; i++)
+		total += roundTrips[i];
+	printf("%s: %d round trips, %.1f us on average, median %u us, 99%% within %u us\n", transport,
+		SHMRING_BENCH_ROUNDS, (double) total / SHMRING_BENCH_ROUNDS, roundTrips[SHMRING_BENCH_ROUNDS / 2],
+		roundTrips[SHMRING_BENCH_ROUNDS * 99 / 100]);
+}
+
+static void benchRings() {
+	shm_channel_t channel;
+	int regionFd;
+	if(shmChannelCreate(&channel, &regionFd) == -1) {
+		printf("rings: can't create the region\n");
+		failures++;
+		return;
+	}
+	pid_t pid = fork();
+	if(pid == 0) {
+		// Set up like a program's end, see executeProgram(). The roles don't matter to the rings.
+		shm_channel_t program;
+		if(dup2(regionFd, PROGRAM_RING_FD) == -1 || dup2(channel.notifyFd, PROGRAM_RING_WAKE_FD) == -1 ||
+				dup2(channel.wakeFd, PROGRAM_RING_NOTIFY_FD) == -1 || shmChannelOpen(&program, -1) == -1)
+			_exit(1);
+		answerRequests(&program, -1, -1);
+		_exit(0);
+	}
+	close(regionFd);
+	sendRequests("rings", &channel, -1, -1);
+	waitpid(pid, NULL, 0);
+	printf("rings: %u signals sent, slept %u times\n", channel.notifications, channel.sleeps);
+	shmChannelClose(&channel);
+}
+
+static void benchPipes() {
+	int toProgram[2], fromProgram[2];
+	if(pipe(toProgram) == -1 || pipe(fromProgram) == -1)
+		return;
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(toProgram[1]);
+		close(fromProgram[0]);
+		answerRequests(NULL, toProgram[0], fromProgram[1]);
+		_exit(0);
+	}
+	close(toProgram[0]);
+	close(fromProgram[1]);
+	sendRequests("pipes", NULL, fromProgram[0], toProgram[1]);
+	close(toProgram[1]);
+	close(fromProgram[0]);
+	waitpid(pid, NULL, 0);
+}
+
+int main() {
+	benchRings();
+	benchPipes();
+	return failures > 0;
+}
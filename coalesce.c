@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "coalesce.h"
+#include "axcp.h"
+
+// Actuators whose actions are coalesced; power and velocity of a motor share the motor's slot
+#define COALESCE_MOTOR 0
+#define COALESCE_SERVO 1
+#define COALESCE_ACTUATORS 2
+
+// One stored action
+typedef struct {
+	uint8_t command[COALESCE_MAX_ACTION_LENGTH];
+	uint32_t length;
+} coalesce_slot_t;
+
+static coalesce_slot_t slots[COALESCE_ACTUATORS][COALESCE_MAX_PORTS];
+static uint32_t stored = 0;
+
+uint32_t coalesceReplaced = 0;
+
+// Return: the slot for the action 'command' or NULL if it can't be coalesced
+static coalesce_slot_t *coalesceSlot(const uint8_t *command, uint32_t length) {
+	if(length < 2 || length > COALESCE_MAX_ACTION_LENGTH || command[1] >= COALESCE_MAX_PORTS)
+		return NULL;
+	switch(command[0]) {
+	case MOTOR_POWER_ACTION:
+	case MOTOR_VELOCITY_ACTION:
+		return &slots[COALESCE_MOTOR][command[1]];
+	case SERVO_DRIVE_ACTION:
+		return &slots[COALESCE_SERVO][command[1]];
+	default:
+		return NULL;
+	}
+}
+
+int coalesceStore(const uint8_t *command, uint32_t length) {
+	coalesce_slot_t *slot = coalesceSlot(command, length);
+	if(slot == NULL)
+		return 0;
+	if(slot->length > 0)
+		coalesceReplaced++;
+	else
+		stored++;
+	memcpy(slot->command, command, length);
+	slot->length = length;
+	return 1;
+}
+
+uint32_t coalesceFlush(coalesce_write_t write) {
+	uint32_t flushed = 0;
+	int actuator, port;
+	for(actuator=0; actuator<COALESCE_ACTUATORS && stored > 0; actuator++) {
+		for(port=0; port<COALESCE_MAX_PORTS; port++) {
+			coalesce_slot_t *slot = &slots[actuator][port];
+			if(slot->length == 0)
+				continue;
+			write(slot->command, slot->length);
+			slot->length = 0;
+			stored--;
+			flushed++;
+		}
+	}
+	return flushed;
+}
+
+uint32_t coalesceCount() {
+	return stored;
+}
+
+void coalesceClear() {
+	int actuator, port;
+	for(actuator=0; actuator<COALESCE_ACTUATORS; actuator++)
+		for(port=0; port<COALESCE_MAX_PORTS; port++)
+			slots[actuator][port].length = 0;
+	stored = 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Last-writer-wins slots for actuator actions on their way to the hardware controller. An action that sets a
+ * motor's power or velocity or a servo's position replaces the not yet sent action for the same actuator, so
+ * that a program updating an actuator faster than the UART can carry the commands doesn't build up a backlog of
+ * stale values, and only the newest one is sent at the next opportunity. Only such set points are coalesced:
+ * digital output levels are not, as a pulse, i.e. high and low in short succession, must reach the pin.
+ */
+
+#include <inttypes.h>
+
+// Highest number of ports (exclusive) of a coalesced action
+#define COALESCE_MAX_PORTS 16
+// Maximum length of a coalesced action (opcode + payload)
+#define COALESCE_MAX_ACTION_LENGTH 4
+
+/*
+ * Callback used by coalesceFlush() to send the action 'command' of 'length' bytes.
+ */
+typedef void (*coalesce_write_t)(uint8_t *command, uint32_t length);
+
+// Number of actions that were replaced by a newer one before they were sent
+extern uint32_t coalesceReplaced;
+
+/*
+ * Stores the action 'command' of 'length' bytes in the slot of its actuator, replacing an older action that
+ * wasn't sent yet.
+ * Return: 1 if the action was stored or 0 if it can't be coalesced, i.e. has to be sent as is.
+ */
+int coalesceStore(const uint8_t *command, uint32_t length);
+
+/*
+ * Passes every stored action to 'write' and empties the slots.
+ * Return: the number of actions passed.
+ */
+uint32_t coalesceFlush(coalesce_write_t write);
+
+/*
+ * Return: the number of stored actions.
+ */
+uint32_t coalesceCount();
+
+/*
+ * Drops all stored actions without sending them.
+ */
+void coalesceClear();
@@ -0,0 +1,217 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mirror.h"
+#include "axcp.h"
+
+// One mirrored reply
+typedef struct {
+	uint8_t reply[MIRROR_MAX_REPLY_LENGTH];
+	uint32_t length;
+	uint64_t receivedAt;
+} mirror_entry_t;
+
+// Mirrored replies without port use slot 0
+static mirror_entry_t analogValues[MIRROR_MAX_PORTS];
+static mirror_entry_t digitalValues[MIRROR_MAX_PORTS];
+static mirror_entry_t motorPositions[MIRROR_MAX_PORTS];
+static mirror_entry_t motorVelocities[MIRROR_MAX_PORTS];
+static mirror_entry_t controllerBatteryCharge;
+static mirror_entry_t controllerBatteryChargingState;
+static mirror_entry_t phoneBatteryCharge;
+static mirror_entry_t phoneBatteryChargingState;
+
+// Shared state region every change is published to, if any
+static shared_state_t *published = NULL;
+
+// Return: the entry for 'replyOpcode' and 'port' or NULL if the reply is not mirrored
+static mirror_entry_t *mirrorEntry(uint8_t replyOpcode, int port) {
+	switch(replyOpcode) {
+	case ANALOG_SENSOR_REPLY:
+	case DIGITAL_SENSOR_REPLY:
+	case MOTOR_POSITION_REPLY:
+	case MOTOR_VELOCITY_REPLY:
+		if(port < 0 || port >= MIRROR_MAX_PORTS)
+			return NULL;
+		if(replyOpcode == ANALOG_SENSOR_REPLY)
+			return &analogValues[port];
+		if(replyOpcode == DIGITAL_SENSOR_REPLY)
+			return &digitalValues[port];
+		if(replyOpcode == MOTOR_POSITION_REPLY)
+			return &motorPositions[port];
+		return &motorVelocities[port];
+	case CONTROLLER_BATTERY_CHARGE_REPLY: return &controllerBatteryCharge;
+	case CONTROLLER_BATTERY_CHARGING_STATE_REPLY: return &controllerBatteryChargingState;
+	case PHONE_BATTERY_CHARGE_REPLY: return &phoneBatteryCharge;
+	case PHONE_BATTERY_CHARGING_STATE_REPLY: return &phoneBatteryChargingState;
+	default: return NULL;
+	}
+}
+
+// Writes the value of the plain 'reply' for 'port' to the shared state region. An 'updatedAt' of 0 marks it unknown.
+static void mirrorPublishReply(const uint8_t *reply, int port, uint64_t updatedAt) {
+	if(published == NULL)
+		return;
+	if(port < 0)
+		port = 0;
+	uint8_t direction;
+	switch(reply[0]) {
+	case ANALOG_SENSOR_REPLY:
+		sharedStateWrite(published, SHARED_STATE_ANALOG, port, axcpParseAnalogReply(reply), updatedAt);
+		break;
+	case DIGITAL_SENSOR_REPLY:
+		sharedStateWrite(published, SHARED_STATE_DIGITAL, port, axcpParseDigitalReply(reply), updatedAt);
+		break;
+	case MOTOR_POSITION_REPLY:
+		sharedStateWrite(published, SHARED_STATE_MOTOR_POSITION, port, axcpParseMotorPositionReply(reply), updatedAt);
+		break;
+	case MOTOR_VELOCITY_REPLY: {
+		int32_t velocity = axcpParseMotorVelocityReply(reply, &direction);
+		sharedStateWrite(published, SHARED_STATE_MOTOR_VELOCITY, port, direction == 0 ? velocity : -velocity,
+			updatedAt);
+		break;
+	} case CONTROLLER_BATTERY_CHARGE_REPLY:
+		sharedStateWrite(published, SHARED_STATE_CONTROLLER_BATTERY_CHARGE, 0, reply[1], updatedAt);
+		break;
+	case CONTROLLER_BATTERY_CHARGING_STATE_REPLY:
+		sharedStateWrite(published, SHARED_STATE_CONTROLLER_BATTERY_CHARGING_STATE, 0, reply[1], updatedAt);
+		break;
+	case PHONE_BATTERY_CHARGE_REPLY:
+		sharedStateWrite(published, SHARED_STATE_PHONE_BATTERY_CHARGE, 0, reply[1], updatedAt);
+		break;
+	case PHONE_BATTERY_CHARGING_STATE_REPLY:
+		sharedStateWrite(published, SHARED_STATE_PHONE_BATTERY_CHARGING_STATE, 0, reply[1], updatedAt);
+		break;
+	}
+}
+
+// Stores the single port replies contained in the bulk 'reply' received at time 'now'
+static void mirrorStoreAll(const uint8_t *reply, uint64_t now) {
+	uint8_t single[MIRROR_MAX_REPLY_LENGTH];
+	int values[AXCP_SENSOR_PORTS];
+	uint16_t mask = 0;
+	int port;
+	if(reply[0] == ANALOG_SENSOR_ALL_REPLY)
+		axcpParseAnalogAllReply(reply, values);
+	else
+		mask = axcpParseDigitalAllReply(reply);
+	for(port=0; port<AXCP_SENSOR_PORTS && port<MIRROR_MAX_PORTS; port++) {
+		if(reply[0] == ANALOG_SENSOR_ALL_REPLY) {
+			single[0] = ANALOG_SENSOR_REPLY;
+			single[1] = port;
+			single[2] = values[port] >> 8;
+			single[3] = values[port] & 0xFF;
+			mirrorStore(single, 4, port, now);
+		} else {
+			single[0] = DIGITAL_SENSOR_REPLY;
+			single[1] = port;
+			single[2] = (mask >> port) & 1;
+			mirrorStore(single, 3, port, now);
+		}
+	}
+}
+
+// Assembles the bulk reply with 'replyOpcode' from the single port replies, see mirrorLookup()
+static uint32_t mirrorLookupAll(uint8_t replyOpcode, uint64_t now, int maxAge, uint8_t *reply) {
+	mirror_entry_t *entries = replyOpcode == ANALOG_SENSOR_ALL_REPLY ? analogValues : digitalValues;
+	int values[AXCP_SENSOR_PORTS];
+	uint16_t mask = 0;
+	int port;
+	for(port=0; port<AXCP_SENSOR_PORTS; port++) {
+		mirror_entry_t *entry = &entries[port];
+		if(port >= MIRROR_MAX_PORTS || entry->length == 0 || now - entry->receivedAt > (uint64_t) maxAge)
+			return 0;
+		if(replyOpcode == ANALOG_SENSOR_ALL_REPLY)
+			values[port] = axcpParseAnalogReply(entry->reply);
+		else if(axcpParseDigitalReply(entry->reply))
+			mask |= 1 << port;
+	}
+	if(replyOpcode == ANALOG_SENSOR_ALL_REPLY)
+		return axcpBuildAnalogAllReply(reply, values);
+	return axcpBuildDigitalAllReply(reply, mask);
+}
+
+void mirrorStore(const uint8_t *reply, uint32_t length, int port, uint64_t now) {
+	if(reply[0] == ANALOG_SENSOR_ALL_REPLY || reply[0] == DIGITAL_SENSOR_ALL_REPLY) {
+		mirrorStoreAll(reply, now);
+		return;
+	}
+	mirror_entry_t *entry = mirrorEntry(reply[0], port);
+	if(entry == NULL || length > MIRROR_MAX_REPLY_LENGTH)
+		return;
+	memcpy(entry->reply, reply, length);
+	entry->length = length;
+	entry->receivedAt = now;
+	mirrorPublishReply(reply, port, now);
+}
+
+void mirrorStoreUpdate(uint8_t replyOpcode, const uint8_t *records, uint32_t length, uint64_t now) {
+	uint8_t reply[MIRROR_MAX_REPLY_LENGTH];
+	uint32_t recordLength = payloadLength(replyOpcode);
+	if(recordLength == 0 || recordLength + 1 > MIRROR_MAX_REPLY_LENGTH)
+		return;
+	// The records are only taken if they fill the update exactly, anything else isn't the expected layout
+	if(length % recordLength != 0)
+		return;
+	reply[0] = replyOpcode;
+	uint32_t i;
+	for(i=0; i + recordLength <= length; i += recordLength) {
+		memcpy(reply + 1, records + i, recordLength);
+		mirrorStore(reply, recordLength + 1, records[i], now);
+	}
+}
+
+uint32_t mirrorLookup(uint8_t replyOpcode, int port, uint64_t now, int maxAge, uint8_t *reply) {
+	if(replyOpcode == ANALOG_SENSOR_ALL_REPLY || replyOpcode == DIGITAL_SENSOR_ALL_REPLY)
+		return mirrorLookupAll(replyOpcode, now, maxAge, reply);
+	mirror_entry_t *entry = mirrorEntry(replyOpcode, port);
+	if(entry == NULL || entry->length == 0 || now - entry->receivedAt > (uint64_t) maxAge)
+		return 0;
+	memcpy(reply, entry->reply, entry->length);
+	return entry->length;
+}
+
+void mirrorInvalidate(uint8_t replyOpcode, int port) {
+	mirror_entry_t *entry = mirrorEntry(replyOpcode, port);
+	if(entry != NULL && entry->length > 0) {
+		entry->length = 0;
+		mirrorPublishReply(entry->reply, port, 0);
+	}
+}
+
+void mirrorClear() {
+	int i;
+	for(i=0; i<MIRROR_MAX_PORTS; i++) {
+		analogValues[i].length = 0;
+		digitalValues[i].length = 0;
+		motorPositions[i].length = 0;
+		motorVelocities[i].length = 0;
+	}
+	controllerBatteryCharge.length = 0;
+	controllerBatteryChargingState.length = 0;
+	phoneBatteryCharge.length = 0;
+	phoneBatteryChargingState.length = 0;
+	if(published != NULL)
+		sharedStateClear(published);
+}
+
+void mirrorPublish(shared_state_t *state) {
+	published = state;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Mirror of the latest state reported by the hardware controller, i.e. sensor values, motor positions and
+ * velocities and battery states. Each value is stored as the plain reply command that carried it, together
+ * with the time it was received, so that a request can be answered locally with a byte-identical reply as
+ * long as the value is recent enough. Every change is also published to a shared state region, see
+ * sharedstate.h.
+ */
+
+#include <inttypes.h>
+#include "sharedstate.h"
+
+// Highest number of ports (exclusive) of a mirrored value
+#define MIRROR_MAX_PORTS 16
+// Maximum length of a mirrored reply (opcode + payload), i.e. of ANALOG_SENSOR_ALL_REPLY
+#define MIRROR_MAX_REPLY_LENGTH 21
+
+/*
+ * Stores the plain 'reply' of 'length' bytes received at time 'now' (see timeMillis()) for 'port', which is
+ * PENDING_NO_PORT for replies that don't carry one. Replies that are not mirrored are ignored. The bulk replies
+ * ANALOG_SENSOR_ALL_REPLY and DIGITAL_SENSOR_ALL_REPLY are stored as the single port replies they contain.
+ */
+void mirrorStore(const uint8_t *reply, uint32_t length, int port, uint64_t now);
+
+/*
+ * Stores the 'length' bytes of 'records' from an update command received at time 'now'. An update carries the
+ * payloads of one or more replies with 'replyOpcode' back to back, each starting with its port, e.g. the
+ * payload of ANALOG_SENSOR_UPDATE is a sequence of ANALOG_SENSOR_REPLY payloads. An update that isn't made up of
+ * whole records is ignored completely, as is a record for a port that is not mirrored.
+ */
+void mirrorStoreUpdate(uint8_t replyOpcode, const uint8_t *records, uint32_t length, uint64_t now);
+
+/*
+ * Copies the mirrored reply with 'replyOpcode' for 'port' into 'reply', which must hold at least
+ * MIRROR_MAX_REPLY_LENGTH bytes, if it was received at most 'maxAge' milliseconds before 'now'. A bulk reply
+ * is assembled from the single port replies if all of them are recent enough.
+ * Return: the length of the reply or 0 if there is no recent enough value.
+ */
+uint32_t mirrorLookup(uint8_t replyOpcode, int port, uint64_t now, int maxAge, uint8_t *reply);
+
+/*
+ * Drops the mirrored reply with 'replyOpcode' for 'port', e.g. because the value was changed by an action.
+ */
+void mirrorInvalidate(uint8_t replyOpcode, int port);
+
+/*
+ * Drops all mirrored values, e.g. because the hardware controller was reset.
+ */
+void mirrorClear();
+
+/*
+ * Publishes every change of the mirror to 'state' from now on; NULL stops publishing.
+ */
+void mirrorPublish(shared_state_t *state);
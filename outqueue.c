@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "outqueue.h"
+#include "axcp.h"
+#include "ringbuffer.h"
+
+#include <errno.h>
+
+// Commands queued in one class
+typedef struct {
+	// The encoded commands back to back, and the length of each of them as uint32_t
+	ringbuffer_handler_t *bytes;
+	ringbuffer_handler_t *lengths;
+	// Number of bytes of the first command written so far
+	uint32_t headWritten;
+} outqueue_class_t;
+
+static outqueue_class_t classes[OUTQUEUE_CLASSES];
+// Class whose first command was written partially, or -1
+static int current = -1;
+static uint32_t queued = 0;
+// Bytes ever queued and written or dropped per class
+static uint64_t queuedBytes[OUTQUEUE_CLASSES];
+static uint64_t writtenBytes[OUTQUEUE_CLASSES];
+
+uint32_t outqueueWrites = 0;
+uint32_t outqueueCommands = 0;
+
+// Return: the number of bytes queued in 'priority' class
+static uint32_t outqueueAvailable(int priority) {
+	return classes[priority].bytes != NULL ? (uint32_t) availableFIFO(classes[priority].bytes) : 0;
+}
+
+// Return: the length of the first command in 'priority' class, which must not be empty
+static uint32_t outqueueHeadLength(int priority) {
+	uint32_t length;
+	peekFIFOBytes((uint8_t*) &length, sizeof(length), classes[priority].lengths);
+	return length;
+}
+
+// Appends encoded bytes to the class passed as 'context', see axcp_batch_sink_t
+static int outqueueAppend(void *context, const uint8_t *data, uint32_t length) {
+	return appendFIFOBytes(data, length, ((outqueue_class_t*) context)->bytes) == (int) length ? 0 : -1;
+}
+
+int outqueuePushv(int priority, const struct iovec *parts, int count) {
+	outqueue_class_t *queue = &classes[priority];
+	int length = axcpEncodedLength(parts, count);
+	if(length <= 0)
+		return length;
+	if(queue->bytes == NULL) {
+		queue->bytes = createGrowableFIFO(OUTQUEUE_INITIAL_BYTES, OUTQUEUE_MAX_BYTES);
+		queue->lengths = createGrowableFIFO(OUTQUEUE_INITIAL_COMMANDS * sizeof(uint32_t),
+			OUTQUEUE_MAX_BYTES);
+	}
+	// Only whole commands are queued
+	uint32_t used = availableFIFO(queue->bytes), commands = availableFIFO(queue->lengths);
+	if(used + length > queue->bytes->maxSize || commands + sizeof(uint32_t) > queue->lengths->maxSize)
+		return -1;
+	// The batch has no buffer, so every piece of the command is appended to the class directly
+	axcp_batch_t batch;
+	axcpBatchInit(&batch, -1, NULL, 0);
+	batch.sink = outqueueAppend;
+	batch.sinkContext = queue;
+	if(axcpBatchEncodev(&batch, parts, count) == -1)
+		return -1;
+	uint32_t commandLength = length;
+	appendFIFOBytes((uint8_t*) &commandLength, sizeof(commandLength), queue->lengths);
+	queuedBytes[priority] += length;
+	queued += length;
+	return 0;
+}
+
+// Return: the contiguous span of bytes 'offset' bytes after the first byte queued in 'priority' class in 'data'
+static uint32_t outqueueSpan(int priority, uint32_t offset, uint8_t **data) {
+	ringbuffer_handler_t *bytes = classes[priority].bytes;
+	uint32_t index = (bytes->readIndex + offset) & (bytes->size - 1);
+	uint32_t available = availableFIFO(bytes) - offset;
+	*data = bytes->fifo + index;
+	return available < bytes->size - index ? available : bytes->size - index;
+}
+
+// Removes 'length' written bytes from the front of 'priority' class
+static void outqueueConsume(int priority, uint32_t length) {
+	outqueue_class_t *queue = &classes[priority];
+	consumeFIFO(length, queue->bytes);
+	writtenBytes[priority] += length;
+	queued -= length;
+	while(length > 0) {
+		uint32_t headLength = outqueueHeadLength(priority);
+		uint32_t n = length < headLength - queue->headWritten ? length : headLength - queue->headWritten;
+		queue->headWritten += n;
+		length -= n;
+		if(queue->headWritten == headLength) {
+			consumeFIFO(sizeof(uint32_t), queue->lengths);
+			queue->headWritten = 0;
+			outqueueCommands++;
+		}
+	}
+}
+
+int outqueueSend(int fd, uint32_t budget) {
+	struct iovec iov[AXCP_MAX_IOV];
+	int priorities[AXCP_MAX_IOV];
+	uint32_t taken[OUTQUEUE_CLASSES] = {0};
+	uint32_t total = 0;
+	int n = 0, i, p;
+
+	// Gather the commands in the order they are due: the rest of a partially written command, then every class
+	// from the highest. The bytes of a class are contiguous, so a whole class is taken with at most two spans.
+	for(i=-1; i<OUTQUEUE_CLASSES && n < AXCP_MAX_IOV && total < budget; i++) {
+		p = i == -1 ? current : i;
+		if(p == -1)
+			continue;
+		uint32_t limit = outqueueAvailable(p);
+		if(i == -1)
+			limit = outqueueHeadLength(p) - classes[p].headWritten;
+		while(taken[p] < limit && n < AXCP_MAX_IOV && total < budget) {
+			uint8_t *data;
+			uint32_t piece = outqueueSpan(p, taken[p], &data);
+			if(piece > limit - taken[p])
+				piece = limit - taken[p];
+			if(piece > budget - total)
+				piece = budget - total;
+			iov[n].iov_base = data;
+			iov[n].iov_len = piece;
+			priorities[n] = p;
+			taken[p] += piece;
+			total += piece;
+			n++;
+		}
+	}
+	if(n == 0)
+		return 0;
+
+	ssize_t written = writev(fd, iov, n);
+	if(written == -1) {
+		if(errno != EAGAIN && errno != EWOULDBLOCK)
+			return -1;
+		written = 0;
+	} else {
+		outqueueWrites++;
+	}
+
+	// Release what was written; at most one command can be left partially written
+	uint32_t remaining = written;
+	for(i=0; i<n && remaining > 0; i++) {
+		uint32_t consumed = remaining < iov[i].iov_len ? remaining : iov[i].iov_len;
+		outqueueConsume(priorities[i], consumed);
+		remaining -= consumed;
+	}
+	current = -1;
+	for(p=0; p<OUTQUEUE_CLASSES; p++)
+		if(classes[p].headWritten > 0)
+			current = p;
+	return written;
+}
+
+uint32_t outqueueLength() {
+	return queued;
+}
+
+uint32_t outqueueDrop(int priority, outqueue_filter_t filter) {
+	outqueue_class_t *queue = &classes[priority];
+	uint32_t commands = queue->lengths != NULL ? availableFIFO(queue->lengths) / sizeof(uint32_t) : 0;
+	uint32_t read = 0, write = 0, kept = 0, dropped = 0, i, k;
+	if(commands == 0)
+		return 0;
+	ringbuffer_handler_t *bytes = queue->bytes, *lengths = queue->lengths;
+	uint32_t mask = bytes->size - 1;
+	uint32_t *lengthList = (uint32_t*) lengths->fifo;
+	uint32_t lengthMask = lengths->size / sizeof(uint32_t) - 1;
+	uint32_t firstLength = lengths->readIndex / sizeof(uint32_t);
+	// The commands that are kept are moved to the front in place, so their order stays the same
+	for(i=0; i<commands; i++) {
+		uint32_t length = lengthList[(firstLength + i) & lengthMask];
+		uint32_t unwritten = i == 0 ? length - queue->headWritten : length;
+		// The rest of a partially written command still has to be written
+		int keep = (i == 0 && queue->headWritten > 0) ||
+			(filter != NULL && !filter(bytes->fifo[(bytes->readIndex + read) & mask]));
+		if(keep) {
+			uint32_t from = bytes->readIndex + read, to = bytes->readIndex + write;
+			for(k=0; to != from && k<unwritten; k++)
+				bytes->fifo[(to + k) & mask] = bytes->fifo[(from + k) & mask];
+			lengthList[(firstLength + kept) & lengthMask] = length;
+			write += unwritten;
+			kept++;
+		} else {
+			writtenBytes[priority] += unwritten;
+			queued -= unwritten;
+			dropped++;
+		}
+		read += unwritten;
+	}
+	bytes->writeIndex = bytes->readIndex + write;
+	lengths->writeIndex = lengths->readIndex + kept * sizeof(uint32_t);
+	return dropped;
+}
+
+uint64_t outqueueQueuedBytes(int priority) {
+	return queuedBytes[priority];
+}
+
+uint64_t outqueueWrittenBytes(int priority) {
+	return writtenBytes[priority];
+}
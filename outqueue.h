@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Prioritised queue of encoded commands on their way to the UART. Commands are queued in one of three
+ * priority classes and written without blocking in portions of a given budget, so the caller can keep the
+ * driver's output queue short. Whenever a portion is written, the waiting commands of the highest class go
+ * first. Within a class, commands keep their order. A command that was only written partially is finished
+ * before any other one starts, because commands can't be interleaved on the wire.
+ * Each class keeps its commands encoded back to back in a ringbuffer that only grows, so queueing a command
+ * copies it once and doesn't allocate memory at steady state.
+ */
+
+#include <inttypes.h>
+#include <sys/uio.h>
+
+// Priority classes, highest first: actuator and safety actions, requests, replies and everything else, and
+// bulk transfers like program sources, compiler output and printouts
+#define OUTQUEUE_CONTROL 0
+#define OUTQUEUE_NORMAL 1
+#define OUTQUEUE_BULK 2
+#define OUTQUEUE_CLASSES 3
+
+// Initial size of the ringbuffer of a class and the size it may grow to, in bytes, and the number of commands a
+// class takes before its list of command lengths grows
+#define OUTQUEUE_INITIAL_BYTES 4096
+#define OUTQUEUE_MAX_BYTES (16 * 1024 * 1024)
+#define OUTQUEUE_INITIAL_COMMANDS 64
+
+// Number of write calls and of commands written completely so far
+extern uint32_t outqueueWrites;
+extern uint32_t outqueueCommands;
+
+/*
+ * Encodes the plain command consisting of 'count' consecutive 'parts' (see axcpEncodeAndSendv()) and queues
+ * it in 'priority' class.
+ * Return: 0 on success, -1 if the class is full or there is not enough memory and -2 if the command has a fixed payload length
+ * which does not correspond to the given length.
+ */
+int outqueuePushv(int priority, const struct iovec *parts, int count);
+
+/*
+ * Writes up to 'budget' bytes of the queued commands to the non-blocking 'fd' with a single writev().
+ * Return: the number of bytes written, which is less than 'budget' if the queue ran empty or 'fd' didn't take
+ * more, or -1 if there was an I/O error.
+ */
+int outqueueSend(int fd, uint32_t budget);
+
+/*
+ * Return: the number of bytes waiting in the queue.
+ */
+uint32_t outqueueLength();
+
+/*
+ * Callback used by outqueueDrop() to select commands by their 'opcode'.
+ * Return: 1 if the command is to be dropped or 0 if it is kept.
+ */
+typedef int (*outqueue_filter_t)(uint8_t opcode);
+
+/*
+ * Drops the commands waiting in 'priority' class that 'filter' selects, or all of them if 'filter' is NULL,
+ * except for a partially written one, e.g. because they are obsolete after an emergency stop. The other commands
+ * keep their order.
+ * Return: the number of commands dropped.
+ */
+uint32_t outqueueDrop(int priority, outqueue_filter_t filter);
+
+/*
+ * Return: the total number of bytes ever queued in 'priority' class. Once outqueueWrittenBytes() reaches the
+ * value returned right after queueing a command, that command and everything before it in its class is written.
+ */
+uint64_t outqueueQueuedBytes(int priority);
+
+/*
+ * Return: the total number of bytes of 'priority' class written or dropped so far.
+ */
+uint64_t outqueueWrittenBytes(int priority);
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pending.h"
+
+#include <string.h>
+
+static pending_request_t table[PENDING_MAX_REQUESTS];
+
+// Return: the entry waiting for 'replyOpcode' on 'port' or NULL if there is none
+static pending_request_t *pendingFind(uint8_t replyOpcode, int port) {
+	int i;
+	for(i=0; i<PENDING_MAX_REQUESTS; i++)
+		if(table[i].used && table[i].replyOpcode == replyOpcode && table[i].port == port)
+			return &table[i];
+	return NULL;
+}
+
+int pendingAdd(uint8_t replyOpcode, int port, uint32_t requester, uint8_t tag, const uint8_t *request,
+		uint32_t length, uint64_t now) {
+	pending_request_t *entry = pendingFind(replyOpcode, port);
+	if(entry != NULL) {
+		entry->requesters |= requester;
+		// Only the last requester is answered with its tag, see pending.h
+		entry->tag = tag;
+		return 1;
+	}
+	if(length > PENDING_MAX_REQUEST_LENGTH)
+		return -1;
+
+	int i;
+	for(i=0; i<PENDING_MAX_REQUESTS; i++) {
+		if(table[i].used)
+			continue;
+		table[i].used = 1;
+		table[i].replyOpcode = replyOpcode;
+		table[i].port = port;
+		table[i].requesters = requester;
+		table[i].tag = tag;
+		memcpy(table[i].request, request, length);
+		table[i].requestLength = length;
+		table[i].sentAt = now;
+		table[i].retries = 0;
+		return 0;
+	}
+	return -1;
+}
+
+uint32_t pendingComplete(uint8_t replyOpcode, int port, uint8_t *tag) {
+	pending_request_t *entry = pendingFind(replyOpcode, port);
+	if(entry == NULL)
+		return 0;
+	entry->used = 0;
+	*tag = entry->tag;
+	return entry->requesters;
+}
+
+uint32_t pendingFail(uint8_t replyOpcode, uint8_t *tag) {
+	pending_request_t *entry = NULL;
+	int i;
+	for(i=0; i<PENDING_MAX_REQUESTS; i++)
+		if(table[i].used && table[i].replyOpcode == replyOpcode && (entry == NULL || table[i].sentAt < entry->sentAt))
+			entry = &table[i];
+	if(entry == NULL)
+		return 0;
+	entry->used = 0;
+	*tag = entry->tag;
+	return entry->requesters;
+}
+
+void pendingCancel(uint32_t requester) {
+	int i;
+	for(i=0; i<PENDING_MAX_REQUESTS; i++) {
+		table[i].requesters &= ~requester;
+		if(table[i].requesters == 0)
+			table[i].used = 0;
+	}
+}
+
+int pendingExpire(uint64_t now, int timeout, pending_expired_callback_t callback) {
+	int i, next = 0;
+	for(i=0; i<PENDING_MAX_REQUESTS; i++) {
+		if(!table[i].used)
+			continue;
+		if(now - table[i].sentAt >= (uint64_t) timeout) {
+			if(callback(&table[i])) {
+				table[i].sentAt = now;
+			} else {
+				table[i].used = 0;
+				continue;
+			}
+		}
+		int remaining = timeout - (int) (now - table[i].sentAt);
+		if(next == 0 || remaining < next)
+			next = remaining;
+	}
+	return next;
+}
+
+int pendingCount() {
+	int i, count = 0;
+	for(i=0; i<PENDING_MAX_REQUESTS; i++)
+		if(table[i].used)
+			count++;
+	return count;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Table of requests that were sent to the hardware controller and whose reply is still outstanding. Every
+ * entry is keyed by the reply opcode and port it waits for, so several requests can be in flight on the UART
+ * at once and each reply is routed to whoever asked for it. An entry remembers the request itself, so that it
+ * can be sent again if the reply doesn't arrive in time.
+ */
+
+#include <inttypes.h>
+
+// Maximum number of requests in flight at once
+#define PENDING_MAX_REQUESTS 32
+// Maximum length of a stored request (opcode + port)
+#define PENDING_MAX_REQUEST_LENGTH 2
+// Port of requests whose reply doesn't carry one, e.g. CONTROLLER_BATTERY_CHARGE_REQUEST
+#define PENDING_NO_PORT -1
+
+// Requesters, combined as bit mask: several requesters waiting for the same reply share one entry
+#define PENDING_REQUESTER_PROGRAM 0x01
+
+// One outstanding request
+typedef struct {
+	int used;
+	uint8_t replyOpcode;
+	int port;
+	// Bit mask of PENDING_REQUESTER_* waiting for the reply
+	uint32_t requesters;
+	// Tag of the latest request the reply answers, see REQUEST_TAG_SWCINTERN. Only the requester that joined last
+	// is answered with its own tag, see pendingAdd().
+	uint8_t tag;
+	// The request as sent to the hardware controller
+	uint8_t request[PENDING_MAX_REQUEST_LENGTH];
+	uint32_t requestLength;
+	// Time in milliseconds (see timeMillis()) the request was last sent and number of times it was sent again
+	uint64_t sentAt;
+	int retries;
+} pending_request_t;
+
+/*
+ * Callback invoked by pendingExpire() for every request that timed out.
+ * Return: 1 to keep waiting for the reply, e.g. after sending the request again, or 0 to remove the entry.
+ */
+typedef int (*pending_expired_callback_t)(pending_request_t *entry);
+
+/*
+ * Adds 'requester' to the entry waiting for 'replyOpcode' on 'port', creating it from 'request' of 'length'
+ * bytes and the current time 'now' if there is none yet. The reply answers the request tagged 'tag'. A request
+ * that joins an entry replaces the tag of the earlier one, so only the last requester gets the reply with its
+ * own tag. This is sufficient as long as the program is the only requester: it has one request outstanding at
+ * a time, so an earlier request it still waits for was given up, e.g. after its deadline.
+ * Return: 0 if a new entry was created, i.e. the request has to be sent, 1 if the same request is already in
+ * flight or -1 if the table is full or 'length' exceeds PENDING_MAX_REQUEST_LENGTH.
+ */
+int pendingAdd(uint8_t replyOpcode, int port, uint32_t requester, uint8_t tag, const uint8_t *request,
+	uint32_t length, uint64_t now);
+
+/*
+ * Removes the entry waiting for 'replyOpcode' on 'port', because the reply arrived, and stores its tag in 'tag'.
+ * Return: the requesters that were waiting for the reply or 0 if nobody asked for it.
+ */
+uint32_t pendingComplete(uint8_t replyOpcode, int port, uint8_t *tag);
+
+/*
+ * Removes the entry waiting for 'replyOpcode' that was sent first among those for any port, because the hardware
+ * controller answered its request with an ERROR_ACTION, which doesn't carry the port. The hardware controller
+ * answers requests in the order they were sent, so that is the request the error refers to. Stores the tag of
+ * the entry in 'tag'.
+ * Return: the requesters that were waiting for the reply or 0 if there is no such entry.
+ */
+uint32_t pendingFail(uint8_t replyOpcode, uint8_t *tag);
+
+/*
+ * Removes 'requester' from all entries, e.g. because it terminated. Entries nobody waits for anymore are
+ * removed.
+ */
+void pendingCancel(uint32_t requester);
+
+/*
+ * Invokes 'callback' for every entry that was sent at least 'timeout' milliseconds before 'now'. Entries kept
+ * by the callback count as sent at 'now'.
+ * Return: the number of milliseconds until the next entry times out or 0 if the table is empty.
+ */
+int pendingExpire(uint64_t now, int timeout, pending_expired_callback_t callback);
+
+/*
+ * Return: the number of requests currently in flight.
+ */
+int pendingCount();
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "reactor.h"
+
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#define REACTOR_TYPE_NONE 0
+#define REACTOR_TYPE_FD 1
+#define REACTOR_TYPE_TIMER 2
+#define REACTOR_TYPE_SIGNAL 3
+
+// Maximum number of events handled per epoll_wait()
+#define REACTOR_MAX_EVENTS 16
+
+static int epoll_fd = -1;
+static reactor_callback_t callbacks[REACTOR_MAX_FDS];
+static uint8_t types[REACTOR_MAX_FDS];
+// Signals that are blocked for the process and delivered via signalfd
+static sigset_t signals;
+
+static int reactorRegister(int fd, reactor_callback_t callback, uint8_t type) {
+	if(fd < 0 || fd >= REACTOR_MAX_FDS)
+		return -1;
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+		return -1;
+	callbacks[fd] = callback;
+	types[fd] = type;
+	return 0;
+}
+
+int reactorInit() {
+	sigemptyset(&signals);
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	return epoll_fd == -1 ? -1 : 0;
+}
+
+int reactorAdd(int fd, reactor_callback_t callback) {
+	return reactorRegister(fd, callback, REACTOR_TYPE_FD);
+}
+
+int reactorModify(int fd, uint32_t events) {
+	struct epoll_event event;
+	event.events = events;
+	event.data.fd = fd;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+int reactorRemove(int fd) {
+	if(fd < 0 || fd >= REACTOR_MAX_FDS)
+		return -1;
+	callbacks[fd] = NULL;
+	types[fd] = REACTOR_TYPE_NONE;
+	// The event argument is ignored, but must not be NULL for kernels before 2.6.9
+	struct epoll_event event;
+	return epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &event);
+}
+
+int reactorCreateTimer(reactor_callback_t callback) {
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if(fd == -1)
+		return -1;
+	if(reactorRegister(fd, callback, REACTOR_TYPE_TIMER) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int reactorArmTimer(int timer_fd, int ms) {
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = 0;
+	spec.it_interval.tv_nsec = 0;
+	spec.it_value.tv_sec = ms / 1000;
+	spec.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	return timerfd_settime(timer_fd, 0, &spec, NULL);
+}
+
+int reactorCreateSignal(int signo, reactor_callback_t callback) {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, signo);
+	// Block the signal first, so that it stays pending until the signalfd reads it
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+	int fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if(fd == -1 || reactorRegister(fd, callback, REACTOR_TYPE_SIGNAL) == -1) {
+		if(fd != -1)
+			close(fd);
+		sigprocmask(SIG_UNBLOCK, &mask, NULL);
+		return -1;
+	}
+	sigaddset(&signals, signo);
+	return fd;
+}
+
+void reactorResetSignals() {
+	sigprocmask(SIG_UNBLOCK, &signals, NULL);
+}
+
+int reactorDispatch(int timeout) {
+	struct epoll_event events[REACTOR_MAX_EVENTS];
+	int n = epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, timeout);
+	if(n == -1)
+		return errno == EINTR ? 0 : -1;
+
+	int i, invoked = 0;
+	for(i=0; i<n; i++) {
+		int fd = events[i].data.fd;
+		// A previous callback of this round may have removed the fd
+		if(callbacks[fd] == NULL)
+			continue;
+
+		// Consume the expiration count or signal info, so the fd doesn't stay readable
+		if(types[fd] == REACTOR_TYPE_TIMER) {
+			uint64_t expirations;
+			if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+				continue;
+		} else if(types[fd] == REACTOR_TYPE_SIGNAL) {
+			struct signalfd_siginfo info;
+			if(read(fd, &info, sizeof(info)) != sizeof(info))
+				continue;
+		}
+
+		callbacks[fd](fd, events[i].events);
+		invoked++;
+	}
+	return invoked;
+}
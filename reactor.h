@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Event reactor on top of epoll. File descriptors, timers (timerfd) and signals (signalfd) are registered
+ * together with a callback, and reactorDispatch() sleeps until at least one of them is ready and invokes
+ * the according callbacks. Signals handled by the reactor are blocked for the process, so every forked
+ * child has to call reactorResetSignals() before exec.
+ */
+
+#include <inttypes.h>
+#include <sys/epoll.h>
+
+// Highest file descriptor number (exclusive) that can be registered
+#define REACTOR_MAX_FDS 1024
+
+/*
+ * Callback invoked by the reactor when 'fd' is ready. 'events' contains the epoll event flags, e.g.
+ * EPOLLIN or EPOLLHUP. For timers and signals, the expiration count or signal info has already been
+ * consumed by the reactor when the callback is invoked.
+ */
+typedef void (*reactor_callback_t)(int fd, uint32_t events);
+
+/*
+ * Creates the epoll instance. Must be called once before any other reactor function.
+ * Return: 0 on success or -1 on failure.
+ */
+int reactorInit();
+
+/*
+ * Registers 'fd' for readability. 'callback' is invoked whenever 'fd' is readable or was hung up.
+ * Return: 0 on success or -1 on failure (e.g. 'fd' does not support polling).
+ */
+int reactorAdd(int fd, reactor_callback_t callback);
+
+/*
+ * Changes the epoll 'events' 'fd' is registered for, e.g. EPOLLIN | EPOLLOUT.
+ * Return: 0 on success or -1 on failure.
+ */
+int reactorModify(int fd, uint32_t events);
+
+/*
+ * Unregisters 'fd' from the reactor. Does not close 'fd'.
+ * Return: 0 on success or -1 on failure.
+ */
+int reactorRemove(int fd);
+
+/*
+ * Creates a disarmed timer whose expiration invokes 'callback'.
+ * Return: the timer's fd or -1 on failure.
+ */
+int reactorCreateTimer(reactor_callback_t callback);
+
+/*
+ * Arms the timer 'timer_fd' to expire once after 'ms' milliseconds. If 'ms' is 0, the timer is disarmed.
+ * Rearming an armed timer replaces the previous deadline.
+ * Return: 0 on success or -1 on failure.
+ */
+int reactorArmTimer(int timer_fd, int ms);
+
+/*
+ * Blocks signal 'signo' for the process and delivers it to 'callback' instead.
+ * Return: the signal's fd or -1 on failure.
+ */
+int reactorCreateSignal(int signo, reactor_callback_t callback);
+
+/*
+ * Unblocks all signals handled by the reactor. Must be called in forked children before exec.
+ */
+void reactorResetSignals();
+
+/*
+ * Waits until at least one registered fd is ready or 'timeout' milliseconds have passed and invokes the
+ * according callbacks. A 'timeout' of -1 waits infinitely.
+ * Return: the number of callbacks invoked or -1 on failure.
+ */
+int reactorDispatch(int timeout);
@@ -20,12 +20,29 @@
 
 #include "ringbuffer.h"
 
-ringbuffer_handler_t *createFIFO(int size){
+#include <string.h>
+
+// Return: the smallest power of two that is at least 'size'
+static uint32_t roundUpFIFO(uint32_t size) {
+    uint32_t rounded = 1;
+    while(rounded < size)
+        rounded <<= 1;
+    return rounded;
+}
+
+ringbuffer_handler_t *createFIFO(int size) {
+    return createGrowableFIFO(size, size);
+}
+
+ringbuffer_handler_t *createGrowableFIFO(int size, int maxSize) {
     ringbuffer_handler_t *buffer = (ringbuffer_handler_t *)malloc(sizeof(ringbuffer_handler_t));
-    buffer->readIndex=0;
-    buffer->writeIndex=0;
-    buffer->fifo = (uint8_t*) malloc(sizeof(uint8_t) * size);
-    buffer->size = size;
+    buffer->readIndex = 0;
+    buffer->writeIndex = 0;
+    buffer->size = roundUpFIFO(size);
+    buffer->maxSize = maxSize > size ? roundUpFIFO(maxSize) : buffer->size;
+    buffer->fifo = (uint8_t*) malloc(sizeof(uint8_t) * buffer->size);
+    buffer->overflows = 0;
+    buffer->droppedBytes = 0;
     return buffer;
 }
 
@@ -40,39 +57,109 @@ int availableFIFO(ringbuffer_handler_t *buffer) {
     // checks validity of ringbuffer
     if(!buffer)
         return -1;
-    if(buffer->writeIndex >= buffer->readIndex)
-	return buffer->writeIndex - buffer->readIndex;
-    else
-        return buffer->size - (buffer->readIndex - buffer->writeIndex);
+    return buffer->writeIndex - buffer->readIndex;
 }
 
-int appendFIFO(uint8_t data, ringbuffer_handler_t *buffer) {
-    // checks validity of ringbuffer
+int freeFIFO(ringbuffer_handler_t *buffer) {
     if(!buffer)
-	return -1;
-    // A write must not cause readIndex == writeIndex. If so, the ringbuffer is full.
-    if(buffer->readIndex == buffer->writeIndex + 1 || (buffer->readIndex == 0 && buffer->writeIndex == buffer->size - 1))
         return -1;
-    buffer->fifo[buffer->writeIndex] = data;
-    // Advance writeIndex
-    buffer->writeIndex++;
-    if(buffer->writeIndex==buffer->size)
-        buffer->writeIndex = 0;
-    return 0;
+    return buffer->size - (buffer->writeIndex - buffer->readIndex);
+}
+
+int appendFIFO(uint8_t data, ringbuffer_handler_t *buffer) {
+    return appendFIFOBytes(&data, 1, buffer) == 1 ? 0 : -1;
 }
 
 int readFIFO(uint8_t *data, ringbuffer_handler_t *buffer) {
-    // checks validity of ringbuffer
+    return readFIFOBytes(data, 1, buffer) == 1 ? 0 : -1;
+}
+
+// Copies 'length' bytes starting at 'index' out of the ringbuffer, in at most two pieces if they wrap around
+static void copyOutFIFO(uint8_t *data, uint32_t index, uint32_t length, ringbuffer_handler_t *buffer) {
+    uint32_t offset = index & (buffer->size - 1);
+    uint32_t first = length < buffer->size - offset ? length : buffer->size - offset;
+    memcpy(data, buffer->fifo + offset, first);
+    memcpy(data + first, buffer->fifo, length - first);
+}
+
+// Grows the ringbuffer until 'length' more bytes fit or it reached its maxSize
+static void growFIFO(uint32_t length, ringbuffer_handler_t *buffer) {
+    uint32_t used = buffer->writeIndex - buffer->readIndex;
+    uint32_t size = buffer->size;
+    while(size - used < length && size < buffer->maxSize)
+        size <<= 1;
+    if(size == buffer->size)
+        return;
+    uint8_t *fifo = (uint8_t*) malloc(sizeof(uint8_t) * size);
+    if(!fifo)
+        return;
+    // The contents start at the beginning of the new buffer
+    copyOutFIFO(fifo, buffer->readIndex, used, buffer);
+    free(buffer->fifo);
+    buffer->fifo = fifo;
+    buffer->size = size;
+    buffer->readIndex = 0;
+    buffer->writeIndex = used;
+}
+
+int appendFIFOBytes(const uint8_t *data, uint32_t length, ringbuffer_handler_t *buffer) {
+    if(!buffer)
+        return -1;
+    if(buffer->size - (buffer->writeIndex - buffer->readIndex) < length)
+        growFIFO(length, buffer);
+    uint32_t room = buffer->size - (buffer->writeIndex - buffer->readIndex);
+    if(length > room) {
+        buffer->overflows++;
+        buffer->droppedBytes += length - room;
+        length = room;
+    }
+    uint32_t offset = buffer->writeIndex & (buffer->size - 1);
+    uint32_t first = length < buffer->size - offset ? length : buffer->size - offset;
+    memcpy(buffer->fifo + offset, data, first);
+    memcpy(buffer->fifo, data + first, length - first);
+    buffer->writeIndex += length;
+    return length;
+}
+
+int peekFIFOBytes(uint8_t *data, uint32_t length, ringbuffer_handler_t *buffer) {
+    if(!buffer)
+        return -1;
+    uint32_t used = buffer->writeIndex - buffer->readIndex;
+    if(length > used)
+        length = used;
+    copyOutFIFO(data, buffer->readIndex, length, buffer);
+    return length;
+}
+
+int readFIFOBytes(uint8_t *data, uint32_t length, ringbuffer_handler_t *buffer) {
+    int read = peekFIFOBytes(data, length, buffer);
+    if(read > 0)
+        buffer->readIndex += read;
+    return read;
+}
+
+uint32_t readSpanFIFO(uint8_t **data, ringbuffer_handler_t *buffer) {
     if(!buffer)
-	return -1;
-    // If readIndex == writeIndex, the ringbuffer is empty.
-    if(buffer->readIndex == buffer->writeIndex)
-	return -1;
-    *data = buffer->fifo[buffer->readIndex];
-    // Advance readIndex
-    buffer->readIndex++;
-    if(buffer->readIndex == buffer->size)
-	buffer->readIndex = 0;
-    return 0;
+        return 0;
+    uint32_t used = buffer->writeIndex - buffer->readIndex;
+    uint32_t offset = buffer->readIndex & (buffer->size - 1);
+    *data = buffer->fifo + offset;
+    return used < buffer->size - offset ? used : buffer->size - offset;
+}
+
+void consumeFIFO(uint32_t length, ringbuffer_handler_t *buffer) {
+    buffer->readIndex += length;
 }
 
+uint32_t writeSpanFIFO(uint8_t **data, ringbuffer_handler_t *buffer) {
+    if(!buffer)
+        return 0;
+    uint32_t room = buffer->size - (buffer->writeIndex - buffer->readIndex);
+    uint32_t offset = buffer->writeIndex & (buffer->size - 1);
+    *data = buffer->fifo + offset;
+    return room < buffer->size - offset ? room : buffer->size - offset;
+}
+
+void commitFIFO(uint32_t length, ringbuffer_handler_t *buffer) {
+    buffer->writeIndex += length;
+}
@@ -21,28 +21,49 @@
 #include <inttypes.h>
 #include <stdlib.h>
 
-// Struct that holds all information about the ringbuffer
+/*
+ * Struct that holds all information about the ringbuffer. 'readIndex' and 'writeIndex' count all bytes ever
+ * read and written, and 'size' is a power of two, so that positions in 'fifo' are found by masking and the
+ * ringbuffer can be filled completely.
+ */
 typedef struct {
-    int readIndex;
-    int writeIndex;
+    uint32_t readIndex;
+    uint32_t writeIndex;
     // The actual buffer
     uint8_t *fifo;
-    // size of the buffer
-    int size;
+    // size of the buffer and size it may grow to when a write doesn't fit
+    uint32_t size;
+    uint32_t maxSize;
+    // Statistics: number of writes that didn't fit completely and number of bytes dropped by them
+    uint32_t overflows;
+    uint32_t droppedBytes;
 } ringbuffer_handler_t;
 
 /*
- * Creates a ringbuffer with length 'size' and returns the handler struct
+ * Creates a ringbuffer with length 'size', rounded up to the next power of two, and returns the handler struct
  */
 ringbuffer_handler_t *createFIFO(int size);
 
 /*
- * Calculates the number of free bytes in the ringbuffer handled by 'buffer', i.e. the number of
- * bytes that can be written.
- * Return: the number of free bytes or -1 if 'buffer' is not valid.
+ * Like createFIFO(), but the ringbuffer doubles its size when a write doesn't fit, up to 'maxSize' rounded up to
+ * the next power of two.
+ */
+ringbuffer_handler_t *createGrowableFIFO(int size, int maxSize);
+
+/*
+ * Calculates the number of bytes in the ringbuffer handled by 'buffer', i.e. the number of bytes that can be
+ * read.
+ * Return: the number of bytes or -1 if 'buffer' is not valid.
  */
 int availableFIFO(ringbuffer_handler_t *buffer);
 
+/*
+ * Calculates the number of free bytes in the ringbuffer handled by 'buffer', i.e. the number of bytes that can be
+ * written without growing it.
+ * Return: the number of free bytes or -1 if 'buffer' is not valid.
+ */
+int freeFIFO(ringbuffer_handler_t *buffer);
+
 /*
  * Adds a new byte to the ringbuffer handled by 'buffer'.
  * Return: 0 on success or -1 if the ringbuffer is full or 'buffer' is invalid
@@ -55,6 +76,50 @@ int appendFIFO(uint8_t data, ringbuffer_handler_t *buffer);
  */
 int readFIFO(uint8_t *data, ringbuffer_handler_t *buffer);
 
+/*
+ * Adds 'length' bytes of 'data' to the ringbuffer handled by 'buffer', growing it if necessary and allowed. If
+ * they still don't fit, only the first bytes that fit are added and the overflow is counted.
+ * Return: the number of bytes added or -1 if 'buffer' is invalid.
+ */
+int appendFIFOBytes(const uint8_t *data, uint32_t length, ringbuffer_handler_t *buffer);
+
+/*
+ * Reads up to 'length' bytes from the ringbuffer handled by 'buffer' into 'data' and deletes them.
+ * Return: the number of bytes read or -1 if 'buffer' is invalid.
+ */
+int readFIFOBytes(uint8_t *data, uint32_t length, ringbuffer_handler_t *buffer);
+
+/*
+ * Like readFIFOBytes(), but the bytes stay in the ringbuffer.
+ */
+int peekFIFOBytes(uint8_t *data, uint32_t length, ringbuffer_handler_t *buffer);
+
+/*
+ * Assigns the contiguous span of readable bytes in the ringbuffer handled by 'buffer' to 'data', e.g. to write
+ * them somewhere without copying them first. They are deleted by consumeFIFO().
+ * Return: the number of bytes in the span, which is less than availableFIFO() if the bytes wrap around, or 0 if
+ * the ringbuffer is empty or 'buffer' is invalid.
+ */
+uint32_t readSpanFIFO(uint8_t **data, ringbuffer_handler_t *buffer);
+
+/*
+ * Deletes the first 'length' bytes, which must not be more than availableFIFO(), e.g. after readSpanFIFO().
+ */
+void consumeFIFO(uint32_t length, ringbuffer_handler_t *buffer);
+
+/*
+ * Assigns the contiguous span of free bytes in the ringbuffer handled by 'buffer' to 'data', e.g. to read() into
+ * it directly. The bytes written to it are added by commitFIFO().
+ * Return: the number of bytes in the span, which is less than freeFIFO() if the free bytes wrap around, or 0 if
+ * the ringbuffer is full or 'buffer' is invalid.
+ */
+uint32_t writeSpanFIFO(uint8_t **data, ringbuffer_handler_t *buffer);
+
+/*
+ * Adds 'length' bytes, which must not be more than the last writeSpanFIFO(), e.g. after writing to that span.
+ */
+void commitFIFO(uint32_t length, ringbuffer_handler_t *buffer);
+
 /*
  * Frees all memory taken by the ringbuffer handled by 'buffer'.
  */
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sharedstate.h"
+#include "tools.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Region mapped by a user program; MAP_FAILED if mapping failed
+static const shared_state_t *mapped = NULL;
+
+shared_state_t *sharedStateCreate(int *readOnlyFd) {
+	char name[32];
+	snprintf(name, 32, "/hedgehog-state-%d", (int) getpid());
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd == -1)
+		return NULL;
+	*readOnlyFd = shm_open(name, O_RDONLY, 0);
+	// The name is not needed anymore, the region lives as long as a file descriptor refers to it
+	shm_unlink(name);
+	if(*readOnlyFd == -1 || ftruncate(fd, sizeof(shared_state_t)) == -1) {
+		close(fd);
+		if(*readOnlyFd != -1)
+			close(*readOnlyFd);
+		return NULL;
+	}
+	shared_state_t *state = (shared_state_t*) mmap(NULL, sizeof(shared_state_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+		fd, 0);
+	close(fd);
+	if(state == MAP_FAILED) {
+		close(*readOnlyFd);
+		return NULL;
+	}
+	// ftruncate() zeroed the region, i.e. all values are unknown
+	state->maxAge = SHARED_STATE_MAX_AGE_MS;
+	return state;
+}
+
+void sharedStateWrite(shared_state_t *state, int kind, int port, int32_t value, uint64_t updatedAt) {
+	state->sequence++;
+	__sync_synchronize();
+	state->values[kind][port].value = value;
+	state->values[kind][port].updatedAt = updatedAt;
+	__sync_synchronize();
+	state->sequence++;
+}
+
+void sharedStateClear(shared_state_t *state) {
+	int kind, port;
+	state->sequence++;
+	__sync_synchronize();
+	for(kind=0; kind<SHARED_STATE_KINDS; kind++)
+		for(port=0; port<SHARED_STATE_PORTS; port++)
+			state->values[kind][port].updatedAt = 0;
+	__sync_synchronize();
+	state->sequence++;
+}
+
+int sharedStateReadAged(int kind, int port, int32_t *value, uint64_t *age) {
+	if(mapped == NULL) {
+		mapped = (const shared_state_t*) mmap(NULL, sizeof(shared_state_t), PROT_READ, MAP_SHARED, SHARED_STATE_FD,
+			0);
+	}
+	if(mapped == MAP_FAILED || port < 0 || port >= SHARED_STATE_PORTS)
+		return 0;
+
+	uint32_t sequence;
+	uint64_t updatedAt;
+	// Retry while andrixswc writes or wrote during the read
+	do {
+		sequence = mapped->sequence;
+		__sync_synchronize();
+		*value = mapped->values[kind][port].value;
+		updatedAt = mapped->values[kind][port].updatedAt;
+		__sync_synchronize();
+	} while((sequence & 1) || sequence != mapped->sequence);
+
+	if(updatedAt == 0)
+		return 0;
+	*age = timeMillis() - updatedAt;
+	return 1;
+}
+
+int sharedStateRead(int kind, int port, int32_t *value) {
+	uint64_t age;
+	if(!sharedStateReadAged(kind, port, value, &age))
+		return 0;
+	// maxAge is only changed at startup, so it needs no consistent read
+	int32_t maxAge = mapped->maxAge;
+	return maxAge >= 0 && age <= (uint64_t) maxAge;
+}
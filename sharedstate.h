@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shared memory region in which andrixswc publishes the state it mirrors from the hardware controller (see
+ * mirror.h), so that user programs can read sensor values with a few loads instead of a request over the
+ * pipes. andrixswc is the only writer; a sequence counter (seqlock) lets readers detect and retry reads that
+ * overlapped with a write. The region is passed to user programs as read-only SHARED_STATE_FD.
+ */
+
+#ifndef SHAREDSTATE_H
+#define SHAREDSTATE_H
+
+#include <inttypes.h>
+
+#define SHARED_STATE_FD 204
+
+// Kinds of values in the region; values without port use port 0
+#define SHARED_STATE_ANALOG 0
+#define SHARED_STATE_DIGITAL 1
+#define SHARED_STATE_MOTOR_POSITION 2
+// Signed velocity magnitude, i.e. negative if the motor moves backward
+#define SHARED_STATE_MOTOR_VELOCITY 3
+#define SHARED_STATE_CONTROLLER_BATTERY_CHARGE 4
+#define SHARED_STATE_CONTROLLER_BATTERY_CHARGING_STATE 5
+#define SHARED_STATE_PHONE_BATTERY_CHARGE 6
+#define SHARED_STATE_PHONE_BATTERY_CHARGING_STATE 7
+#define SHARED_STATE_KINDS 8
+#define SHARED_STATE_PORTS 16
+// Maximum age in milliseconds of a value that a program uses instead of a request, see shared_state_t. Independent
+// of the age up to which andrixswc answers requests from the mirror itself, as a read from the region costs no
+// round trip at all.
+#define SHARED_STATE_MAX_AGE_MS 10
+
+// One value and the time it was received (see timeMillis()), which is 0 if the value is unknown
+typedef struct {
+	int32_t value;
+	uint64_t updatedAt;
+} shared_value_t;
+
+// Layout of the region
+typedef struct {
+	// Odd while andrixswc writes to the region
+	volatile uint32_t sequence;
+	// Maximum age in milliseconds of a value that may be used instead of a request. Set to
+	// SHARED_STATE_MAX_AGE_MS by sharedStateCreate(); andrixswc may change it directly, as it is a single word.
+	volatile int32_t maxAge;
+	shared_value_t values[SHARED_STATE_KINDS][SHARED_STATE_PORTS];
+} shared_state_t;
+
+/*
+ * Creates the region in andrixswc. The region itself is mapped writable, 'readOnlyFd' is set to a read-only
+ * file descriptor for it that is passed to user programs.
+ * Return: the region or NULL on failure.
+ */
+shared_state_t *sharedStateCreate(int *readOnlyFd);
+
+/*
+ * Sets the value of 'kind' for 'port' in 'state' to 'value', received at 'updatedAt'. An 'updatedAt' of 0 marks
+ * the value as unknown. Only for andrixswc.
+ */
+void sharedStateWrite(shared_state_t *state, int kind, int port, int32_t value, uint64_t updatedAt);
+
+/*
+ * Marks all values in 'state' as unknown. Only for andrixswc.
+ */
+void sharedStateClear(shared_state_t *state);
+
+/*
+ * Reads the value of 'kind' for 'port' in the region passed by andrixswc into 'value', mapping the region on the
+ * first call. Only for user programs.
+ * Return: 1 if the value is at most maxAge milliseconds old or 0 if it has to be requested from andrixswc,
+ * e.g. because it is outdated or the region isn't available.
+ */
+int sharedStateRead(int kind, int port, int32_t *value);
+
+/*
+ * Like sharedStateRead(), but accepts a value of any age, e.g. as fallback when a request timed out. The age of
+ * the value in milliseconds is assigned to 'age'.
+ * Return: 1 if a value is known or 0 if not.
+ */
+int sharedStateReadAged(int kind, int port, int32_t *value, uint64_t *age);
+
+#endif
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "shmring.h"
+#include "tools.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+
+static void shmChannelInit(shm_channel_t *channel, shm_rings_t *rings, shm_ring_t *in, shm_ring_t *out) {
+	channel->rings = rings;
+	channel->in = in;
+	channel->out = out;
+	channel->notifications = 0;
+	channel->sleeps = 0;
+}
+
+int shmChannelCreate(shm_channel_t *channel, int *regionFd) {
+	char name[32];
+	snprintf(name, 32, "/hedgehog-ring-%d", (int) getpid());
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd == -1)
+		return -1;
+	shm_unlink(name);
+	if(ftruncate(fd, sizeof(shm_rings_t)) == -1) {
+		close(fd);
+		return -1;
+	}
+	shm_rings_t *rings = (shm_rings_t*) mmap(NULL, sizeof(shm_rings_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(rings == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	channel->wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	channel->notifyFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if(channel->wakeFd == -1 || channel->notifyFd == -1) {
+		if(channel->wakeFd != -1)
+			close(channel->wakeFd);
+		if(channel->notifyFd != -1)
+			close(channel->notifyFd);
+		munmap(rings, sizeof(shm_rings_t));
+		close(fd);
+		return -1;
+	}
+	// ftruncate() zeroed the region, i.e. both rings are empty
+	shmChannelInit(channel, rings, &rings->fromProgram, &rings->toProgram);
+	channel->hangupFd = -1;
+	*regionFd = fd;
+	return 0;
+}
+
+int shmChannelOpen(shm_channel_t *channel, int hangupFd) {
+	// A program started by other means may have anything or nothing at PROGRAM_RING_FD
+	struct stat region;
+	if(fstat(PROGRAM_RING_FD, &region) == -1 || region.st_size != sizeof(shm_rings_t))
+		return -1;
+	shm_rings_t *rings = (shm_rings_t*) mmap(NULL, sizeof(shm_rings_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+		PROGRAM_RING_FD, 0);
+	if(rings == MAP_FAILED)
+		return -1;
+	shmChannelInit(channel, rings, &rings->toProgram, &rings->fromProgram);
+	channel->wakeFd = PROGRAM_RING_WAKE_FD;
+	channel->notifyFd = PROGRAM_RING_NOTIFY_FD;
+	channel->hangupFd = hangupFd;
+	return 0;
+}
+
+void shmChannelClose(shm_channel_t *channel) {
+	munmap(channel->rings, sizeof(shm_rings_t));
+	close(channel->wakeFd);
+	close(channel->notifyFd);
+	channel->rings = NULL;
+	channel->wakeFd = -1;
+	channel->notifyFd = -1;
+}
+
+static void shmChannelNotify(shm_channel_t *channel) {
+	eventfd_write(channel->notifyFd, 1);
+	channel->notifications++;
+}
+
+// Return: 1 if the incoming ring is not empty ('reading') or the outgoing ring is not full (not 'reading')
+static int shmChannelReady(shm_channel_t *channel, int reading) {
+	if(reading)
+		return channel->in->head != channel->in->tail;
+	return channel->out->head - channel->out->tail < SHM_RING_SIZE;
+}
+
+/*
+ * Sleeps until the condition of shmChannelReady() holds or 'timeout' milliseconds have passed.
+ * Return: 1 if it holds, 0 on timeout or -1 if the other side is gone or an error occurred.
+ */
+static int shmChannelSleep(shm_channel_t *channel, int reading, int timeout) {
+	volatile uint32_t *sleeping = reading ? &channel->in->consumerSleeping : &channel->out->producerSleeping;
+	uint64_t deadline = timeMillis() + timeout;
+	int result;
+	while(1) {
+		// Announce the sleep before checking again, so that the other side either sees the announcement or
+		// made its change before the check
+		*sleeping = 1;
+		__sync_synchronize();
+		if(shmChannelReady(channel, reading)) {
+			result = 1;
+			break;
+		}
+		int wait = -1;
+		if(timeout >= 0) {
+			uint64_t now = timeMillis();
+			wait = now < deadline ? (int) (deadline - now) : 0;
+		}
+		struct pollfd fds[2];
+		fds[0].fd = channel->wakeFd;
+		fds[0].events = POLLIN;
+		fds[1].fd = channel->hangupFd;
+		fds[1].events = 0;
+		channel->sleeps++;
+		int ready = poll(fds, 2, wait);
+		if(ready == -1 && errno == EINTR)
+			continue;
+		if(ready == -1) {
+			result = -1;
+			break;
+		}
+		if(fds[0].revents & POLLIN) {
+			eventfd_t count;
+			eventfd_read(channel->wakeFd, &count);
+		}
+		if(shmChannelReady(channel, reading)) {
+			result = 1;
+			break;
+		}
+		if(fds[1].revents & (POLLHUP | POLLERR)) {
+			errno = EPIPE;
+			result = -1;
+			break;
+		}
+		if(ready == 0) {
+			result = 0;
+			break;
+		}
+	}
+	*sleeping = 0;
+	return result;
+}
+
+// Makes the bytes written to the outgoing ring up to 'head' visible and wakes the other side if it sleeps
+static void shmChannelPublish(shm_channel_t *channel, uint32_t head) {
+	shm_ring_t *ring = channel->out;
+	if(head == ring->head)
+		return;
+	// The data has to be visible before the head, and the head before the sleep announcement is checked
+	__sync_synchronize();
+	ring->head = head;
+	__sync_synchronize();
+	if(ring->consumerSleeping)
+		shmChannelNotify(channel);
+}
+
+int shmChannelWritev(shm_channel_t *channel, const struct iovec *parts, int count) {
+	shm_ring_t *ring = channel->out;
+	uint32_t head = ring->head;
+	int p, slept = 0;
+	for(p=0; p<count; p++) {
+		const uint8_t *data = (const uint8_t*) parts[p].iov_base;
+		uint32_t length = parts[p].iov_len;
+		while(length > 0) {
+			uint32_t room = SHM_RING_SIZE - (head - ring->tail);
+			if(room == 0) {
+				// The other side can only make room for what it sees
+				shmChannelPublish(channel, head);
+				if(shmChannelSleep(channel, 0, -1) == -1)
+					return -1;
+				slept = 1;
+				continue;
+			}
+			uint32_t n = length < room ? length : room;
+			uint32_t offset = head & SHM_RING_MASK;
+			uint32_t first = n < SHM_RING_SIZE - offset ? n : SHM_RING_SIZE - offset;
+			memcpy(ring->data + offset, data, first);
+			memcpy(ring->data, data + first, n - first);
+			head += n;
+			data += n;
+			length -= n;
+		}
+	}
+	shmChannelPublish(channel, head);
+	// The signal consumed while sleeping may have announced bytes in the incoming ring to an event loop that
+	// watches wakeFd, like andrixswc's reactor, so it is passed on
+	if(slept)
+		eventfd_write(channel->wakeFd, 1);
+	return 0;
+}
+
+uint32_t shmChannelPeek(shm_channel_t *channel, const uint8_t **data) {
+	shm_ring_t *ring = channel->in;
+	if(ring->consumerSleeping)
+		ring->consumerSleeping = 0;
+	uint32_t available = ring->head - ring->tail;
+	// The head has to be read before the data it covers
+	__sync_synchronize();
+	uint32_t offset = ring->tail & SHM_RING_MASK;
+	*data = ring->data + offset;
+	return available < SHM_RING_SIZE - offset ? available : SHM_RING_SIZE - offset;
+}
+
+void shmChannelConsume(shm_channel_t *channel, uint32_t length) {
+	shm_ring_t *ring = channel->in;
+	// The data has to be read before the producer may overwrite it
+	__sync_synchronize();
+	ring->tail += length;
+	__sync_synchronize();
+	if(ring->producerSleeping)
+		shmChannelNotify(channel);
+}
+
+int shmChannelRead(shm_channel_t *channel, uint8_t *buffer, uint32_t length) {
+	while(length > 0) {
+		const uint8_t *data;
+		uint32_t available = shmChannelPeek(channel, &data);
+		if(available == 0) {
+			if(shmChannelSleep(channel, 1, -1) == -1)
+				return -1;
+			continue;
+		}
+		uint32_t n = length < available ? length : available;
+		memcpy(buffer, data, n);
+		shmChannelConsume(channel, n);
+		buffer += n;
+		length -= n;
+	}
+	return 0;
+}
+
+int shmChannelWait(shm_channel_t *channel, int timeout) {
+	if(shmChannelReady(channel, 1))
+		return 1;
+	return shmChannelSleep(channel, 1, timeout);
+}
+
+int shmChannelIdle(shm_channel_t *channel) {
+	shm_ring_t *ring = channel->in;
+	ring->consumerSleeping = 1;
+	__sync_synchronize();
+	if(ring->head == ring->tail)
+		return 1;
+	ring->consumerSleeping = 0;
+	return 0;
+}
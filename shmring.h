@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2015 Christoph Krofitsch, 
+ * Practical Robotics Institute Austria
+ * 
+ * This file is part of HedgehogLightPi.
+ * 
+ * HedgehogLightPi is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * HedgehogLightPi is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with HedgehogLightPi. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Transport between andrixswc and a user program that replaces the command pipes: two lock-free
+ * single-producer/single-consumer byte rings in a shared memory region, one per direction, which carry the same
+ * encoded AXCP stream as the pipes. Each side has an eventfd it sleeps on when its ring is empty or the other ring
+ * is full. A side only signals the other one's eventfd if the other one announced that it sleeps, so commands
+ * exchanged while both sides are busy cost no system calls at all.
+ * The region is passed to user programs as PROGRAM_RING_FD together with their eventfd PROGRAM_RING_WAKE_FD and
+ * andrixswc's eventfd PROGRAM_RING_NOTIFY_FD. Programs that don't find the region use the pipes instead.
+ */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <inttypes.h>
+#include <sys/uio.h>
+
+#define PROGRAM_RING_FD 206
+#define PROGRAM_RING_WAKE_FD 207
+#define PROGRAM_RING_NOTIFY_FD 208
+
+// Capacity of each ring in bytes. A power of two, so that positions wrap around by masking.
+#define SHM_RING_SIZE 65536
+#define SHM_RING_MASK (SHM_RING_SIZE - 1)
+
+// One ring. 'head' and 'tail' count all bytes ever written and read and wrap around at 2^32.
+typedef struct {
+	// Only changed by the producer
+	volatile uint32_t head;
+	// Set by the producer before it sleeps because the ring is full
+	volatile uint32_t producerSleeping;
+	// Padding, so that both sides don't write to the same cache line
+	uint8_t padding[56];
+	// Only changed by the consumer
+	volatile uint32_t tail;
+	// Set by the consumer before it sleeps because the ring is empty
+	volatile uint32_t consumerSleeping;
+	uint8_t padding2[56];
+	uint8_t data[SHM_RING_SIZE];
+} shm_ring_t;
+
+// Layout of the region
+typedef struct {
+	shm_ring_t toProgram;
+	shm_ring_t fromProgram;
+} shm_rings_t;
+
+// One side's end of the region
+typedef struct {
+	shm_rings_t *rings;
+	// Ring this side consumes and ring it produces
+	shm_ring_t *in;
+	shm_ring_t *out;
+	// eventfd this side sleeps on and eventfd of the other side
+	int wakeFd;
+	int notifyFd;
+	// File descriptor that reports POLLHUP once the other side is gone, or -1
+	int hangupFd;
+	// Statistics: signals sent to the other side and number of times this side slept
+	uint32_t notifications;
+	uint32_t sleeps;
+} shm_channel_t;
+
+/*
+ * Creates the region and both eventfds in andrixswc and initializes 'channel' as andrixswc's end. 'regionFd' is
+ * set to a file descriptor for the region that is passed to the user program and closed afterwards. All file
+ * descriptors are close-on-exec, i.e. have to be duplicated to the PROGRAM_RING_* fds in the child.
+ * Return: 0 on success or -1 on failure.
+ */
+int shmChannelCreate(shm_channel_t *channel, int *regionFd);
+
+/*
+ * Maps the region passed by andrixswc and initializes 'channel' as the user program's end. 'hangupFd' is as in
+ * shm_channel_t.
+ * Return: 0 on success or -1 if there is no region, i.e. the pipes have to be used.
+ */
+int shmChannelOpen(shm_channel_t *channel, int hangupFd);
+
+/*
+ * Unmaps the region and closes the eventfds of 'channel'.
+ */
+void shmChannelClose(shm_channel_t *channel);
+
+/*
+ * Writes the 'count' 'parts' to the outgoing ring, sleeping while it is full, and wakes the other side if it
+ * sleeps. As a sleeping writer may have consumed a signal meant for reading, its eventfd is signaled again
+ * afterwards.
+ * Return: 0 on success or -1 if the other side is gone or an error occurred.
+ */
+int shmChannelWritev(shm_channel_t *channel, const struct iovec *parts, int count);
+
+/*
+ * Assigns the contiguous span of readable bytes in the incoming ring to 'data' without consuming them, i.e.
+ * shmChannelConsume() has to be called once they have been handled. Withdraws an announcement of
+ * shmChannelIdle().
+ * Return: the number of bytes in the span, which may be less than the number of readable bytes if they wrap
+ * around, or 0 if the ring is empty.
+ */
+uint32_t shmChannelPeek(shm_channel_t *channel, const uint8_t **data);
+
+/*
+ * Consumes 'length' bytes of the incoming ring and wakes the other side if it waits for room.
+ */
+void shmChannelConsume(shm_channel_t *channel, uint32_t length);
+
+/*
+ * Reads exactly 'length' bytes from the incoming ring into 'buffer', sleeping while it is empty.
+ * Return: 0 on success or -1 if the other side is gone or an error occurred.
+ */
+int shmChannelRead(shm_channel_t *channel, uint8_t *buffer, uint32_t length);
+
+/*
+ * Sleeps until the incoming ring is not empty or 'timeout' milliseconds have passed. A 'timeout' of -1 waits
+ * infinitely.
+ * Return: 1 if there are bytes to read, 0 on timeout or -1 if the other side is gone or an error occurred.
+ */
+int shmChannelWait(shm_channel_t *channel, int timeout);
+
+/*
+ * Announces that this side goes to sleep until its eventfd is signaled, e.g. in an event loop, unless bytes
+ * arrived in the meantime. The eventfd has to be read by the caller on wakeup.
+ * Return: 1 if this side may sleep or 0 if there are bytes to read.
+ */
+int shmChannelIdle(shm_channel_t *channel);
+
+#endif
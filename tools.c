@@ -20,6 +20,8 @@
 
 #include "tools.h"
 
+#include <time.h>
+
 int fullRead(int fd, uint8_t* buffer, const int length) {
 	int curLen = 0, temp = 0; 
 	// Loops until all bytes have been read
@@ -43,3 +45,35 @@ int fullWrite(int fd, const uint8_t* buffer, const int length) {
 	}
 	return 0;
 }
+
+int fullWritev(int fd, struct iovec* iov, int count) {
+	// Loops until all buffers have been written
+	while(count > 0) {
+		ssize_t temp = writev(fd, iov, count);
+		if(temp == -1)
+			return -1;
+		// Skip the buffers that were written completely and advance into the one written partially
+		while(count > 0 && (size_t) temp >= iov->iov_len) {
+			temp -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if(count > 0) {
+			iov->iov_base = (uint8_t*) iov->iov_base + temp;
+			iov->iov_len -= temp;
+		}
+	}
+	return 0;
+}
+
+uint64_t timeMillis() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+uint64_t timeMicros() {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
@@ -20,6 +20,7 @@
 
 #include <unistd.h>
 #include <inttypes.h>
+#include <sys/uio.h>
 
 /*
  * Reads exactly 'length' bytes into 'buffer' from 'fd'. Blocks until all bytes have been read.
@@ -32,3 +33,21 @@ int fullRead(int fd, uint8_t* buffer, const int length);
  * Return: 0 on success or -1 if one write operation returned -1.
  */
 int fullWrite(int fd, const uint8_t* buffer, const int length);
+
+/*
+ * Writes all 'count' buffers described by 'iov' into 'fd', using a single writev() if 'fd' accepts all bytes at
+ * once. Blocks until all bytes have been written. The contents of 'iov' are modified.
+ * Return: 0 on success or -1 if one write operation returned -1.
+ */
+int fullWritev(int fd, struct iovec* iov, int count);
+
+/*
+ * Return: the current time of a monotonic clock in milliseconds, i.e. a time that is only suitable for measuring
+ * durations, as it is unaffected by changes of the system time.
+ */
+uint64_t timeMillis();
+
+/*
+ * Return: the current time of the same clock as timeMillis() in microseconds.
+ */
+uint64_t timeMicros();
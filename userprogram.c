@@ -19,6 +19,20 @@
  */
 
 #include "userprogram.h"
+#include "sharedstate.h"
+
+#include <poll.h>
+
+// Custom data is received in pieces of at most this many bytes, so that every reply fits on the stack
+#define CUSTOM_DATA_PIECE_SIZE 1024
+
+// Handlers registered via registerUpdateHandler(), indexed by opcode
+static update_handler_t updateHandlers[256];
+static uint32_t updateRecordLengths[256];
+
+// Cleared once the hardware controller rejected a bulk request as unknown; from then on readAllSensors() reads
+// every port on its own
+static int bulkRequests = 1;
 
 void msleep(int ms) {
 	if(ms < 0)
@@ -26,37 +40,216 @@ void msleep(int ms) {
 	usleep(ms * 1000);
 }
 
+// Receives the reply to the custom data request 'send' of 'sendLen' bytes into 'data', which must hold
+// CUSTOM_DATA_PIECE_SIZE bytes.
+// Return: the number of bytes received or -1 if the request failed
+static int requestCustomData(uint8_t* send, uint32_t sendLen, uint8_t* data) {
+	uint8_t receive[CUSTOM_DATA_PIECE_SIZE + 1];
+	uint32_t receiveLen;
+	if(userProgramRequestInto(send, sendLen, receive, sizeof(receive), &receiveLen) != 0)
+		return -1;
+	memcpy(data, receive + 1, receiveLen - 1);
+	return receiveLen - 1;
+}
+
+// Reads up to 'length' available custom data bytes, at most CUSTOM_DATA_PIECE_SIZE, into 'data'
+// Return: the number of bytes read or -1 if the request failed
+static int readCustomDataPiece(uint8_t* data, uint32_t length) {
+	uint8_t send[5];
+	send[0] = READ_CUSTOM_DATA_REQUEST_SWCINTERN;
+	send[1] = ((length >> 24) & 0xFF);
+	send[2] = ((length >> 16) & 0xFF);
+	send[3] = ((length >> 8) & 0xFF);
+	send[4] = (length & 0xFF);
+	return requestCustomData(send, 5, data);
+}
+
+// Reads available custom data into 'data' until 'received' of 'length' bytes are there or no more is available
+// Return: the number of bytes received in total
+static uint32_t readCustomDataPieces(uint8_t* data, uint32_t received, uint32_t length) {
+	while(received < length) {
+		uint32_t piece = length - received < CUSTOM_DATA_PIECE_SIZE ? length - received : CUSTOM_DATA_PIECE_SIZE;
+		int n = readCustomDataPiece(data + received, piece);
+		if(n <= 0)
+			break;
+		received += n;
+		// A piece that isn't full means that nothing more is available
+		if((uint32_t) n < piece)
+			break;
+	}
+	return received;
+}
+
 void readCustomData(uint8_t* data, uint32_t length) {
-        uint8_t send[5];
-        send[0] = READ_CUSTOM_DATA_REQUEST_SWCINTERN;
-        send[1] = ((length >> 24) & 0xFF);
-        send[2] = ((length >> 16) & 0xFF);
-        send[3] = ((length >> 8) & 0xFF);
-        send[4] = (length & 0xFF);
-        uint8_t *receive;
-        uint32_t receiveLen;
-        // Receive the desired data from the parent process holding the ringbuffer
-        userProgramRequest(send, 5, &receive, &receiveLen);
-        memcpy(data, receive + 1, receiveLen - 1);
-        free(receive);
+	// Receive the desired data from the parent process holding the ringbuffer
+	uint32_t received = readCustomDataPieces(data, 0, length);
+	// Only the available bytes are sent
+	memset(data + received, 0, length - received);
+}
+
+int waitCustomData(uint8_t* data, uint32_t minimum, uint32_t capacity, int timeout) {
+	uint8_t send[13];
+	uint32_t wait = timeout < 0 ? 0xFFFFFFFF : (uint32_t) timeout;
+	uint32_t piece = capacity < CUSTOM_DATA_PIECE_SIZE ? capacity : CUSTOM_DATA_PIECE_SIZE;
+	if(minimum > capacity)
+		minimum = capacity;
+	send[0] = WAIT_CUSTOM_DATA_REQUEST_SWCINTERN;
+	send[1] = (minimum >> 24) & 0xFF;
+	send[2] = (minimum >> 16) & 0xFF;
+	send[3] = (minimum >> 8) & 0xFF;
+	send[4] = minimum & 0xFF;
+	send[5] = (piece >> 24) & 0xFF;
+	send[6] = (piece >> 16) & 0xFF;
+	send[7] = (piece >> 8) & 0xFF;
+	send[8] = piece & 0xFF;
+	send[9] = (wait >> 24) & 0xFF;
+	send[10] = (wait >> 16) & 0xFF;
+	send[11] = (wait >> 8) & 0xFF;
+	send[12] = wait & 0xFF;
+	// andrixswc replies once enough data arrived or the timeout passed
+	int received = requestCustomData(send, 13, data);
+	if(received == -1)
+		return -1;
+	// The rest of the data that was available is read piece by piece
+	if((uint32_t) received == piece)
+		received = readCustomDataPieces(data, received, capacity);
+	return received;
 }
 
 uint32_t customDataAvailable() {
         uint8_t send[1];
         send[0] = CUSTOM_DATA_AVAILABLE_REQUEST_SWCINTERN;
-        uint8_t* receive;
+        uint8_t receive[5];
         uint32_t receiveLen;
         // Recieve the desired information from the parent process holding the ringbuffer.
-        userProgramRequest(send, 1, &receive, &receiveLen);
+        userProgramRequestInto(send, 1, receive, sizeof(receive), &receiveLen);
         uint32_t result = ((receive[1] << 24) | (receive[2] << 16) | (receive[3] << 8) | receive[4]);
-        free(receive);
         return result;
 }
 
 void sendCustomData(uint8_t* buffer, uint32_t length) {
-        uint8_t send[length + 1];
-        send[0] = SEND_CUSTOM_DATA_ACTION_SWCINTERN;
-        memcpy(send + 1, buffer, length);
-        userProgramSend(send, length + 1);
+        uint8_t opcode = SEND_CUSTOM_DATA_ACTION_SWCINTERN;
+        struct iovec parts[2];
+        parts[0].iov_base = &opcode;
+        parts[0].iov_len = 1;
+        parts[1].iov_base = buffer;
+        parts[1].iov_len = length;
+        userProgramSendv(parts, 2);
+}
+
+void beginBatch() {
+	userProgramBeginBatch();
 }
 
+void commitBatch() {
+	userProgramCommitBatch();
+}
+
+int receiveUpdate(uint8_t *command, uint32_t capacity, uint32_t *length, int timeout) {
+	struct pollfd event;
+	event.fd = PROGRAM_EVENT_FD;
+	event.events = POLLIN;
+	int result = poll(&event, 1, timeout);
+	if(result <= 0)
+		return result;
+	// A truncated update still holds complete records at its start
+	if(axcpReceiveAndDecodeInto(PROGRAM_EVENT_FD, command, capacity, length) == -1)
+		return -1;
+	return 1;
+}
+
+int requestPortTimeout(uint8_t request, uint8_t port, int timeout, uint8_t *answer, int kind, int32_t *last) {
+	uint8_t send[2];
+	uint32_t answerLen;
+	uint64_t age;
+	if(userProgramRequestTimeout(send, axcpBuildPortCommand(send, request, port), answer, 6, &answerLen, timeout) == 0)
+		return 0;
+	*last = 0;
+	return sharedStateReadAged(kind, port, last, &age) ? 1 : -1;
+}
+
+// Reads all ports of 'kind' with single port requests, or their last known value if that fails
+static int readAllPorts(int kind, int32_t *values) {
+	uint8_t request = kind == SHARED_STATE_ANALOG ? ANALOG_SENSOR_REQUEST : DIGITAL_SENSOR_REQUEST;
+	uint8_t answer[6];
+	int port, result = 0;
+	for(port=0; port<AXCP_SENSOR_PORTS; port++) {
+		int read = requestPortTimeout(request, port, -1, answer, kind, &values[port]);
+		if(read == 0)
+			values[port] = kind == SHARED_STATE_ANALOG ? axcpParseAnalogReply(answer) : axcpParseDigitalReply(answer);
+		if(read == -1 || (read == 1 && result == 0))
+			result = read;
+	}
+	return result;
+}
+
+// Assigns the last known values of all ports of 'kind' to 'values', or 0 to those without one
+static int readAllLastKnown(int kind, int32_t *values) {
+	uint64_t age;
+	int port, result = 1;
+	for(port=0; port<AXCP_SENSOR_PORTS; port++) {
+		if(!sharedStateReadAged(kind, port, &values[port], &age)) {
+			values[port] = 0;
+			result = -1;
+		}
+	}
+	return result;
+}
+
+int readAllSensors(int kind, int32_t *values) {
+	int port;
+	for(port=0; port<AXCP_SENSOR_PORTS && sharedStateRead(kind, port, &values[port]); port++)
+		;
+	if(port == AXCP_SENSOR_PORTS)
+		return 0;
+	if(!bulkRequests)
+		return readAllPorts(kind, values);
+
+	uint8_t send[1];
+	// Large enough for either bulk reply
+	uint8_t answer[21];
+	uint32_t answerLen, expected = kind == SHARED_STATE_ANALOG ? 21 : 3;
+	send[0] = kind == SHARED_STATE_ANALOG ? ANALOG_SENSOR_ALL_REQUEST : DIGITAL_SENSOR_ALL_REQUEST;
+	int result = userProgramRequestInto(send, 1, answer, expected, &answerLen);
+	if(result == -5 && userProgramErrorCode == ERRORCODE_UNSPECIFIED_OPCODE) {
+		bulkRequests = 0;
+		return readAllPorts(kind, values);
+	}
+	// The hardware controller knows the bulk request, but didn't answer it, e.g. in time
+	if(result != 0 || answerLen != expected)
+		return readAllLastKnown(kind, values);
+	if(kind == SHARED_STATE_ANALOG) {
+		int analog[AXCP_SENSOR_PORTS];
+		axcpParseAnalogAllReply(answer, analog);
+		for(port=0; port<AXCP_SENSOR_PORTS; port++)
+			values[port] = analog[port];
+	} else {
+		uint16_t mask = axcpParseDigitalAllReply(answer);
+		for(port=0; port<AXCP_SENSOR_PORTS; port++)
+			values[port] = (mask >> port) & 1;
+	}
+	return 0;
+}
+
+void registerUpdateHandler(uint8_t opcode, uint32_t recordLength, update_handler_t handler) {
+	updateHandlers[opcode] = handler;
+	updateRecordLengths[opcode] = recordLength;
+}
+
+int waitForEvents(int timeout) {
+	uint8_t command[256];
+	uint32_t length;
+	int received = 0;
+	int result = receiveUpdate(command, sizeof(command), &length, timeout);
+	while(result == 1) {
+		received++;
+		update_handler_t handler = updateHandlers[command[0]];
+		uint32_t recordLength = updateRecordLengths[command[0]];
+		uint32_t i;
+		if(handler != NULL && recordLength > 0)
+			for(i=1; i + recordLength <= length; i += recordLength)
+				handler(command + i);
+		result = receiveUpdate(command, sizeof(command), &length, 0);
+	}
+	return result == -1 ? -1 : received;
+}
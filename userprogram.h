@@ -23,6 +23,9 @@
  * controller is used.
  */
 
+#ifndef USERPROGRAM_H
+#define USERPROGRAM_H
+
 #include "axcp.h"
 
 /*
@@ -39,6 +42,16 @@ void msleep(int ms);
  */
 void readCustomData(uint8_t* buffer, uint32_t length);
 
+/*
+ * Function for user programs to wait until at least 'minimum' bytes application-specific custom data are
+ * available and receive up to 'capacity' of them into 'buffer'. Unlike polling customDataAvailable(), the
+ * user program sleeps until the data arrived or 'timeout' milliseconds passed (-1 waits infinitely, 0 doesn't
+ * wait).
+ * Return: The number of bytes received, which is less than 'minimum' if the timeout passed, or -1 if there was
+ * an I/O error.
+ */
+int waitCustomData(uint8_t* buffer, uint32_t minimum, uint32_t capacity, int timeout);
+
 /*
  * Function for user programs to check how many application-specific custom data bytes are available,
  * i.e. have been received so far.
@@ -51,3 +64,71 @@ uint32_t customDataAvailable();
  */  
 void sendCustomData(uint8_t* buffer, uint32_t length);
 
+/*
+ * Starts a batch: the actions issued from now on, e.g. by moveAtPower() or setPosition(), are collected and
+ * only sent when commitBatch() is called, all at once. This is much cheaper for programs that update many
+ * motors or servos in every cycle, and the hardware controller receives the actions in one burst. Reading a
+ * sensor while a batch is open sends the actions collected so far first.
+ */
+void beginBatch();
+
+/*
+ * Sends all actions collected since beginBatch() and ends the batch.
+ */
+void commitBatch();
+
+/*
+ * Waits up to 'timeout' milliseconds (-1 waits infinitely, 0 doesn't wait) for the next update of a
+ * subscription, e.g. see subscribeAnalog(), and receives the plain update command into 'command' of 'capacity'
+ * bytes. Its payload is a list of records, each being the payload of the according reply, e.g. [port, value
+ * high byte, value low byte] for ANALOG_SENSOR_UPDATE. Updates are also readable via poll() on PROGRAM_EVENT_FD.
+ * Return: 1 if an update was received, 0 if 'timeout' passed or -1 if there was an I/O error.
+ */
+int receiveUpdate(uint8_t *command, uint32_t capacity, uint32_t *length, int timeout);
+
+// Update interval of the subscriptions made when registering callbacks like onDigitalChange()
+#define EVENT_UPDATE_INTERVAL_MS 10
+
+/*
+ * Handler for one 'record' of an update or event command, i.e. the payload of the according reply, e.g.
+ * [port, level] for DIGITAL_SENSOR_UPDATE.
+ */
+typedef void (*update_handler_t)(const uint8_t *record);
+
+/*
+ * Makes waitForEvents() pass every record of 'recordLength' bytes in commands with 'opcode' to 'handler'. A
+ * 'handler' of NULL stops handling 'opcode'. Used by the hardware controller libraries to implement callbacks
+ * like onDigitalChange().
+ */
+void registerUpdateHandler(uint8_t opcode, uint32_t recordLength, update_handler_t handler);
+
+/*
+ * Sends the port 'request' for 'port' and receives the reply into 'answer' of 6 bytes within 'timeout'
+ * milliseconds (-1 waits infinitely). If that fails, the last known value of 'kind' (see sharedstate.h) is
+ * assigned to 'last'. Used by the hardware controller libraries to implement functions like analogTimeout().
+ * Return: 0 if the reply was received, 1 if 'last' was assigned or -1 if there is no value at all.
+ */
+int requestPortTimeout(uint8_t request, uint8_t port, int timeout, uint8_t *answer, int kind, int32_t *last);
+
+/*
+ * Reads the sensors of 'kind', SHARED_STATE_ANALOG or SHARED_STATE_DIGITAL, of all AXCP_SENSOR_PORTS ports into
+ * 'values'. They are taken from the shared state if all are fresh and fetched with one bulk request otherwise.
+ * Only once the hardware controller rejected the bulk request as unknown, every port is requested on its own,
+ * see requestPortTimeout(). If a request fails otherwise, e.g. because the hardware controller didn't answer in
+ * time, the last known values are used. Used by the hardware controller libraries to implement readAllAnalog()
+ * and readAllDigital().
+ * Return: 0 if all values are current, 1 if some are the last known ones or -1 if a value is not known at all,
+ * in which case it is 0.
+ */
+int readAllSensors(int kind, int32_t *values);
+
+/*
+ * Waits up to 'timeout' milliseconds (-1 waits infinitely, 0 doesn't wait) for updates and events and passes
+ * them to the registered handlers, which invoke the callbacks registered by the program. Once something
+ * arrived, everything else that is already available is handled as well without waiting. Must not be mixed
+ * with receiveUpdate(), as both consume the same updates.
+ * Return: the number of updates and events received or -1 if there was an I/O error.
+ */
+int waitForEvents(int timeout);
+
+#endif